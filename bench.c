@@ -0,0 +1,459 @@
+/*
+ * bench.c - throughput benchmark for the DSP routines
+ *
+ * Each kernel is run over the same input a number of times, after one
+ * untimed warm-up run, and the time per input sample is reported as
+ * the minimum, median and 99th percentile over the runs, along with the
+ * median throughput. The decoders keep their state from one run to the
+ * next, so after the warm-up they are doing what they do on the air.
+ *
+ * The synthetic input is a WWV-like second (tick, 500-Hz tone and
+ * 100-Hz subcarrier) for the WWV kernels, a 300-baud Bell 103 FSK
+ * signal for the CHU kernel and the sum of both for the rest, all with
+ * a little noise. A recording, raw 16-bit samples, can be given with -f
+ * and is then run as well, wrapped around if it is shorter than a run.
+ * The resampler treats the input as 48-kHz samples and addtone() takes
+ * none, so its figures are per sample generated.
+ *
+ * The process is pinned to one processor, by default the one it starts
+ * on, and the decoder output is sent to /dev/null. Results go to the
+ * standard output as CSV, or JSON with -j.
+ *
+ * Build with the decoders and their support modules, which must be
+ * compiled with NO_MAIN defined:
+ *
+ *	cc -O2 -DNO_MAIN -o bench bench.c wwv.c chu.c irig.c
+ *	    resample48to8.c tones-wwv.c pool.c wwvtlm.c ntp_systime.c
+ *	    caljulian.c md5.c -lm -lpthread
+ *
+ * The synthetic inputs carry no IRIG signal, so the IRIG demodulator
+ * keeps checking the format on them. Its steady-state cost is measured
+ * on an IRIG recording given with -f.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include "ntp_fp.h"
+
+#define SECOND		8000	/* sample rate (Hz) */
+#define RUNS		21	/* default runs */
+#define RUNSEC		10	/* default run length (s) */
+#define CHUNK		8000	/* samples per call */
+#define RSN		80	/* resampler outputs per call */
+
+/*
+ * The routines under test
+ */
+struct wwvunit;
+struct chuunit;
+struct irigunit;
+struct wwvunit *wwv_start(int unit, const char *statefile);
+void wwv_shutdown(int unit, struct wwvunit *up);
+void wwv_rf(struct wwvunit *up, float isig);
+void wwv_receive(struct wwvunit *up, int16_t *recv_buffer, unsigned int recv_length, l_fp recv_time);
+struct chuunit *chu_start(void);
+void chu_shutdown(struct chuunit *up);
+void chu_rf(struct chuunit *up, float sample);
+struct irigunit *irig_start(unsigned int rate);
+void irig_shutdown(struct irigunit *up);
+void irig_receive(struct irigunit *up, int16_t *recv_buffer, unsigned int recv_length, l_fp recv_time);
+void codec2_48_to_8(float *out8k, float *in48k, unsigned int n);
+void addtone(int16_t *start, size_t len, unsigned hz, unsigned amp);
+
+/*
+ * A kernel is set up once per input, run over the input in chunks and
+ * torn down. The input flags say which inputs it runs on.
+ */
+#define IN_WWV		0x1	/* synthetic WWV */
+#define IN_CHU		0x2	/* synthetic CHU */
+#define IN_MIX		0x4	/* synthetic WWV + CHU */
+#define IN_FILE		0x8	/* recording */
+#define IN_NONE		0x10	/* no input */
+
+struct kernel {
+	const char *name;
+	int	inputs;		/* inputs it runs on */
+	void	*(*init)(void);
+	void	(*run)(void *ctx, int16_t *buf, unsigned int n);
+	void	(*fini)(void *ctx);
+};
+
+/*
+ * wwv_rf - the per-sample WWV path, as the decoder ran originally
+ */
+static void *wwv_rf_init(void)
+{
+	return (wwv_start(2, NULL));
+}
+
+static void wwv_rf_run(void *ctx, int16_t *buf, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		wwv_rf(ctx, buf[i]);
+}
+
+/*
+ * wwv_receive - the block WWV path, with the clipper, VFO and vector
+ * filters and mixers
+ */
+static void wwv_receive_run(void *ctx, int16_t *buf, unsigned int n)
+{
+	l_fp	t;
+
+	t.l_ui = t.l_uf = 0;
+	wwv_receive(ctx, buf, n, t);
+}
+
+static void wwv_fini(void *ctx)
+{
+	wwv_shutdown(2, ctx);
+}
+
+/*
+ * chu_rf - the CHU filters, discriminator and UARTs
+ */
+static void *chu_init(void)
+{
+	return (chu_start());
+}
+
+static void chu_run(void *ctx, int16_t *buf, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++)
+		chu_rf(ctx, buf[i]);
+}
+
+static void chu_fini(void *ctx)
+{
+	chu_shutdown(ctx);
+}
+
+/*
+ * irig_receive - the IRIG filters, demodulator and decoder
+ */
+static void *irig_init(void)
+{
+	return (irig_start(SECOND));
+}
+
+static void irig_run(void *ctx, int16_t *buf, unsigned int n)
+{
+	l_fp	t;
+
+	t.l_ui = t.l_uf = 0;
+	irig_receive(ctx, buf, n, t);
+}
+
+static void irig_fini(void *ctx)
+{
+	irig_shutdown(ctx);
+}
+
+/*
+ * codec2_48_to_8 - the 48-to-8-kHz decimator. The input buffer keeps
+ * 48 samples of history on each side of the 6 * RSN new ones.
+ */
+struct rsctx {
+	float	in[48 * RSN + 144];
+	float	out[RSN];
+};
+
+static void *rs_init(void)
+{
+	return (calloc(1, sizeof(struct rsctx)));
+}
+
+static void rs_run(void *ctx, int16_t *buf, unsigned int n)
+{
+	struct rsctx *rp = ctx;
+	unsigned int i, j;
+
+	for (i = 0; i + 6 * RSN <= n; i += 6 * RSN) {
+		for (j = 0; j < 6 * RSN; j++)
+			rp->in[48 + j] = buf[i + j];
+		codec2_48_to_8(rp->out, rp->in + 48, RSN);
+	}
+}
+
+static void rs_fini(void *ctx)
+{
+	free(ctx);
+}
+
+/*
+ * addtone - the tone generator of the WWV simulator. The tone is added
+ * to the copy of the input, as the simulator adds it to its output.
+ */
+static void *tone_init(void)
+{
+	return (NULL);
+}
+
+static void tone_run(void *ctx, int16_t *buf, unsigned int n)
+{
+	(void)ctx;
+	addtone(buf, n, 1000, 50);
+}
+
+static void tone_fini(void *ctx)
+{
+	(void)ctx;
+}
+
+static const struct kernel kernels[] = {
+	{"wwv_rf", IN_WWV | IN_MIX | IN_FILE, wwv_rf_init, wwv_rf_run, wwv_fini},
+	{"wwv_receive", IN_WWV | IN_MIX | IN_FILE, wwv_rf_init, wwv_receive_run, wwv_fini},
+	{"chu_rf", IN_CHU | IN_MIX | IN_FILE, chu_init, chu_run, chu_fini},
+	{"irig_receive", IN_MIX | IN_FILE, irig_init, irig_run, irig_fini},
+	{"codec2_48_to_8", IN_MIX | IN_FILE, rs_init, rs_run, rs_fini},
+	{"addtone", IN_NONE, tone_init, tone_run, tone_fini},
+	{NULL, 0, NULL, NULL, NULL}
+};
+
+/*
+ * Noise from a linear congruential generator, roughly uniform in
+ * [-amp, amp)
+ */
+static uint32_t seed = 1;
+
+static int noise(int amp)
+{
+	seed = seed * 1664525 + 1013904223;
+	return ((int)((seed >> 16) % (2 * amp)) - amp);
+}
+
+static int16_t clip16(int x)
+{
+	return (x > 32767 ? 32767 : x < -32768 ? -32768 : x);
+}
+
+/*
+ * synth_wwv - seconds of WWV: 5-ms tick, 500-Hz tone and a 100-Hz
+ * subcarrier pulse of 200, 500 or 800 ms in turn
+ */
+static void synth_wwv(int16_t *buf, unsigned int n)
+{
+	static const unsigned int bitlen[3] = {200, 500, 800};
+	unsigned int i, k;
+
+	memset(buf, 0, n * sizeof(int16_t));
+	for (i = 0, k = 0; i + SECOND <= n; i += SECOND, k++) {
+		addtone(buf + i, 5 * SECOND / 1000, 1000, 50);
+		addtone(buf + i + 30 * SECOND / 1000, 960 * SECOND / 1000,
+		    500, 25);
+		addtone(buf + i + 30 * SECOND / 1000, bitlen[k % 3] *
+		    SECOND / 1000, 100, 12);
+	}
+	for (i = 0; i < n; i++)
+		buf[i] = clip16(buf[i] + noise(1000));
+}
+
+/*
+ * synth_chu - random bits at 300 baud, mark 2225 Hz and space 2025 Hz
+ */
+static void synth_chu(int16_t *buf, unsigned int n)
+{
+	double	phase = 0, baud = 0;
+	unsigned int i;
+	int	bit = 1;
+
+	for (i = 0; i < n; i++) {
+		baud += 300. / SECOND;
+		if (baud >= 1) {
+			baud -= 1;
+			bit = noise(1000) >= 0;
+		}
+		phase += 2 * M_PI * (bit ? 2225 : 2025) / SECOND;
+		if (phase > 2 * M_PI)
+			phase -= 2 * M_PI;
+		buf[i] = clip16((int)(8000 * sin(phase)) + noise(1000));
+	}
+}
+
+/*
+ * load - read a recording into buf, repeating it to fill n samples
+ */
+static int load(const char *path, int16_t *buf, unsigned int n)
+{
+	unsigned int have = 0, m;
+	ssize_t	len;
+	int	fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (-1);
+	while (have < n && (len = read(fd, buf + have, (n - have) *
+	    sizeof(int16_t))) > 0)
+		have += len / sizeof(int16_t);
+	close(fd);
+	if (have == 0)
+		return (-1);
+	for (m = have; have < n; have++)
+		buf[have] = buf[have % m];
+	return (0);
+}
+
+static int cmpd(const void *a, const void *b)
+{
+	double	x = *(const double *)a, y = *(const double *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * bench - time one kernel on one input. Returns ns per sample for each
+ * run in ns, sorted.
+ */
+static void bench(const struct kernel *kp, int16_t *in, unsigned int n, int runs, double *ns)
+{
+	struct timespec t1, t2;
+	int16_t	*buf;
+	void	*ctx;
+	unsigned int i, len;
+	int	r;
+
+	buf = malloc(CHUNK * sizeof(int16_t));
+	ctx = kp->init();
+	for (r = -1; r < runs; r++) {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+		for (i = 0; i < n; i += len) {
+			len = n - i < CHUNK ? n - i : CHUNK;
+
+			/*
+			 * Some kernels write their input, so give them
+			 * a copy. The copy is timed as well, but it is
+			 * small beside the kernels.
+			 */
+			memcpy(buf, in + i, len * sizeof(int16_t));
+			kp->run(ctx, buf, len);
+		}
+		clock_gettime(CLOCK_MONOTONIC_RAW, &t2);
+		if (r >= 0)
+			ns[r] = ((t2.tv_sec - t1.tv_sec) * 1e9 +
+			    (t2.tv_nsec - t1.tv_nsec)) / n;
+	}
+	kp->fini(ctx);
+	free(buf);
+	qsort(ns, runs, sizeof(double), cmpd);
+}
+
+int main(int argc, char **argv)
+{
+	const char *usage_str = "Usage: bench [-c cpu] [-f file] [-j] [-r runs] [-s seconds]\n";
+	static const struct {
+		int	flag;
+		const char *name;
+	} inputs[] = {
+		{IN_WWV, "wwv"}, {IN_CHU, "chu"}, {IN_MIX, "mix"},
+		{IN_FILE, "file"}, {IN_NONE, "none"}
+	};
+	const struct kernel *kp;
+	const char *file = NULL;
+	int16_t	*in[5];
+	double	*ns, med;
+	cpu_set_t cpus;
+	FILE	*out;
+	unsigned int n, i;
+	int	cpu = -1, json = 0, runs = RUNS, secs = RUNSEC;
+	int	option, j, first = 1, devnull;
+
+	while ((option = getopt(argc, argv, "c:f:jr:s:")) != -1) {
+		switch (option) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'r':
+			runs = atoi(optarg);
+			break;
+		case 's':
+			secs = atoi(optarg);
+			break;
+		default:
+			fputs(usage_str, stderr);
+			return (1);
+		}
+	}
+	if (runs < 1 || secs < 1) {
+		fputs(usage_str, stderr);
+		return (1);
+	}
+
+	/*
+	 * Pin to one processor and keep the decoder monitor lines out of
+	 * the results.
+	 */
+	if (cpu < 0)
+		cpu = sched_getcpu();
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+		fprintf(stderr, "bench: cannot pin to cpu %d\n", cpu);
+	out = fdopen(dup(1), "w");
+	if ((devnull = open("/dev/null", O_WRONLY)) >= 0)
+		dup2(devnull, 1);
+
+	n = secs * SECOND;
+	ns = malloc(runs * sizeof(double));
+	for (j = 0; j < 5; j++)
+		in[j] = malloc(n * sizeof(int16_t));
+	synth_wwv(in[0], n);
+	synth_chu(in[1], n);
+	for (i = 0; i < n; i++)
+		in[2][i] = clip16(in[0][i] + in[1][i]);
+	if (file != NULL && load(file, in[3], n) < 0) {
+		fprintf(stderr, "bench: cannot read %s\n", file);
+		return (1);
+	}
+	memset(in[4], 0, n * sizeof(int16_t));
+
+	if (json)
+		fprintf(out, "{\"cpu\": %d, \"runs\": %d, \"samples\": %u, \"results\": [\n",
+		    cpu, runs, n);
+	else
+		fprintf(out, "kernel,input,samples,runs,min_ns,median_ns,p99_ns,msps\n");
+	for (kp = kernels; kp->name != NULL; kp++) {
+		for (j = 0; j < 5; j++) {
+			if (!(kp->inputs & inputs[j].flag) ||
+			    (inputs[j].flag == IN_FILE && file == NULL))
+				continue;
+			bench(kp, in[j], n, runs, ns);
+			med = ns[runs / 2];
+			i = (unsigned int)ceil(.99 * runs) - 1;
+			if (json)
+				fprintf(out, "%s  {\"kernel\": \"%s\", \"input\": \"%s\", \"min_ns\": %.3f, \"median_ns\": %.3f, \"p99_ns\": %.3f, \"msps\": %.3f}",
+				    first ? "" : ",\n", kp->name,
+				    inputs[j].name, ns[0], med, ns[i],
+				    1e3 / med);
+			else
+				fprintf(out, "%s,%s,%u,%d,%.3f,%.3f,%.3f,%.3f\n",
+				    kp->name, inputs[j].name, n, runs,
+				    ns[0], med, ns[i], 1e3 / med);
+			fflush(out);
+			first = 0;
+		}
+	}
+	if (json)
+		fprintf(out, "\n]}\n");
+	fclose(out);
+	for (j = 0; j < 5; j++)
+		free(in[j]);
+	free(ns);
+	return (0);
+}
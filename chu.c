@@ -10,9 +10,15 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <signal.h>
+#include <getopt.h>
 #include "ntp_fp.h"
+#include "ntpshm.h"
+#include "pool.h"
+#include "simd.h"
+#include "wavfile.h"
 #define CLOCK_CODEC_OFFSET 0
-#define MAXGAIN 16383
 #define	LEAP_NOWARNING	0x0	/* normal */
 #define	LEAP_NOTINSYNC	0x3	/* overload, clock is free running */
 
@@ -35,6 +41,10 @@
  * tuned automatically as propagation conditions change throughout the
  * day and season.
  *
+ * With three receivers, one on each frequency, the driver can decode
+ * all three at once (see chu_multi()). The bursts heard on any of them
+ * count toward the minute, so a fade on one frequency costs little.
+ *
  * The driver requires an audio codec or sound card with sampling rate 8
  * kHz and mu-law companding. This is the same standard as used by the
  * telephone industry and is supported by most hardware and operating
@@ -140,11 +150,10 @@
  * The nibble-swapped timecode shows DUT1 +0.1 second, year 1998 and TAI
  * - UTC 31 seconds.
  *
- * Each line is preceeded by the code chuA or chuB, as appropriate. If
- * the audio driver is compiled, the current gain (0-255) and relative
- * signal level (0-9999) follow the code. The receiver volume control
- * should be set so that the gain is somewhere near the middle of the
- * range 0-255, which results in a signal level near 1000.
+ * Each line is preceeded by the code chuA or chuB, as appropriate. The
+ * status and the input signal level (rms) follow the code. A digital
+ * AGC scales the input to suit the demodulator, so the receiver volume
+ * control need only be set to keep the codec well clear of clipping.
  *
  * In addition to the above, the reference timecode is updated and
  * written to the clockstats file and debug score after the last burst
@@ -160,7 +169,7 @@
  * l	leap second indicator (space, L or D)
  * dst	Canadian daylight code (opaque)
  * t	number of minutes since last synchronized
- * agc	audio gain (0 - 255)
+ * agc	AGC gain (dB)
  * ident identifier (CHU0 3330 kHz, CHU1 7850 kHz, CHU2 14670 kHz)
  * m	signal metric (0 - 100)
  * b	number of timecodes for the previous minute (0 - 59)
@@ -203,6 +212,7 @@
  */
 #define	PRECISION	(-10)	/* precision assumed (about 1 ms) */
 #define	REFID		"CHU"	/* reference ID */
+#define	SHMUNIT		8	/* default NTP shared memory unit */
 
 /*
  * Audio demodulator definitions
@@ -213,14 +223,34 @@
 #define SIZE		256	/* decompanding table size */
 #define	MAXAMP		6000.0f	/* maximum signal level */
 #define	MAXCLP		100	/* max clips above reference per s */
-#define	SPAN		800.0f	/* min envelope span */
-#define LIMIT		1000.0f	/* soft limiter threshold */
+#define	SPAN		800.0f	/* min envelope span at LIMIT */
+#define LIMIT		1000.0f	/* initial soft limiter threshold */
+#define ENVWIN		80	/* envelope window (samples) */
+#define NOISEREF	100.0f	/* AGC noise floor reference (rms) */
+#define PEAKREF		2000.0f	/* AGC max signal reference (rms) */
+#define AGCMIN		0.01f	/* min AGC gain */
+#define AGCMAX		100.0f	/* max AGC gain */
+#define AGCUP		1.26f	/* max AGC gain increase per s (2 dB) */
+#define FLOORTC		8	/* noise floor time constant (s) */
+#define PEAKTC		60	/* signal level time constant (s) */
+#define LIMSIG		1.4f	/* limiter threshold (x signal rms) */
+#define SPANNSE		10.0f	/* min envelope span (x noise floor) */
+#define SPANMAX		1.5f	/* max envelope span (x limiter) */
 #define AGAIN		6.0f	/* baseband gain */
 #define LAG		10	/* discriminator lag */
+#define NLPF		27	/* lowpass filter taps */
+#define LPFBUF		32	/* lowpass filter ring size */
+#define LPFDLY		((NLPF - 1) / 2) /* lowpass filter delay (samples) */
+#define BBUF		8192	/* baseband ring size (power of 2) */
+#define REFWIN		16	/* refinement search window (samples) */
+#define REFSPB		((float)SECOND / BAUD) /* samples per bit */
+#define REFLEN		((BURST * 11 * SECOND + BAUD - 1) / BAUD + 2 * \
+			    REFWIN + 2) /* refinement window (samples) */
 #define	DESCRIPTION	"CHU Audio Receiver" /* WRU */
 #define	AUDIO_BUFSIZ 256 /* audio buffer size (30 ms) */
 #define BMAX        128 /* max timecode length */
 #define MAXSTAGE    60  /* max median filter stages  */
+#define NCHAN		3	/* number of radio channels */
 
 /*
  * Decoder definitions
@@ -233,6 +263,22 @@
 #define MINSTAMP	20	/* min timestamps (of 60) */
 #define MINMETRIC	50	/* min channel metric (of 160) */
 
+/*
+ * Soft-decision definitions. Each character gets a weight, the log
+ * likelihood ratio of a correct to an incorrect bit, from the UART
+ * distance and envelope span of the survivor that decoded it. Noise
+ * characters have distance near DIST0 and span near SPAN; clean ones
+ * distance near DIST1 and span above 3 * SPAN. A margin of SYNLLR at
+ * every digit, about two fair bursts, is as good as MINMETRIC for
+ * synchronization.
+ */
+#define DIST0		0.70f	/* distance of a noise character */
+#define DIST1		0.90f	/* distance of a clean character */
+#define PMIN		0.01f	/* min bit error probability */
+#define MINWGT		0.5f	/* min mean burst weight */
+#define MINLLR		4.0f	/* min digit margin */
+#define SYNLLR		8.0f	/* digit margin for sync */
+
 /*
  * The on-time synchronization point for the driver is the last stop bit
  * of the first character 170 ms. The modem delay is 0.8 ms, while the
@@ -280,30 +326,43 @@
 #define TSPERR		0x08	/* insufficient data */
 
 /*
- * Maximum-likelihood UART structure. There are eight of these
- * corresponding to the number of phases.
+ * Maximum-likelihood UART. There are eight survivors, one for each
+ * phase of the baseband signal sampled at eight times the baud rate,
+ * and each one sees every eighth sample. Rather than keep a shift
+ * register for each, the samples go in one ring, where the eleven bits
+ * of each survivor are eight samples apart and the same bit of all
+ * eight survivors is eight consecutive samples. The ring is written
+ * twice over, so any eight consecutive samples can be loaded as one
+ * vector without wrapping.
  */
-struct surv {
-	l_fp	cstamp;		/* last bit timestamp */
-	float	shift[12];	/* sample shift register */
-	float	span;		/* shift register envelope span */
-	float	dist;		/* sample distance */
-	int	uart;		/* decoded character */
-};
+#define UARTBUF		(12 * 8) /* UART ring size (samples) */
 
 /*
- * CHU unit control structure
+ * CHU path structure
+ *
+ * A path demodulates one audio stream and collects the bursts it
+ * decodes during the minute. In single-stream mode the unit has one
+ * path. In multi-stream mode there is one for each of the qsy[]
+ * frequencies, each fed from its own receiver and run on a pool
+ * thread, and at the end of the minute the unit combines the decoding
+ * matrices and timestamps of all of them. A path touches nothing
+ * outside itself while demodulating, and each is allocated on its own
+ * cache lines.
  */
-struct chuunit {
+#define TRACE		4096	/* burst trace buffer size */
+
+struct chupath {
 	uint8_t	decode[20][16];	/* maximum-likelihood decoding matrix */
+	float	llr[20][16];	/* soft-decision decoding matrix */
 	l_fp	cstamp[BURST];	/* character timestamps */
+	uint32_t cidx[BURST];	/* character sample numbers */
+	float	cweight[BURST];	/* character weights */
 	l_fp	tstamp[MAXSTAGE]; /* timestamp samples */
 	l_fp	timestamp;	/* current buffer timestamp */
 	l_fp	laststamp;	/* last buffer timestamp */
 	l_fp	charstamp;	/* character time as a l_fp */
-	int	second;		/* counts the seconds of the minute */
-	int	errflg;		/* error flags */
 	int	status;		/* status bits */
+	int	asec;		/* second of last valid A burst */
 	char	ident[5];	/* station ID and channel */
 
 	/*
@@ -312,24 +371,33 @@ struct chuunit {
 	int	cbuf[BURST];	/* character buffer */
 	int	ntstamp;	/* number of timestamp samples */
 	int	ndx;		/* buffer start index */
+	int	bto;		/* burst timeout (UART samples) */
 	int	prevsec;	/* previous burst second */
 	int	burdist;	/* burst distance */
 	int	syndist;	/* sync distance */
+	int	synpha;		/* sync phase */
 	int	burstcnt;	/* format A bursts this minute */
 
 	/*
-	 * Format particulars
+	 * Format B particulars
 	 */
+	int	year;		/* year (0 until a valid B burst) */
 	int	dst;		/* Canadian DST code */
 
 	/*
-	 * Audio codec variables
+	 * AGC variables
 	 */
-	float gain;
-	int	fd;	        /* audio port file descriptor */
-	int	mongain;	/* codec monitor gain */
+	float	gain;		/* AGC gain */
 	int	clipcnt;	/* sample clip count */
 	int	seccnt;		/* second interval counter */
+	float	envsum;		/* envelope window energy */
+	int	envcnt;		/* envelope window counter */
+	float	envmax;		/* max window energy this second */
+	float	envmin;		/* min window energy this second */
+	float	peak;		/* signal level (input power) */
+	float	floor;		/* noise floor (input power) */
+	float	limit;		/* soft limiter threshold */
+	float	span;		/* min envelope span */
 
 	/*
 	 * Modem variables
@@ -337,19 +405,65 @@ struct chuunit {
 	l_fp	tick;		/* audio sample increment */
 	float	bpf[9];		/* IIR bandpass filter */
 	float	disc[LAG];	/* discriminator shift register */
-	float	lpf[27];	/* FIR lowpass filter */
+	float	lpf[2 * LPFBUF]; /* FIR lowpass filter ring */
+	float	bbuf[BBUF];	/* baseband ring */
+	uint32_t nsamp;		/* sample number */
 	float	monitor;	/* audio monitor */
 	int	discptr;	/* discriminator pointer */
+	int	lpfptr;		/* lowpass filter pointer */
 
 	/*
 	 * Maximum-likelihood UART variables
 	 */
 	float	baud;		/* baud interval */
-	struct surv surv[8];	/* UART survivor structures */
+	float	ubuf[2 * UARTBUF]; /* UART sample ring */
+	l_fp	ustamp[8];	/* UART last bit timestamps */
+	uint32_t uidx[8];	/* UART last bit sample numbers */
+	int	uptr;		/* UART ring pointer */
 	int	decptr;		/* decode pointer */
 	int	decpha;		/* decode phase */
 	int	dbrk;		/* holdoff counter */
 
+	/*
+	 * Burst trace lines, written out after each buffer
+	 */
+	char	trace[TRACE];	/* trace buffer */
+	int	ntrace;		/* trace buffer length */
+} __attribute__((aligned(64)));
+
+/*
+ * CHU unit control structure
+ */
+struct chuunit {
+	uint8_t	decode[20][16];	/* maximum-likelihood decoding matrix */
+	float	llr[20][16];	/* soft-decision decoding matrix */
+	float	margin;		/* min digit margin */
+	l_fp	tstamp[NCHAN * MAXSTAGE]; /* timestamp samples */
+	int	second;		/* counts the seconds of the minute */
+	int	errflg;		/* error flags */
+	int	status;		/* status bits */
+	char	ident[5];	/* station ID and channel */
+	int	ntstamp;	/* number of timestamp samples */
+	int	burstcnt;	/* format A bursts this minute */
+
+	/*
+	 * Format particulars
+	 */
+	int	dst;		/* Canadian DST code */
+
+	/*
+	 * Audio paths
+	 */
+	struct chupath *path[NCHAN]; /* paths (only path[0] if single) */
+	struct pool *pool;	/* path thread pool (multi-stream) */
+	int16_t	*seg[NCHAN];	/* buffer for each path (NULL if none) */
+	unsigned int nseg;	/* samples in each buffer */
+	l_fp	segtime;	/* buffer timestamp */
+	l_fp	rcvtime;	/* end of the last buffer (clock time) */
+	float gain;		/* gain of the best path */
+	int	fd;	        /* audio port file descriptor */
+	int	mongain;	/* codec monitor gain */
+
     char a_lastcode[BMAX]; /* last timecode received */
     unsigned int lencode;    /* length of last timecode */
 
@@ -361,30 +475,65 @@ struct chuunit {
     uint32_t    yearstart;  /* beginning of year */
     uint8_t leap;       /* leap/synchronization code */
 
+    /*
+     * Offset filter
+     */
+    double filter[NCHAN * MAXSTAGE]; /* offset samples */
+    int nstage;     /* number of samples */
+    double offset;  /* trimmed mean offset */
+    double jitter;  /* jitter */
+
     /*
      * Configuration data
      */
     float fudgetime1; /* fudge time1 */
     float fudgetime2; /* fudge time2 */
+
+    /* NTP-SHM segment (NULL if not published) */
+    struct shmTime *shmTime;
 };
 
 /*
  * More function prototypes
  */
-static void	chu_decode	(struct chuunit *up, int, l_fp);
-static void	chu_burst	(struct chuunit *up);
+static void	chu_decode	(struct chupath *cp, int, l_fp, uint32_t, float, float);
+static void	chu_burst	(struct chupath *cp);
+static void	chu_refine	(struct chupath *cp, int, int);
+static void	chu_llr		(float *row, int digit, float wgt);
 static void	chu_clear	(struct chuunit *up);
-void	chu_a		(struct chuunit *up, int);
-void	chu_b		(struct chuunit *up, int);
+void	chu_a		(struct chupath *cp, int);
+void	chu_b		(struct chupath *cp, int);
 static float	chu_major	(struct chuunit *up);
-void	chu_uart	(struct surv *, float);
+static void	chu_frame	(struct chupath *cp);
+static int	chu_uart	(struct chupath *cp, int *uart, float *ddist, float *dspan);
 void	chu_rf		(struct chuunit *up, float sample);
-static void	chu_gain	(struct chuunit *up);
+static void	chu_fsk		(struct chupath *cp, float sample);
+static void	chu_gain	(struct chupath *cp);
+static unsigned int chu_scale	(float *, const int16_t *, unsigned int, float);
+static struct chupath *chu_path	(const char *ident);
+static void	chu_path_receive (struct chupath *cp, int16_t *, unsigned int, l_fp);
+static void	chu_path_job	(void *arg, unsigned int job);
+static void	chu_trace	(struct chuunit *up);
+static void	chu_puttrace	(struct chupath *cp, const char *line);
+static void	chu_combine	(struct chuunit *up);
+static void	chu_process_offset (struct chuunit *up, l_fp lasttim, l_fp lastrec, double fudge);
+static int	chu_sample	(struct chuunit *up);
+static void	chu_publish	(struct chuunit *up, l_fp lasttim);
 
 /*
- * Global variables
+ * Lowpass filter coefficients, oldest sample first. The discriminator
+ * output is scaled by the end tap as it enters the ring, so the newest
+ * sample goes in with unit weight.
  */
-static char hexchar[] = "0123456789abcdef_*=";
+static const float lpfcoef[NLPF] = {
+	2.538771e-02f, 1.084671e-01f, 2.003159e-01f, 2.985303e-01f,
+	4.003697e-01f, 5.028552e-01f, 6.028795e-01f, 6.973249e-01f,
+	7.831828e-01f, 8.576717e-01f, 9.183463e-01f, 9.631951e-01f,
+	9.907208e-01f, 1.000000e+00f, 9.907208e-01f, 9.631951e-01f,
+	9.183463e-01f, 8.576717e-01f, 7.831828e-01f, 6.973249e-01f,
+	6.028795e-01f, 5.028552e-01f, 4.003697e-01f, 2.985303e-01f,
+	2.003159e-01f, 1.084671e-01f, 1.0f
+};
 
 /*
  * Note the tuned frequencies are 1 kHz higher than the carrier. CHU
@@ -394,30 +543,64 @@ static char hexchar[] = "0123456789abcdef_*=";
 static float qsy[3] = {3.33, 7.85, 14.67}; /* freq (MHz) */
 
 /*
- * chu_dist - determine the distance of two octet arguments
+ * chu_frame - determine the burst and sync distances of a burst
+ *
+ * This routine checks the framing of the whole burst in one pass. The
+ * distance of two octets is the number of bits that agree less the
+ * number that differ, and the burst distance is its sum over the pairs
+ * of characters five apart. The first five characters are packed in
+ * one word and the next five in another, so this is one exclusive OR
+ * and one population count. The framing digits of the three format A burst phases are
+ * packed in a third word, 16 bits to a phase, and checked against
+ * 0x6363 the same way. It leaves the burst distance, the maximum sync
+ * distance and the phase that produced it in the path structure.
  */
-static int chu_dist(int x, int y)
+static void chu_frame(struct chupath *cp)
 {
-	int	val;		/* bit count */
+	uint64_t first, second;	/* character blocks */
+	uint64_t sync;		/* framing digits */
+	int	val;		/* distance */
 	int	temp;
-	int	i;
+	int	i, n;
 
 	/*
-	 * The distance is determined as the weight of the exclusive OR
-	 * of the two arguments. The weight is determined by the number
-	 * of one bits in the result. Each one bit increases the weight,
-	 * while each zero bit decreases it.
+	 * Burst distance over the characters present in both blocks
 	 */
-	temp = x ^ y;
-	val = 0;
-	for (i = 0; i < 8; i++) {
-		if ((temp & 0x1) == 0)
-			val++;
-		else
-			val--;
-		temp >>= 1;
+	n = cp->ndx - 5 < 5 ? cp->ndx - 5 : 5;
+	first = second = 0;
+	for (i = 0; i < 5; i++) {
+		first |= (uint64_t)cp->cbuf[i] << (8 * i);
+		if (i < n)
+			second |= (uint64_t)cp->cbuf[i + 5] << (8 * i);
+	}
+	cp->burdist = 8 * n - 2 * __builtin_popcountll((first ^ second) &
+	    ((1ULL << (8 * n)) - 1));
+
+	/*
+	 * Framing digits 0x6 at positions 0 and 5 and 0x3 at positions
+	 * 4 and 9, one character early (phase -1), in phase (0) and one
+	 * character late (1).
+	 */
+	sync = 0;
+	for (i = -1; i < 2; i++) {
+		temp = cp->cbuf[i + 4] & 0xf;
+		if (i >= 0)
+			temp |= (cp->cbuf[i] & 0xf) << 4;
+		temp |= (cp->cbuf[i + 5] & 0xf) << 12;
+		if (i + 9 < cp->ndx)
+			temp |= (cp->cbuf[i + 9] & 0xf) << 8;
+		sync |= (uint64_t)temp << (16 * (i + 1));
+	}
+	sync ^= 0x636363636363ULL;
+	cp->syndist = cp->synpha = 0;
+	for (i = -1; i < 2; i++) {
+		val = 16 - 2 * __builtin_popcountll((sync >> (16 * (i + 1))) &
+		    0xffff);
+		if (val > cp->syndist) {
+			cp->syndist = val;
+			cp->synpha = i;
+		}
 	}
-	return (val);
 }
 
 /*
@@ -432,25 +615,87 @@ struct chuunit *chu_start(void)
 	 */
 	up = malloc(sizeof(*up));
 	memset(up, 0, sizeof(*up));
+	if (!(up->path[0] = chu_path("CHU"))) {
+		free(up);
+		return (NULL);
+	}
 
 	/*
 	 * Initialize miscellaneous variables
 	 */
 	//pp->clockdesc = DESCRIPTION;
 	strcpy(up->ident, "CHU");
-	DTOLFP(CHAR, &up->charstamp);
-
-	up->gain = 127;
-	DTOLFP(1. / SECOND, &up->tick);
+	up->gain = 1;
     return up;
 }
 
+/*
+ * chu_path - allocate and initialize a path
+ */
+static struct chupath *chu_path(const char *ident)
+{
+	struct chupath *cp;
+
+	if (!(cp = (struct chupath *)aligned_alloc(64,
+	    sizeof(struct chupath))))
+		return (NULL);
+	memset(cp, 0, sizeof(*cp));
+	strcpy(cp->ident, ident);
+	DTOLFP(CHAR, &cp->charstamp);
+	cp->gain = 1;
+	cp->envmin = 1e30f;
+	cp->limit = LIMIT;
+	cp->span = SPAN;
+	DTOLFP(1. / SECOND, &cp->tick);
+	return (cp);
+}
+
+/*
+ * chu_multi - switch the unit to multi-stream mode
+ *
+ * This routine allocates a path for each qsy[] frequency, identified
+ * as CHU0 through CHU2, and a pool of nthreads threads to run them.
+ * From then on the unit is fed with chu_receive_multi(). Returns 0 if
+ * successful, -1 if not.
+ */
+int chu_multi(struct chuunit *up, unsigned int nthreads)
+{
+	char	ident[5];
+	int	i;
+
+	if (up->pool != NULL)
+		return (0);
+	for (i = 0; i < NCHAN; i++) {
+		snprintf(ident, sizeof(ident), "CHU%d", i);
+		if (i > 0 && !(up->path[i] = chu_path(ident)))
+			goto fail;
+		strcpy(up->path[i]->ident, ident);
+	}
+	if (!(up->pool = pool_create(nthreads)))
+		goto fail;
+	return (0);
+
+fail:
+	for (i = 1; i < NCHAN; i++) {
+		free(up->path[i]);
+		up->path[i] = NULL;
+	}
+	strcpy(up->path[0]->ident, "CHU");
+	return (-1);
+}
+
 /*
  * chu_shutdown - shut down the clock
  */
 void
 chu_shutdown(struct chuunit *up)
 {
+	int	i;
+
+	if (up->pool != NULL)
+		pool_destroy(up->pool);
+	for (i = 0; i < NCHAN; i++)
+		free(up->path[i]);
 	free(up);
 }
 
@@ -459,47 +704,175 @@ chu_shutdown(struct chuunit *up)
  */
 void chu_receive(struct chuunit *up, int16_t *recv_buffer, unsigned int recv_length, l_fp recv_time)
 {
-	float	sample;		/* codec sample */
-	unsigned int bufcnt;		/* buffer counter */
+	chu_path_receive(up->path[0], recv_buffer, recv_length, recv_time);
+	chu_trace(up);
+	up->rcvtime = recv_time;
+}
+
+/*
+ * chu_receive_multi - receive data from all channels at once
+ *
+ * This routine is the multi-stream version of chu_receive(). There is
+ * one buffer of recv_length samples for each qsy[] frequency, all
+ * sampled by the same clock; a NULL buffer means that channel is not
+ * available. The paths demodulate their buffers on the pool threads
+ * and the burst traces are written out in channel order once all are
+ * done.
+ */
+void chu_receive_multi(struct chuunit *up, int16_t *recv_buffer[NCHAN], unsigned int recv_length, l_fp recv_time)
+{
+	int	i;
+
+	up->rcvtime = recv_time;
+	if (up->pool == NULL) {
+		for (i = 0; i < NCHAN && recv_buffer[i] == NULL; i++);
+		if (i < NCHAN)
+			chu_receive(up, recv_buffer[i], recv_length,
+			    recv_time);
+		return;
+	}
+	for (i = 0; i < NCHAN; i++)
+		up->seg[i] = recv_buffer[i];
+	up->nseg = recv_length;
+	up->segtime = recv_time;
+	pool_run(up->pool, chu_path_job, up, NCHAN);
+	chu_trace(up);
+}
+
+/*
+ * chu_path_job - demodulate the buffer of one channel
+ *
+ * This routine runs on a pool thread and touches only its own path.
+ */
+static void chu_path_job(void *arg, unsigned int job)
+{
+	struct chuunit *up = (struct chuunit *)arg;
+
+	if (up->seg[job] != NULL)
+		chu_path_receive(up->path[job], up->seg[job], up->nseg,
+		    up->segtime);
+}
+
+/*
+ * chu_path_receive - demodulate a buffer
+ */
+static void chu_path_receive(struct chupath *cp, int16_t *recv_buffer, unsigned int recv_length, l_fp recv_time)
+{
+	float	x[AUDIO_BUFSIZ]; /* scaled samples */
+	unsigned int bufcnt;	/* buffer counter */
+	unsigned int n, i;
 	l_fp	ltemp;		/* l_fp temp */
 
 	/*
-	 * Main loop - read until there ain't no more. Note codec
-	 * samples are bit-inverted.
+	 * Main loop - read until there ain't no more. The samples are
+	 * scaled by the AGC gain a block at a time, where the blocks
+	 * end at each second, so the gain changes on the same sample
+	 * whatever the buffer size.
 	 */
 	DTOLFP((float)recv_length / SECOND, &ltemp);
 	L_SUB(&recv_time, &ltemp);
-	up->timestamp = recv_time;
-	for (bufcnt = 0; bufcnt < recv_length; bufcnt++) {
-		sample = ((float)recv_buffer[bufcnt]);
+	cp->timestamp = recv_time;
+	for (bufcnt = 0; bufcnt < recv_length; bufcnt += n) {
+		n = recv_length - bufcnt;
+		if (n > AUDIO_BUFSIZ)
+			n = AUDIO_BUFSIZ;
+		if (n > (unsigned int)(SECOND - cp->seccnt))
+			n = SECOND - cp->seccnt;
 
 		/*
-		 * Clip noise spikes greater than MAXAMP. If no clips,
-		 * increase the gain a tad; if the clips are too high,
-		 * decrease a tad.
+		 * Clip noise spikes greater than MAXAMP and record the
+		 * number of clips to be used later by the AGC.
 		 */
-		if (sample > MAXAMP) {
-			sample = MAXAMP;
-			up->clipcnt++;
-		} else if (sample < -MAXAMP) {
-			sample = -MAXAMP;
-			up->clipcnt++;
+		cp->clipcnt += chu_scale(x, &recv_buffer[bufcnt], n,
+		    cp->gain);
+		for (i = 0; i < n; i++) {
+			chu_fsk(cp, x[i]);
+			L_ADD(&cp->timestamp, &cp->tick);
 		}
-		chu_rf(up, sample);
-		L_ADD(&up->timestamp, &up->tick);
 
 		/*
 		 * Once each second ride gain.
 		 */
-		up->seccnt = (up->seccnt + 1) % SECOND;
-		if (up->seccnt == 0) {
-			chu_gain(up);
+		cp->seccnt += n;
+		if (cp->seccnt == SECOND) {
+			cp->seccnt = 0;
+			chu_gain(cp);
 		}
 	}
 }
 
 /*
- * chu_rf - filter and demodulate the FSK signal
+ * chu_scale - apply the AGC gain to codec samples
+ *
+ * This routine converts the codec samples to float, scales them by the
+ * gain, clips them at MAXAMP and returns the number of clips.
+ */
+SIMD_CLONES static unsigned int chu_scale(float *out, const int16_t *in, unsigned int n, float gain)
+{
+	v8sf	x, g, hi, lo;
+	v8si	over, under, nclip;
+	unsigned int clipcnt;
+	unsigned int i;
+
+	g = v8sf_set1(gain);
+	hi = v8sf_set1(MAXAMP);
+	lo = v8sf_set1(-MAXAMP);
+	nclip = (v8si){0};
+	for (i = 0; i + VLEN <= n; i += VLEN) {
+		x = __builtin_convertvector(v8hi_load(&in[i]), v8sf) * g;
+		over = x > hi;
+		under = x < lo;
+		x = v8sf_select(over, hi, v8sf_select(under, lo, x));
+		nclip -= over | under;
+		v8sf_store(&out[i], x);
+	}
+	clipcnt = v8si_hsum(nclip);
+	for (; i < n; i++) {
+		out[i] = in[i] * gain;
+		if (out[i] > MAXAMP) {
+			out[i] = MAXAMP;
+			clipcnt++;
+		} else if (out[i] < -MAXAMP) {
+			out[i] = -MAXAMP;
+			clipcnt++;
+		}
+	}
+	return (clipcnt);
+}
+
+/*
+ * chu_trace - write out the burst traces and pick up the burst seconds
+ *
+ * A valid A burst sets the second of the minute. If more than one path
+ * has one, they are from the same burst and the last one wins.
+ */
+static void chu_trace(struct chuunit *up)
+{
+	struct chupath *cp;
+	int	i;
+
+	for (i = 0; i < NCHAN && (cp = up->path[i]) != NULL; i++) {
+		if (cp->ntrace > 0) {
+			write(1, cp->trace, cp->ntrace);
+			cp->ntrace = 0;
+		}
+		if (cp->asec != 0) {
+			up->sec = cp->asec;
+			cp->asec = 0;
+		}
+	}
+}
+
+/*
+ * chu_rf - demodulate one sample in single-stream mode
+ */
+void chu_rf(struct chuunit *up, float sample)
+{
+	chu_fsk(up->path[0], sample);
+}
+
+/*
+ * chu_fsk - filter and demodulate the FSK signal
  *
  * This routine implements a 300-baud Bell 103 modem with mark 2225 Hz
  * and space 2025 Hz. It uses a bandpass filter followed by a soft
@@ -509,12 +882,12 @@ void chu_receive(struct chuunit *up, int16_t *recv_buffer, unsigned int recv_len
  *
  * The filters are built for speed, which explains the rather clumsy
  * code. Hopefully, the compiler will efficiently implement the move-
- * and-muiltiply-and-add operations.
+ * and-muiltiply-and-add operations. The lowpass filter output is used
+ * only at the UART sample instants, 2400 times a second, so it is
+ * computed only then, from a ring of the discriminator output.
  */
-void chu_rf(struct chuunit *up, float sample)
+static void chu_fsk(struct chupath *cp, float sample)
 {
-	struct surv *sp;
-
 	/*
 	 * Local variables
 	 */
@@ -522,34 +895,62 @@ void chu_rf(struct chuunit *up, float sample)
 	float	limit;		/* limiter signal */
 	float	disc;		/* discriminator signal */
 	float	lpf;		/* lowpass signal */
-	float	dist;		/* UART signal distance */
-	int	i, j;
+	const float *fp;	/* lowpass filter window */
+	int	uart;		/* decoded character */
+	float	dist;		/* character distance */
+	float	span;		/* character envelope span */
+	int	j;
 
 	/*
 	 * Bandpass filter. 4th-order elliptic, 500-Hz bandpass centered
 	 * at 2125 Hz. Passband ripple 0.3 dB, stopband ripple 50 dB,
 	 * phase delay 0.24 ms.
 	 */
-	signal  = (up->bpf[8] = up->bpf[7]) * 0.5844676f;
-	signal += (up->bpf[7] = up->bpf[6]) * 0.488486f;
-	signal += (up->bpf[6] = up->bpf[5]) * 2.704384f;
-	signal += (up->bpf[5] = up->bpf[4]) * 1.645032f;
-	signal += (up->bpf[4] = up->bpf[3]) * 4.644557f;
-	signal += (up->bpf[3] = up->bpf[2]) * 1.879165f;
-	signal += (up->bpf[2] = up->bpf[1]) * 3.522634f;
-	signal += (up->bpf[1] = up->bpf[0]) * 0.7315738f;
-	up->bpf[0] = sample - signal;
-	signal = up->bpf[0] * 6.176213e-03f
-	    + up->bpf[1] * 3.156599e-03f
-	    + up->bpf[2] * 7.567487e-03f
-	    + up->bpf[3] * 4.344580e-03f
-	    + up->bpf[4] * 1.190128e-02f
-	    + up->bpf[5] * 4.344580e-03f
-	    + up->bpf[6] * 7.567487e-03f
-	    + up->bpf[7] * 3.156599e-03f
-	    + up->bpf[8] * 6.176213e-03f;
-
-	up->monitor = signal * 0.25f;	/* note monitor after filter */
+	signal  = (cp->bpf[8] = cp->bpf[7]) * 0.5844676f;
+	signal += (cp->bpf[7] = cp->bpf[6]) * 0.488486f;
+	signal += (cp->bpf[6] = cp->bpf[5]) * 2.704384f;
+	signal += (cp->bpf[5] = cp->bpf[4]) * 1.645032f;
+	signal += (cp->bpf[4] = cp->bpf[3]) * 4.644557f;
+	signal += (cp->bpf[3] = cp->bpf[2]) * 1.879165f;
+	signal += (cp->bpf[2] = cp->bpf[1]) * 3.522634f;
+	signal += (cp->bpf[1] = cp->bpf[0]) * 0.7315738f;
+	cp->bpf[0] = sample - signal;
+	signal = cp->bpf[0] * 6.176213e-03f
+	    + cp->bpf[1] * 3.156599e-03f
+	    + cp->bpf[2] * 7.567487e-03f
+	    + cp->bpf[3] * 4.344580e-03f
+	    + cp->bpf[4] * 1.190128e-02f
+	    + cp->bpf[5] * 4.344580e-03f
+	    + cp->bpf[6] * 7.567487e-03f
+	    + cp->bpf[7] * 3.156599e-03f
+	    + cp->bpf[8] * 6.176213e-03f;
+
+	cp->monitor = signal * 0.25f;	/* note monitor after filter */
+
+	/*
+	 * Envelope. The energy of the bandpass signal is summed over
+	 * windows of ENVWIN samples and the largest and smallest window
+	 * of each second go to the AGC. A window too strong for the
+	 * limiter raises the limiter threshold at once, so a burst
+	 * after a long quiet spell is not clipped until the AGC gets
+	 * around to it.
+	 */
+	cp->envsum += signal * signal;
+	if (++cp->envcnt == ENVWIN) {
+		if (cp->envsum > cp->envmax) {
+			cp->envmax = cp->envsum;
+			if (LIMSIG * LIMSIG * cp->envsum > cp->limit *
+			    cp->limit * ENVWIN) {
+				cp->limit = LIMSIG * sqrtf(cp->envsum /
+				    ENVWIN);
+				cp->span = SPAN / LIMIT * cp->limit;
+			}
+		}
+		if (cp->envsum < cp->envmin)
+			cp->envmin = cp->envsum;
+		cp->envsum = 0;
+		cp->envcnt = 0;
+	}
 
 	/*
 	 * Soft limiter/discriminator. The 11-sample discriminator lag
@@ -561,13 +962,13 @@ void chu_rf(struct chuunit *up, float sample)
 	 * at 8000 Hz sucks.
 	 */
 	limit = signal;
-	if (limit > LIMIT)
-		limit = LIMIT;
-	else if (limit < -LIMIT)
-		limit = -LIMIT;
-	disc = up->disc[up->discptr] * -limit;
-	up->disc[up->discptr] = limit;
-	up->discptr = (up->discptr + 1 ) % LAG;
+	if (limit > cp->limit)
+		limit = cp->limit;
+	else if (limit < -cp->limit)
+		limit = -cp->limit;
+	disc = cp->disc[cp->discptr] * -limit;
+	cp->disc[cp->discptr] = limit;
+	cp->discptr = (cp->discptr + 1 ) % LAG;
 	if (disc >= 0)
 		disc = sqrtf(disc);
 	else
@@ -575,79 +976,62 @@ void chu_rf(struct chuunit *up, float sample)
 
 	/*
 	 * Lowpass filter. Raised cosine FIR, Ts = 1 / 300, beta = 0.1.
+	 * The ring is written twice over, so the last NLPF samples are
+	 * always contiguous.
 	 */
-	lpf  = (up->lpf[26] = up->lpf[25]) * 2.538771e-02f;
-	lpf += (up->lpf[25] = up->lpf[24]) * 1.084671e-01f;
-	lpf += (up->lpf[24] = up->lpf[23]) * 2.003159e-01f;
-	lpf += (up->lpf[23] = up->lpf[22]) * 2.985303e-01f;
-	lpf += (up->lpf[22] = up->lpf[21]) * 4.003697e-01f;
-	lpf += (up->lpf[21] = up->lpf[20]) * 5.028552e-01f;
-	lpf += (up->lpf[20] = up->lpf[19]) * 6.028795e-01f;
-	lpf += (up->lpf[19] = up->lpf[18]) * 6.973249e-01f;
-	lpf += (up->lpf[18] = up->lpf[17]) * 7.831828e-01f;
-	lpf += (up->lpf[17] = up->lpf[16]) * 8.576717e-01f;
-	lpf += (up->lpf[16] = up->lpf[15]) * 9.183463e-01f;
-	lpf += (up->lpf[15] = up->lpf[14]) * 9.631951e-01f;
-	lpf += (up->lpf[14] = up->lpf[13]) * 9.907208e-01f;
-	lpf += (up->lpf[13] = up->lpf[12]) * 1.000000e+00f;
-	lpf += (up->lpf[12] = up->lpf[11]) * 9.907208e-01f;
-	lpf += (up->lpf[11] = up->lpf[10]) * 9.631951e-01f;
-	lpf += (up->lpf[10] = up->lpf[9]) * 9.183463e-01f;
-	lpf += (up->lpf[9] = up->lpf[8]) * 8.576717e-01f;
-	lpf += (up->lpf[8] = up->lpf[7]) * 7.831828e-01f;
-	lpf += (up->lpf[7] = up->lpf[6]) * 6.973249e-01f;
-	lpf += (up->lpf[6] = up->lpf[5]) * 6.028795e-01f;
-	lpf += (up->lpf[5] = up->lpf[4]) * 5.028552e-01f;
-	lpf += (up->lpf[4] = up->lpf[3]) * 4.003697e-01f;
-	lpf += (up->lpf[3] = up->lpf[2]) * 2.985303e-01f;
-	lpf += (up->lpf[2] = up->lpf[1]) * 2.003159e-01f;
-	lpf += (up->lpf[1] = up->lpf[0]) * 1.084671e-01f;
-	lpf += up->lpf[0] = disc * 2.538771e-02;
+	cp->lpf[cp->lpfptr] = cp->lpf[cp->lpfptr + LPFBUF] =
+	    disc * 2.538771e-02;
+	cp->lpfptr = (cp->lpfptr + 1) % LPFBUF;
 
 	/*
-	 * Maximum-likelihood decoder. The UART updates each of the
-	 * eight survivors and determines the span, slice level and
-	 * tentative decoded character. Valid 11-bit characters are
-	 * framed so that bit 10 and bit 11 (stop bits) are mark and bit
-	 * 1 (start bit) is space. When a valid character is found, the
-	 * survivor with maximum distance determines the final decoded
+	 * The discriminator output is also kept for about a second, so
+	 * chu_refine() can go back over a whole burst.
+	 */
+	cp->bbuf[cp->nsamp & (BBUF - 1)] = disc;
+	cp->nsamp++;
+
+	/*
+	 * Maximum-likelihood decoder. Each baseband sample goes to the
+	 * next of the eight survivors. Once per baud interval, at the
+	 * decoding phase, the UART scores all eight survivors at once
+	 * and returns the one with maximum distance among those with a
+	 * valid character, which determines the final decoded
 	 * character.
 	 */
-	up->baud += 1.0f / SECOND;
-	if (up->baud > 1.0f / (BAUD * 8.0f)) {
-		up->baud -= 1.0f / (BAUD * 8.0f);
-		up->decptr = (up->decptr + 1) % 8;
-		sp = &up->surv[up->decptr];
-		sp->cstamp = up->timestamp;
-		chu_uart(sp, -lpf * AGAIN);
-		if (up->dbrk > 0) {
-			up->dbrk--;
-			if (up->dbrk > 0)
+	cp->baud += 1.0f / SECOND;
+	if (cp->baud > 1.0f / (BAUD * 8.0f)) {
+		cp->baud -= 1.0f / (BAUD * 8.0f);
+		cp->decptr = (cp->decptr + 1) % 8;
+		cp->ustamp[cp->decptr] = cp->timestamp;
+		cp->uidx[cp->decptr] = cp->nsamp - 1;
+		fp = &cp->lpf[cp->lpfptr + LPFBUF - NLPF];
+		lpf = fp[0] * lpfcoef[0];
+		for (j = 1; j < NLPF; j++)
+			lpf += fp[j] * lpfcoef[j];
+		cp->ubuf[cp->uptr] = cp->ubuf[cp->uptr + UARTBUF] =
+		    -lpf * AGAIN;
+		cp->uptr = (cp->uptr + 1) % UARTBUF;
+
+		/*
+		 * If no character has followed the last one for as long
+		 * as the longest burst, the burst is over. Process it now,
+		 * while its baseband is still in the ring.
+		 */
+		if (cp->bto > 0 && --cp->bto == 0 && cp->ndx > 0) {
+			chu_burst(cp);
+			cp->ndx = 0;
+		}
+		if (cp->dbrk > 0) {
+			cp->dbrk--;
+			if (cp->dbrk > 0)
 				return;
 
-			up->decpha = up->decptr;
+			cp->decpha = cp->decptr;
 		}
-		if (up->decptr != up->decpha)
+		if (cp->decptr != cp->decpha)
 			return;
 
-		dist = 0;
-		j = -1;
-		for (i = 0; i < 8; i++) {
-			/*
-			 * The timestamp is taken at the last bit, so
-			 * for correct decoding we reqire sufficient
-			 * span and correct start bit and two stop bits.
-			 */
-			if ((up->surv[i].uart & 0x601) != 0x600 ||
-			    up->surv[i].span < SPAN)
-				continue;
-
-			if (up->surv[i].dist > dist) {
-				dist = up->surv[i].dist;
-				j = i;
-			}
-		}
-		if (j < 0)
+		if ((j = chu_uart(cp, &uart, &dist, &span)) < 0)
 			return;
 
 		/*
@@ -656,45 +1040,53 @@ void chu_rf(struct chuunit *up, float sample)
 		 * phase of the entire burst from the phase of the first
 		 * character.
 		 */
-		//up->maxsignal = up->surv[j].span;
-		chu_decode(up, (up->surv[j].uart >> 1) & 0xff, up->surv[j].cstamp);
-		up->dbrk = 88;
+		chu_decode(cp, (uart >> 1) & 0xff, cp->ustamp[j], cp->uidx[j],
+		    dist, span);
+		cp->dbrk = 88;
 	}
 }
 
 /*
  * chu_uart - maximum-likelihood UART
  *
- * This routine updates a shift register holding the last 11 envelope
- * samples. It then computes the slice level and span over these samples
- * and determines the tentative data bits and distance. The calling
- * program selects over the last eight survivors the one with maximum
- * distance to determine the decoded character.
+ * This routine scores the eight survivors on their last eleven samples.
+ * For each it computes the slice level and span over these samples and
+ * determines the tentative data bits and distance, then it selects the
+ * survivor with maximum distance among those with a valid character.
+ * Vector lane l holds survivor (decptr + 1 + l) % 8, whose last sample
+ * was taken 7 - l samples ago, and bit b of every survivor is loaded
+ * from the ring as one vector. Returns the survivor number, with the
+ * decoded character, its distance and span in *uart, *ddist and
+ * *dspan, or -1 if none is valid.
  */
-void chu_uart(
-	struct surv *sp,	/* survivor structure pointer */
-	float sample		/* baseband signal */
+SIMD_CLONES static int chu_uart(
+	struct chupath *cp,	/* driver structure pointer */
+	int	*uart,		/* decoded character */
+	float	*ddist,		/* its distance */
+	float	*dspan		/* its envelope span */
 	)
 {
-	float	es_max, es_min;	/* max/min envelope */
-	float	slice;		/* slice level */
-	float	dist;		/* distance */
-	float	dtemp;
-	int	i;
+	v8sf	x[12];		/* bit samples, newest first */
+	v8sf	es_max, es_min;	/* max/min envelope */
+	v8sf	span;		/* envelope span */
+	v8sf	slice;		/* slice level */
+	v8sf	dist;		/* distance */
+	v8si	mark;		/* bit is mark */
+	v8si	bits;		/* tentative data bits */
+	float	dmax;
+	int	i, j, l, p;
 
 	/*
-	 * Save the sample and shift right. At the same time, measure
-	 * the maximum and minimum over all eleven samples.
+	 * Load the samples. At the same time, measure the maximum and
+	 * minimum over all eleven samples.
 	 */
-	es_max = -1e6;
-	es_min = 1e6;
-	sp->shift[0] = sample;
-	for (i = 11; i > 0; i--) {
-		sp->shift[i] = sp->shift[i - 1];
-		if (sp->shift[i] > es_max)
-			es_max = sp->shift[i];
-		if (sp->shift[i] < es_min)
-			es_min = sp->shift[i];
+	es_max = v8sf_set1(-1e6f);
+	es_min = v8sf_set1(1e6f);
+	for (i = 1; i < 12; i++) {
+		p = (cp->uptr + UARTBUF - 8 * i) % UARTBUF;
+		x[i] = v8sf_load(&cp->ubuf[p]);
+		es_max = v8sf_select(x[i] > es_max, x[i], es_max);
+		es_min = v8sf_select(x[i] < es_min, x[i], es_min);
 	}
 
 	/*
@@ -703,40 +1095,67 @@ void chu_uart(
 	 * the slight bias toward mark to correct for the modem tendency
 	 * to make more mark than space errors. Compute the distance on
 	 * the assumption the last two bits must be mark, the first
-	 * space and the rest either mark or space.
+	 * space and the rest either mark or space. If no survivor has
+	 * the span for a character, as between bursts, stop here.
 	 */
-	sp->span = es_max - es_min;
-	slice = es_min + 0.45f * sp->span;
-	dist = 0;
-	sp->uart = 0;
+	span = es_max - es_min;
+	if (!v8si_hsum(span >= v8sf_set1(cp->span)))
+		return (-1);
+
+	slice = es_min + 0.45f * span;
+	dist = (v8sf){0};
+	bits = (v8si){0};
 	for (i = 1; i < 12; i++) {
-		sp->uart <<= 1;
-		dtemp = sp->shift[i];
-		if (dtemp > slice)
-			sp->uart |= 0x1;
-		if (i == 1 || i == 2) {
-			dist += dtemp - es_min;
-		} else if (i == 11) {
-			dist += es_max - dtemp;
-		} else {
-			if (dtemp > slice)
-				dist += dtemp - es_min;
-			else
-				dist += es_max - dtemp;
+		mark = x[i] > slice;
+		bits = (bits << 1) | (mark & 0x1);
+		if (i == 1 || i == 2)
+			dist += x[i] - es_min;
+		else if (i == 11)
+			dist += es_max - x[i];
+		else
+			dist += v8sf_select(mark, x[i] - es_min, es_max -
+			    x[i]);
+	}
+	dist /= 11 * span;
+
+	/*
+	 * The timestamp is taken at the last bit, so for correct
+	 * decoding we reqire sufficient span and correct start bit and
+	 * two stop bits. Survivors that fail get zero distance, which
+	 * never wins.
+	 */
+	dist = v8sf_select(((bits & 0x601) == 0x600) & (span >= v8sf_set1(cp->span)), dist,
+	    (v8sf){0});
+	dmax = 0;
+	j = -1;
+	for (i = 0; i < 8; i++) {
+		l = (i - cp->decptr + 7) % 8;
+		if (dist[l] > dmax) {
+			dmax = dist[l];
+			j = i;
+			*uart = bits[l];
+			*ddist = dist[l];
+			*dspan = span[l];
 		}
 	}
-	sp->dist = dist / (11 * sp->span);
+	return (j);
 }
 
 /*
  * chu_decode - decode the character data
  */
-/* data character */
-/* data character timestamp */
-static void chu_decode(struct chuunit *up, int	hexhex, l_fp cstamp)
+static void chu_decode(
+	struct chupath *cp,	/* path structure pointer */
+	int	hexhex,		/* data character */
+	l_fp	cstamp,		/* data character timestamp */
+	uint32_t cidx,		/* data character sample number */
+	float	dist,		/* UART distance */
+	float	span		/* UART envelope span */
+	)
 {
 	l_fp	tstmp;		/* timestamp temp */
 	float	dtemp;
+	float	x, y;
 
 	/*
 	 * If the interval since the last character is greater than the
@@ -744,36 +1163,51 @@ static void chu_decode(struct chuunit *up, int	hexhex, l_fp cstamp)
 	 * the interval is less than this but greater than two
 	 * characters, consider this a noise burst and reject it.
 	 */
-	tstmp = up->timestamp;
-	if (L_ISZERO(&up->laststamp))
-		up->laststamp = up->timestamp;
-	L_SUB(&tstmp, &up->laststamp);
-	up->laststamp = up->timestamp;
+	tstmp = cp->timestamp;
+	if (L_ISZERO(&cp->laststamp))
+		cp->laststamp = cp->timestamp;
+	L_SUB(&tstmp, &cp->laststamp);
+	cp->laststamp = cp->timestamp;
 	LFPTOD(&tstmp, dtemp);
 	if (dtemp > BURST * CHAR) {
-		chu_burst(up);
-		up->ndx = 0;
+		if (cp->ndx > 0)
+			chu_burst(cp);
+		cp->ndx = 0;
 	} else if (dtemp > 2.5f * CHAR) {
-		up->ndx = 0;
+		cp->ndx = 0;
 	}
 
 	/*
 	 * Append the character to the current burst and append the
 	 * character timestamp to the timestamp list.
 	 */
-	if (up->ndx < BURST) {
-		up->cbuf[up->ndx] = hexhex & 0xff;
-		up->cstamp[up->ndx] = cstamp;
-		up->ndx++;
+	if (cp->ndx < BURST) {
+		cp->cbuf[cp->ndx] = hexhex & 0xff;
+		cp->cstamp[cp->ndx] = cstamp;
+		cp->cidx[cp->ndx] = cidx;
 
+		/*
+		 * The bit error probability falls from one half for a
+		 * noise character to PMIN for a clean one, as both the
+		 * distance and the span rise.
+		 */
+		x = (dist - DIST0) / (DIST1 - DIST0);
+		x = x < 0 ? 0 : x > 1 ? 1 : x;
+		y = (span - cp->span) / (2 * cp->span);
+		y = y < 0 ? 0 : y > 1 ? 1 : y;
+		dtemp = 0.5f - (0.5f - PMIN) * x * y;
+		cp->cweight[cp->ndx] = logf((1 - dtemp) / dtemp);
+		cp->ndx++;
 	}
+	cp->bto = BURST * 11 * 8 + 1;
 }
 
 /*
  * chu_burst - search for valid burst format
  */
-static void chu_burst(struct chuunit *up)
+static void chu_burst(struct chupath *cp)
 {
+	float	wgt;		/* burst weight */
 	int	i;
 
 	/*
@@ -782,13 +1216,23 @@ static void chu_burst(struct chuunit *up)
 	 * of bits that match in the two blocks for format A and that
 	 * match the inverse for format B.
 	 */
-	if (up->ndx < MINCHAR) {
-		up->status |= RUNT;
+	if (cp->ndx < MINCHAR) {
+		cp->status |= RUNT;
 		return;
 	}
-	up->burdist = 0;
-	for (i = 0; i < 5 && i < up->ndx - 5; i++)
-		up->burdist += chu_dist(up->cbuf[i], up->cbuf[i + 5]);
+
+	/*
+	 * A burst of characters that all look like noise to the UART is
+	 * noise, whatever they happen to decode to.
+	 */
+	wgt = 0;
+	for (i = 0; i < cp->ndx; i++)
+		wgt += cp->cweight[i];
+	if (wgt < MINWGT * cp->ndx) {
+		cp->status |= NOISE;
+		return;
+	}
+	chu_frame(cp);
 
 	/*
 	 * If the burst distance is at least MINDIST, this must be a
@@ -797,22 +1241,39 @@ static void chu_burst(struct chuunit *up)
 	 * believe it; otherwise, it is a noise burst and of no use to
 	 * anybody.
 	 */
-	if (up->burdist >= MINDIST) {
-		chu_a(up, up->ndx);
-	} else if (up->burdist <= -MINDIST) {
-		chu_b(up, up->ndx);
+	if (cp->burdist >= MINDIST) {
+		chu_a(cp, cp->ndx);
+	} else if (cp->burdist <= -MINDIST) {
+		chu_b(cp, cp->ndx);
 	} else {
-		up->status |= NOISE;
+		cp->status |= NOISE;
 		return;
 	}
 }
 
+/*
+ * chu_puttrace - append a line to the burst trace
+ *
+ * The trace is written out by chu_trace() after each buffer, so lines
+ * from the pool threads come out whole and in channel order. Lines that
+ * do not fit are dropped.
+ */
+static void chu_puttrace(struct chupath *cp, const char *line)
+{
+	size_t	len = strlen(line);
+
+	if (cp->ntrace + len > TRACE)
+		return;
+	memcpy(cp->trace + cp->ntrace, line, len);
+	cp->ntrace += len;
+}
+
 /*
  * chu_b - decode format B burst
  */
-void chu_b(struct chuunit *up, int nchar)
+void chu_b(struct chupath *cp, int nchar)
 {
-	//uint8_t	code[11];	/* decoded timecode */
+	int	code[8];	/* decoded digits */
 	char	tbuf[80];	/* trace buffer */
 	char *	p;
 	size_t	chars;
@@ -827,7 +1288,7 @@ void chu_b(struct chuunit *up, int nchar)
 	 * been found errors are ignored.
 	 */
 	snprintf(tbuf, sizeof(tbuf), "chuB %04x %4.0f %2d %2d ",
-		     up->status, /*up->maxsignal*/255.0, nchar, -up->burdist);
+		     cp->status, sqrtf(cp->peak), nchar, -cp->burdist);
 	cb = sizeof(tbuf);
 	p = tbuf;
 	for (i = 0; i < nchar; i++) {
@@ -838,37 +1299,50 @@ void chu_b(struct chuunit *up, int nchar)
 		}
 		cb -= chars;
 		p += chars;
-		snprintf(p, cb, "%02x", up->cbuf[i]);
+		snprintf(p, cb, "%02x", cp->cbuf[i]);
 	}
 #ifdef DEBUG
 	if (debug) {
-        write(1, tbuf, strlen(tbuf));
+        chu_puttrace(cp, tbuf);
     }
 #endif
-	if (up->burdist > -40) {
-		up->status |= BFRAME;
+	if (cp->burdist > -40) {
+		cp->status |= BFRAME;
 		return;
 	}
 
 	/*
 	 * Convert the burst data to internal format. Don't bother with
-	 * the timestamps.
+	 * the timestamps. The code digit must have even parity and the
+	 * DUT1, year and TAI - UTC digits must be decimal; otherwise, the
+	 * frame was complemented correctly but is still garbage.
 	 */
-    up->year = ((up->cbuf[3] << 8)|up->cbuf[2]);
-    up->dst = up->cbuf[4];
+	for (i = 0; i < 8; i++) {
+		code[i] = (cp->cbuf[i / 2] >> (4 * (i % 2))) & 0xf;
+		if (i > 0 && code[i] > 9) {
+			cp->status |= BFORMAT;
+			return;
+		}
+	}
+	if (__builtin_parity(code[0])) {
+		cp->status |= BFORMAT;
+		return;
+	}
+	cp->status |= BVALID;
+	cp->year = code[2] * 1000 + code[3] * 100 + code[4] * 10 + code[5];
+	cp->dst = cp->cbuf[4];
 }
 
 /*
  * chu_a - decode format A burst
  */
-void chu_a(struct chuunit *up, int nchar)
+void chu_a(struct chupath *cp, int nchar)
 {
 	char	tbuf[80];	/* trace buffer */
 	char *	p;
 	size_t	chars;
 	size_t	cb;
 	l_fp	offset;		/* timestamp offset */
-	int	val;		/* distance */
 	int	temp;
 	int	i, j, k;
 
@@ -878,37 +1352,23 @@ void chu_a(struct chuunit *up, int nchar)
 	 * character late. These cases are distinguished by the position
 	 * of the framing digits 0x6 at positions 0 and 5 and 0x3 at
 	 * positions 4 and 9. The correct phase is when the distance
-	 * relative to the framing digits is maximum. The burst is valid
-	 * only if the maximum distance is at least MINSYNC.
+	 * relative to the framing digits is maximum, as determined by
+	 * chu_frame(). The burst is valid only if the maximum distance
+	 * is at least MINSYNC.
 	 */
-	up->syndist = k = 0;
-	val = -16;
-	for (i = -1; i < 2; i++) {
-		temp = up->cbuf[i + 4] & 0xf;
-		if (i >= 0)
-			temp |= (up->cbuf[i] & 0xf) << 4;
-		val = chu_dist(temp, 0x63);
-		temp = (up->cbuf[i + 5] & 0xf) << 4;
-		if (i + 9 < nchar)
-			temp |= up->cbuf[i + 9] & 0xf;
-		val += chu_dist(temp, 0x63);
-		if (val > up->syndist) {
-			up->syndist = val;
-			k = i;
-		}
-	}
+	k = cp->synpha;
 
 	/*
 	 * Extract the second number; it must be in the range 2 through
 	 * 9 and the two repititions must be the same.
 	 */
-	temp = (up->cbuf[k + 4] >> 4) & 0xf;
+	temp = (cp->cbuf[k + 4] >> 4) & 0xf;
 	if (temp < 2 || temp > 9 || k + 9 >= nchar || temp !=
-	    ((up->cbuf[k + 9] >> 4) & 0xf))
+	    ((cp->cbuf[k + 9] >> 4) & 0xf))
 		temp = 0;
 	snprintf(tbuf, sizeof(tbuf),
-		 "chuA %04x %4.0f %2d %2d %2d %2d %1d ", up->status,
-		 /*up->maxsignal*/255.0, nchar, up->burdist, k, up->syndist,
+		 "chuA %04x %4.0f %2d %2d %2d %2d %1d ", cp->status,
+		 sqrtf(cp->peak), nchar, cp->burdist, k, cp->syndist,
 		 temp);
 	cb = sizeof(tbuf);
 	p = tbuf;
@@ -920,13 +1380,13 @@ void chu_a(struct chuunit *up, int nchar)
 		}
 		cb -= chars;
 		p += chars;
-		snprintf(p, cb, "%02x", up->cbuf[i]);
+		snprintf(p, cb, "%02x", cp->cbuf[i]);
 	}
     *p++ = '\n';
     *p = '\0';
-    write(1, tbuf, strlen(tbuf));
-	if (up->syndist < MINSYNC) {
-		up->status |= AFRAME;
+    chu_puttrace(cp, tbuf);
+	if (cp->syndist < MINSYNC) {
+		cp->status |= AFRAME;
 		return;
 	}
 
@@ -935,40 +1395,43 @@ void chu_a(struct chuunit *up, int nchar)
 	 * last seconds number. If so, the burst timestamps are
 	 * corrected to the current minute and saved for later
 	 * processing. In addition, the seconds decode is advanced from
-	 * the previous burst to the current one.
+	 * the previous burst to the current one. A burst that fails
+	 * this has errors the majority decoder is better off without.
 	 */
 	if (temp == 0) {
-		up->status |= AFORMAT;
+		cp->status |= AFORMAT;
+		return;
 	} else {
-		up->status |= AVALID;
-		up->sec = 30 + temp;
+		cp->status |= AVALID;
+		cp->asec = 30 + temp;
 		offset.l_ui = 30 + temp;
 		offset.l_f = 0;
 		i = 0;
 		if (k < 0)
-			offset = up->charstamp;
+			L_ADD(&offset, &cp->charstamp);
 		else if (k > 0)
 			i = 1;
+		chu_refine(cp, i, nchar < k + 10 ? nchar : k + 10);
 		for (; i < nchar && i < k + 10; i++) {
-			up->tstamp[up->ntstamp] = up->cstamp[i];
-			L_SUB(&up->tstamp[up->ntstamp], &offset);
-			L_ADD(&offset, &up->charstamp);
-			if (up->ntstamp < MAXSTAGE - 1)
-				up->ntstamp++;
+			cp->tstamp[cp->ntstamp] = cp->cstamp[i];
+			L_SUB(&cp->tstamp[cp->ntstamp], &offset);
+			L_ADD(&offset, &cp->charstamp);
+			if (cp->ntstamp < MAXSTAGE - 1)
+				cp->ntstamp++;
 		}
-		while (temp > up->prevsec) {
+		while (temp > cp->prevsec) {
 			for (j = 15; j > 0; j--) {
-				up->decode[9][j] = up->decode[9][j - 1];
-				up->decode[19][j] =
-				    up->decode[19][j - 1];
+				cp->decode[9][j] = cp->decode[9][j - 1];
+				cp->decode[19][j] =
+				    cp->decode[19][j - 1];
 			}
-			up->decode[9][j] = up->decode[19][j] = 0;
-			up->prevsec++;
+			cp->decode[9][j] = cp->decode[19][j] = 0;
+			cp->prevsec++;
 		}
 	}
 
 	/*
-	 * Stash the data in the decoding matrix.
+	 * Stash the data in the decoding matrices.
 	 */
 	i = -(2 * k);
 	for (j = 0; j < nchar; j++) {
@@ -976,51 +1439,191 @@ void chu_a(struct chuunit *up, int nchar)
 			i += 2;
 			continue;
 		}
-		up->decode[i][up->cbuf[j] & 0xf]++;
+		cp->decode[i][cp->cbuf[j] & 0xf]++;
+		chu_llr(cp->llr[i], cp->cbuf[j] & 0xf, cp->cweight[j]);
 		i++;
-		up->decode[i][(up->cbuf[j] >> 4) & 0xf]++;
+		cp->decode[i][(cp->cbuf[j] >> 4) & 0xf]++;
+		chu_llr(cp->llr[i], (cp->cbuf[j] >> 4) & 0xf, cp->cweight[j]);
 		i++;
 	}
-	up->burstcnt++;
+	cp->burstcnt++;
 }
 
+/*
+ * chu_refine - refine the burst timestamps
+ *
+ * The UART timestamps a character at the decoding tick nearest the
+ * middle of its last stop bit, so each timestamp is good only to a
+ * fraction of the 2400-Hz tick. Once the burst is known to be valid,
+ * its characters are known as well, so this routine goes back to the
+ * baseband ring and correlates the discriminator output over the whole
+ * burst with the ideal NRZ signal of the characters, start and stop
+ * bits included. The correlation is computed from a running sum of the
+ * baseband at each whole-sample lag within REFWIN samples of where the
+ * UART put the burst, then the peak is interpolated with a parabola
+ * through it and its neighbors. The timestamps of characters first
+ * through last - 1 are replaced by the refined burst start plus the
+ * nominal character interval. If the burst is no longer in the ring,
+ * the characters are not contiguous or there is no clear interior
+ * peak, the timestamps are left as the UART made them.
+ */
+static void chu_refine(
+	struct chupath *cp,	/* path structure pointer */
+	int	first,		/* first character */
+	int	last		/* last character + 1 */
+	)
+{
+	double	sum[REFLEN + 1]; /* running sum of the baseband */
+	double	corr[2 * REFWIN + 1]; /* correlation by lag */
+	double	c0, cm, cp1;
+	float	pred;		/* UART burst start after base */
+	float	edge;
+	uint32_t base;		/* first sample of the window */
+	l_fp	delta;
+	int	len, n, lo, hi;
+	int	i, b, t, v, tmax;
+
+	if (last - first < 2)
+		return;
+	for (i = first + 1; i < last; i++) {
+		if (fabsf((float)(cp->cidx[i] - cp->cidx[first]) - (i -
+		    first) * 11 * REFSPB) > REFSPB)
+			return;
+	}
+
+	/*
+	 * The sample at cidx is the one the lowpass filter output at
+	 * the decoding tick came from, LPFDLY samples late, and the
+	 * character began 10.5 bits before it.
+	 */
+	pred = -10.5f * REFSPB - LPFDLY;
+	n = (int)floorf(pred) - REFWIN;
+	base = cp->cidx[first] + n;
+	pred -= n;
+	len = (int)ceilf(pred + (last - first) * 11 * REFSPB) + REFWIN + 1;
+	if (len > REFLEN || cp->nsamp - base > BBUF || cp->nsamp - base <
+	    (uint32_t)len)
+		return;
+
+	/*
+	 * Mark is negative at the discriminator.
+	 */
+	sum[0] = 0;
+	for (i = 0; i < len; i++)
+		sum[i + 1] = sum[i] - cp->bbuf[(base + i) & (BBUF - 1)];
+	for (t = -REFWIN; t <= REFWIN; t++)
+		corr[t + REFWIN] = 0;
+	for (i = first; i < last; i++) {
+		for (b = 0; b < 11; b++) {
+			if (b == 0)
+				v = -1;
+			else if (b > 8)
+				v = 1;
+			else
+				v = (cp->cbuf[i] >> (b - 1)) & 1 ? 1 : -1;
+			edge = pred + ((i - first) * 11 + b) * REFSPB;
+			lo = (int)lrintf(edge);
+			hi = (int)lrintf(edge + REFSPB);
+			for (t = -REFWIN; t <= REFWIN; t++)
+				corr[t + REFWIN] += v * (sum[hi + t] -
+				    sum[lo + t]);
+		}
+	}
+	tmax = 0;
+	for (t = 1; t < 2 * REFWIN + 1; t++) {
+		if (corr[t] > corr[tmax])
+			tmax = t;
+	}
+	if (tmax == 0 || tmax == 2 * REFWIN || corr[tmax] <= 0)
+		return;
+
+	cm = corr[tmax - 1];
+	c0 = corr[tmax];
+	cp1 = corr[tmax + 1];
+	DTOLFP((tmax - REFWIN + 0.5 * (cm - cp1) / (cm - 2 * c0 + cp1)) /
+	    SECOND, &delta);
+	L_ADD(&delta, &cp->cstamp[first]);
+	for (i = first; i < last; i++) {
+		cp->cstamp[i] = delta;
+		L_ADD(&delta, &cp->charstamp);
+	}
+}
+
+/*
+ * chu_llr - add a received digit to a row of the soft-decision matrix
+ *
+ * Each candidate digit loses the character weight for each bit in
+ * which it differs from the received digit, so the row holds the log
+ * likelihood of each candidate, less a constant.
+ */
+static void chu_llr(float *row, int digit, float wgt)
+{
+	int	j;
+
+	for (j = 0; j < 16; j++)
+		row[j] -= wgt * __builtin_popcount(digit ^ j);
+}
+
+/*
+ * chu_yearstart - return the start of the year containing an NTP time
+ */
+static uint32_t chu_yearstart(uint32_t ntp_ui)
+{
+	struct calendar jt;
+	uint32_t day = ntp_ui / 86400;
+
+	caljulian(day, &jt);	/* yearday is zero-based */
+	return ((day - jt.yearday) * 86400);
+}
+
+/*
+ * clocktime - compute the clock time of a timecode
+ *
+ * The timecode carries no year, so the year is the one of the receive
+ * time rec_ui, unless the timecode then falls more than half a year
+ * from the receive time, as it does across New Year, in which case the
+ * previous or next year is used instead. The start of the year goes in
+ * *yearstart and the clock time in *ts_ui. Returns 1.
+ */
 int clocktime(int yday, int hour, int minute, int second, uint32_t rec_ui, uint32_t *yearstart, uint32_t *ts_ui)
 {
-	register int32_t tmp;
-	register uint32_t yst;
+	int32_t	tmp;
+	uint32_t yst;
 
 	/*
-	 * Compute the offset into the year in seconds.  Note that
-	 * this could come out to be a negative number.
+	 * Compute the offset into the year in seconds.
 	 */
 	tmp = (int32_t)((24 * (yday-1)) + hour);
 	tmp = (60 * tmp) + (int32_t)minute;
 	tmp = (60 * tmp) + (int32_t)second;
 
 	/*
-	 * Initialize yearstart, if necessary.
+	 * The NTP time stamps (l_fp) count seconds unsigned mod 2**32,
+	 * so the differences are taken the same way.
 	 */
-	yst = *yearstart;
-	if (yst == 0) {
-		struct calendar jt;
-		caljulian(rec_ui,&jt);
-		/* The NTP time stamps (l_fp) count seconds unsigned mod 2**32, so we
-	 	 * have to calculate this in the proper way!
-	 	 */
-		yst = (uint32_t)(rec_ui - (uint32_t)jt.yearday);
-		*yearstart = yst;
-	}
-
-	*ts_ui = (uint32_t)(tmp + (int32_t)yst);
+	yst = chu_yearstart(rec_ui);
+	if ((int32_t)(yst + tmp - rec_ui) > 183 * 86400)
+		yst = chu_yearstart(yst - 86400);
+	else if ((int32_t)(rec_ui - yst - tmp) > 183 * 86400)
+		yst = chu_yearstart(yst + 366 * 86400);
+	*yearstart = yst;
+	*ts_ui = yst + tmp;
 	return 1;
 }
 
 /*
  * chu_second - process minute data
+ *
+ * The time now is taken as the end of the last buffer received, not
+ * the system clock, so the decoder keeps to the time of the samples
+ * whether they are live or replayed. The update argument is the time
+ * the clock was last synchronized. Returns 1 at the end of a minute,
+ * when a_lastcode holds its timecode and nstage the number of offset
+ * samples taken from it, and 0 otherwise.
  */
-void chu_second(int unit, struct chuunit *up, unsigned int update)
+int chu_second(int unit, struct chuunit *up, unsigned int update)
 {
-	l_fp	offset, curtime;
+	l_fp	offset;
 	char	synchar, qual, leapchar;
 	int	minset, i;
 	float	dtemp;
@@ -1032,7 +1635,7 @@ void chu_second(int unit, struct chuunit *up, unsigned int update)
 	 */
 	up->sec = (up->sec + 1) % 60;
 	if (up->sec != 0)
-		return;
+		return (0);
 
 	/*
 	 * Process the last burst, if still in the burst buffer.
@@ -1040,10 +1643,8 @@ void chu_second(int unit, struct chuunit *up, unsigned int update)
 	 * frame metric, it is considered valid. However, the timecode
 	 * is sent to clockstats even if invalid.
 	 */
-	chu_burst(up);
-    get_systime(&curtime);
-	//minset = ((current_time - update) + 30) / 60;
-	minset = ((curtime.l_ui - update) + 30) / 60;
+	chu_combine(up);
+	minset = ((up->rcvtime.l_ui - update) + 30) / 60;
 	dtemp = chu_major(up);
 	qual = 0;
 	if (up->status & (BFRAME | AFRAME))
@@ -1054,7 +1655,8 @@ void chu_second(int unit, struct chuunit *up, unsigned int update)
 		qual |= DECERR;
 	if (up->status & STAMP)
 		qual |= TSPERR;
-	if (up->status & BVALID && dtemp >= MINMETRIC)
+	if (up->status & BVALID && (dtemp >= MINMETRIC || up->margin >=
+	    SYNLLR))
 		up->status |= INSYNC;
 	synchar = leapchar = ' ';
 	if (!(up->status & INSYNC)) {
@@ -1065,7 +1667,7 @@ void chu_second(int unit, struct chuunit *up, unsigned int update)
 	}
 	up->lencode = snprintf(up->a_lastcode, sizeof(up->a_lastcode), "%c%1X %04d %03d %02u:%02u:%02u %c%x %d %d %s %.0f %d",
 	    synchar, qual, up->year, up->day, up->hour, up->min,
-	    up->sec, leapchar, up->dst, minset, up->gain,
+	    up->sec, leapchar, up->dst, minset, (int)lrintf(20 * log10f(up->gain)),
 	    up->ident, dtemp, up->ntstamp);
 
 	/*
@@ -1073,63 +1675,186 @@ void chu_second(int unit, struct chuunit *up, unsigned int update)
 	 * timecode is ipso fatso valid and can be selected to
 	 * discipline the clock.
 	 */
-	if (up->status & INSYNC && !(up->status & (DECODE | STAMP)) && dtemp > MINMETRIC) {
+	up->nstage = 0;
+	if (up->status & INSYNC && !(up->status & (DECODE | STAMP)) &&
+	    (dtemp > MINMETRIC || up->margin >= SYNLLR)) {
 		clocktime(up->day, up->hour, up->min, 0, up->tstamp[0].l_ui, &up->yearstart, &offset.l_ui);
 		offset.l_uf = 0;
-#if 0
 		for (i = 0; i < up->ntstamp; i++)
-			refclock_process_offset(pp, offset, up->tstamp[i], PDELAY + pp->fudgetime1);
-		pp->lastref = up->timestamp;
-		refclock_receive(peer);
-#endif
+			chu_process_offset(up, offset, up->tstamp[i], PDELAY + up->fudgetime1);
+		if (chu_sample(up))
+			chu_publish(up, offset);
 	}
 	printf("chu: timecode %d %s\n", up->lencode, up->a_lastcode);
 	chu_clear(up);
 	up->errflg = 0;
+	return (1);
 }
 
 /*
- * chu_major - majority decoder
+ * chu_process_offset - add a sample to the offset filter
+ *
+ * The sample is the difference between the clock time of the minute
+ * and the receive timestamp of a burst character, already corrected to
+ * the minute, plus the fixed delays.
+ */
+static void
+chu_process_offset(
+	struct chuunit *up,
+	l_fp	lasttim,	/* clock time */
+	l_fp	lastrec,	/* receive time */
+	double	fudge		/* delays (s) */
+	)
+{
+	l_fp	lftemp;
+	double	doffset;
+
+	lftemp = lasttim;
+	L_SUB(&lftemp, &lastrec);
+	LFPTOD(&lftemp, doffset);
+	if (up->nstage < NCHAN * MAXSTAGE)
+		up->filter[up->nstage++] = doffset + fudge;
+}
+
+static int
+chu_cmpoff(const void *a, const void *b)
+{
+	double	x = *(const double *)a, y = *(const double *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+/*
+ * chu_sample - process the samples of the minute
+ *
+ * This routine sorts the samples, trims the outliers furthest from the
+ * median until about 60 percent remain and returns the mean of the rest
+ * as the offset and the RMS of the differences between neighbours as
+ * the jitter. Returns the number of samples used, or zero if there are
+ * none.
+ */
+static int
+chu_sample(struct chuunit *up)
+{
+	double	*off = up->filter;
+	double	offset, jitter;
+	int	i, j, k, m, n = up->nstage;
+
+	if (n == 0)
+		return (0);
+	qsort(off, n, sizeof(double), chu_cmpoff);
+
+	/*
+	 * Reject the furthest from the median of the samples until
+	 * approximately 60 percent of the samples remain.
+	 */
+	i = 0; j = n;
+	m = n - (n * 4) / 10;
+	while ((j - i) > m) {
+		offset = off[(j + i) / 2];
+		if (off[j - 1] - offset < offset - off[i])
+			i++;	/* reject low end */
+		else
+			j--;	/* reject high end */
+	}
+
+	/*
+	 * Determine the offset and jitter.
+	 */
+	offset = jitter = 0;
+	for (k = i; k < j; k++) {
+		offset += off[k];
+		if (k > i)
+			jitter += (off[k] - off[k - 1]) * (off[k] - off[k - 1]);
+	}
+	up->offset = offset / m;
+	if (m > 2)
+		jitter /= m - 1;
+	up->jitter = sqrt(jitter);
+	return (m);
+}
+
+/*
+ * chu_publish - publish the minute to the NTP shared memory segment
+ *
+ * The clock time is the start of the minute and the receive time that
+ * less the filtered offset. The precision follows the jitter, but is
+ * never claimed better than PRECISION.
+ */
+static void
+chu_publish(struct chuunit *up, l_fp lasttim)
+{
+	struct timedelta_t td;
+	l_fp	rec, lftemp;
+	int	precision;
+
+	if (up->shmTime == NULL)
+		return;
+	rec = lasttim;
+	DTOLFP(up->offset, &lftemp);
+	L_SUB(&rec, &lftemp);
+	td.real.tv_sec = lasttim.l_ui - JAN_1970;
+	td.real.tv_nsec = 0;
+	td.clock.tv_sec = rec.l_ui - JAN_1970;
+	td.clock.tv_nsec = (long)((double)rec.l_uf / FRAC * 1e9);
+	for (precision = PRECISION; precision < 0 &&
+	    up->jitter > ldexp(1., precision); precision++)
+		;
+	ntp_write(up->shmTime, &td, precision);
+}
+
+/*
+ * chu_major - maximum-likelihood digit decoder
  */
 static float
 chu_major(struct chuunit *up)
 {
-	uint8_t	code[11];	/* decoded timecode */
+	int	code[9];	/* decoded digits */
 	int	metric;		/* distance metric */
-	int	val1;		/* maximum distance */
-	int	synchar;	/* stray cat */
-	int	temp;
+	float	best, next;	/* max and runner-up likelihood */
+	float	margin;		/* min digit margin */
+	float	llr;
 	int	i, j, k;
 
 	/*
-	 * Majority decoder. Each burst encodes two replications at each
-	 * digit position in the timecode. Each row of the decoding
-	 * matrix encodes the number of occurences of each digit found
-	 * at the corresponding position. The maximum over all
-	 * occurrences at each position is the distance for this
-	 * position and the corresponding digit is the maximum-
-	 * likelihood candidate. If the distance is not more than half
-	 * the total number of occurences, a majority has not been found
-	 * and the data are discarded. The decoding distance is defined
-	 * as the sum of the distances over the first nine digits. The
-	 * tenth digit varies over the seconds, so we don't count it.
+	 * Soft-decision decoder. Each burst encodes two replications at
+	 * each digit position in the timecode. Each row of the soft-
+	 * decision matrix holds the log likelihood of each digit at the
+	 * corresponding position, summed over the occurrences found
+	 * there and weighted by how clean each occurrence looked to the
+	 * UART. The digit with maximum likelihood over both rows is the
+	 * decoded digit, and its margin over the runner-up measures the
+	 * confidence. If the margin at any of the first nine digits is
+	 * less than MINLLR, which takes both occurrences in a fair burst
+	 * or one in a clean burst, the data are discarded. The tenth digit varies over the seconds,
+	 * so we don't count it.
+	 *
+	 * The decoding distance is still the number of occurrences of
+	 * the decoded digits, as in the majority decoder this replaces.
 	 */
 	metric = 0;
+	margin = 1e9f;
 	for (i = 0; i < 9; i++) {
-		val1 = 0;
+		best = next = -1e9f;
 		k = 0;
 		for (j = 0; j < 16; j++) {
-			temp = up->decode[i][j] + up->decode[i + 10][j];
-			if (temp > val1) {
-				val1 = temp;
+			llr = up->llr[i][j] + up->llr[i + 10][j];
+			if (llr > best) {
+				next = best;
+				best = llr;
 				k = j;
+			} else if (llr > next) {
+				next = llr;
 			}
 		}
-		if (val1 <= up->burstcnt)
-			up->status |= DECODE;
-		metric += val1;
-		code[i] = hexchar[k];
+		if (best - next < margin)
+			margin = best - next;
+		metric += up->decode[i][k] + up->decode[i + 10][k];
+		code[i] = k;
 	}
+	up->margin = margin;
+	if (margin < MINLLR)
+		up->status |= DECODE;
 
 	/*
 	 * Compute the timecode timestamp from the days, hours and
@@ -1138,62 +1863,470 @@ chu_major(struct chuunit *up)
 	 * seconds. Note that this code relies on the filesystem time
 	 * for the years and does not use the years of the timecode.
 	 */
-    synchar = (((code[0] - 0x30) <= 9) ? (code[0] - 0x30) : ((code[0]|0x20) - 'a' + 10));
-    up->day = ((code[1]*100) + (code[2]*10) + code[3]);
-    up->hour = ((code[4]*10) + code[5]);
-    up->min = ((code[6]*10) + code[7]);
+	up->day = code[1] * 100 + code[2] * 10 + code[3];
+	up->hour = code[4] * 10 + code[5];
+	up->min = code[6] * 10 + code[7];
 	if (up->ntstamp < MINSTAMP)
 		up->status |= STAMP;
 	return (metric);
 }
 
+/*
+ * chu_combine - combine the bursts of all paths for the minute
+ *
+ * This routine processes the last burst of each path, then adds up the
+ * decoding matrices and collects the timestamps and status bits of all
+ * paths in the unit, so the majority decoder sees every burst heard on
+ * any frequency. The path with the most format A bursts names the
+ * station and gives the gain.
+ */
+static void
+chu_combine(struct chuunit *up)
+{
+	struct chupath *cp;
+	int	best, i, j, k;
+
+	for (i = 0; i < NCHAN && (cp = up->path[i]) != NULL; i++)
+		chu_burst(cp);
+	chu_trace(up);
+	best = 0;
+	for (i = 0; i < NCHAN && (cp = up->path[i]) != NULL; i++) {
+		for (j = 0; j < 20; j++) {
+			for (k = 0; k < 16; k++) {
+				up->decode[j][k] += cp->decode[j][k];
+				up->llr[j][k] += cp->llr[j][k];
+			}
+		}
+		memcpy(&up->tstamp[up->ntstamp], cp->tstamp, cp->ntstamp *
+		    sizeof(l_fp));
+		up->ntstamp += cp->ntstamp;
+		up->burstcnt += cp->burstcnt;
+		up->status |= cp->status;
+		if (cp->year != 0) {
+			up->year = cp->year;
+			up->dst = cp->dst;
+		}
+		if (cp->burstcnt > up->path[best]->burstcnt)
+			best = i;
+	}
+	strcpy(up->ident, up->path[best]->ident);
+	up->gain = up->path[best]->gain;
+}
+
 /*
  * chu_clear - clear decoding matrix
  */
 static void
 chu_clear(struct chuunit *up)
 {
-	int	i, j;
+	struct chupath *cp;
+	int	i;
 
 	/*
 	 * Clear stuff for the minute.
 	 */
-	up->ndx = up->prevsec = 0;
 	up->burstcnt = up->ntstamp = 0;
 	up->status &= INSYNC | METRIC;
-	for (i = 0; i < 20; i++) {
-		for (j = 0; j < 16; j++)
-			up->decode[i][j] = 0;
+	memset(up->decode, 0, sizeof(up->decode));
+	memset(up->llr, 0, sizeof(up->llr));
+	for (i = 0; i < NCHAN && (cp = up->path[i]) != NULL; i++) {
+		cp->ndx = cp->prevsec = 0;
+		cp->burstcnt = cp->ntstamp = 0;
+		cp->status = 0;
+		memset(cp->decode, 0, sizeof(cp->decode));
+		memset(cp->llr, 0, sizeof(cp->llr));
 	}
 }
 
 /*
- * chu_gain - adjust codec gain
- *
- * This routine is called at the end of each second. During the second
- * the number of signal clips above the MAXAMP threshold (6000). If
- * there are no clips, the gain is bumped up; if there are more than
- * MAXCLP clips (100), it is bumped down. The decoder is relatively
- * insensitive to amplitude, so this crudity works just peachy. The
- * routine also jiggles the input port and selectively mutes the
+ * chu_gain - adjust AGC gain, limiter and span
+ *
+ * This routine is called at the end of each second. The signal level
+ * follows the largest envelope window energy at once on the way up and
+ * over PEAKTC seconds on the way down, so it holds over the seconds
+ * without bursts, while the noise floor follows the smallest over
+ * FLOORTC seconds. Both are kept in terms of the input, before the
+ * gain. The gain brings the noise floor to NOISEREF, unless that would
+ * take the signal level over PEAKREF or more than MAXCLP samples were
+ * clipped in the second. The gain comes down at once but goes up by no
+ * more than AGCUP per second.
+ *
+ * The limiter threshold is LIMSIG times the signal amplitude, about
+ * its peak, so the limiter clips noise spikes and fades in the signal
+ * but does not square up the signal itself, which costs a few dB at
+ * low SNR. The UART span threshold scales with it, so characters are
+ * judged against the signal actually heard rather than a fixed level,
+ * but it is held to at least SPANNSE times the noise floor and at most
+ * SPANMAX times the limiter threshold. Between calls chu_fsk() can
+ * only raise the limiter threshold, when a burst arrives well above
+ * it.
  */
 static void
-chu_gain(struct chuunit *up)
+chu_gain(struct chupath *cp)
 {
+	float	g2;		/* gain squared */
+	float	noise, sig;	/* noise and signal amplitude (rms) */
+	float	gain;
+
+	g2 = cp->gain * cp->gain * ENVWIN;
+	if (cp->envmax / g2 > cp->peak)
+		cp->peak = cp->envmax / g2;
+	else
+		cp->peak += (cp->envmax / g2 - cp->peak) / PEAKTC;
+	if (cp->floor == 0)
+		cp->floor = cp->envmin / g2;
+	else
+		cp->floor += (cp->envmin / g2 - cp->floor) / FLOORTC;
+	cp->envmax = 0;
+	cp->envmin = 1e30f;
+
+	gain = NOISEREF / sqrtf(cp->floor + 1e-6f);
+	if (gain * gain * cp->peak > PEAKREF * PEAKREF)
+		gain = PEAKREF / sqrtf(cp->peak);
+	if (cp->clipcnt > MAXCLP && gain > cp->gain / AGCUP)
+		gain = cp->gain / AGCUP;
+	if (gain > cp->gain * AGCUP)
+		gain = cp->gain * AGCUP;
+	if (gain > AGCMAX)
+		gain = AGCMAX;
+	else if (gain < AGCMIN)
+		gain = AGCMIN;
+	cp->gain = gain;
+	cp->clipcnt = 0;
+
+	noise = gain * sqrtf(cp->floor);
+	sig = gain * sqrtf(cp->peak);
+	cp->limit = LIMSIG * sig;
+	if (cp->limit < 1)
+		cp->limit = 1;
+	cp->span = SPAN / LIMIT * cp->limit;
+	if (cp->span < SPANNSE * noise)
+		cp->span = SPANNSE * noise;
+	if (cp->span > SPANMAX * cp->limit)
+		cp->span = SPANMAX * cp->limit;
+}
+
+
+
+/*
+ * The program below is left out when the decoder is linked into
+ * another program, such as the benchmark.
+ */
+#ifndef NO_MAIN
+/*
+ * Live and replay driver. Live input is read from the file given, a
+ * sound device or a pipe from one, in blocks of -n samples, each
+ * timestamped with the system time as its read returns. With -c it
+ * has that many interleaved channels, each feeding a path in qsy[]
+ * order. The offset of each good minute is written to NTP shared
+ * memory unit SHMUNIT or the one given with -u. SIGTERM stops the
+ * program at the end of the current block.
+ *
+ * With -r the input is recorded captures instead, memory mapped and
+ * decoded as fast as the processor allows. The receive time of each
+ * block is derived from its sample index and chu_second() is called at
+ * each whole second of samples, so the decoder runs on the clock of the
+ * capture rather than the system clock and a run is exactly
+ * repeatable. A capture is either a WAV file, 16-bit PCM at 8 kHz, or
+ * raw samples. With one file, each of its first NCHAN channels feeds a
+ * path; with more than one, each file feeds a path from its first
+ * channel. Nothing is written to the NTP shared memory segment.
+ *
+ * Each minute makes a record
+ *
+ *	offset jitter timecode
+ *
+ * with '-' for the offset and jitter if the minute was not good enough
+ * to discipline the clock. With -o the records are written to a file,
+ * which can later serve as the golden file for -g. With -r and -g the
+ * records are compared with those of the golden file in order: the
+ * timecodes must match exactly and the offsets to within the -e
+ * tolerance. The exit status is 1 if any do not.
+ */
+#define GOLDTOL		1e-4	/* default offset tolerance (s) */
+#define RECLEN		(BMAX + 64) /* max minute record length */
+
+/*
+ * chu_golden - compare a minute record with the next record of the
+ * golden file. Returns 0 if they agree, 1 if not.
+ */
+static int chu_golden(FILE *gold, const char *rec, int minute, double tol)
+{
+	char	line[RECLEN];	/* golden record */
+	char	off[2][32];	/* offsets as text */
+	int	pos[2];		/* timecode positions */
+
+	if (fgets(line, sizeof(line), gold) == NULL) {
+		fprintf(stderr, "golden: minute %d: %s", minute, rec);
+		fprintf(stderr, "golden: not in golden file\n");
+		return (1);
+	}
+	pos[0] = pos[1] = 0;
+	sscanf(rec, "%31s %*s %n", off[0], &pos[0]);
+	sscanf(line, "%31s %*s %n", off[1], &pos[1]);
+	if (pos[1] == 0 || strcmp(rec + pos[0], line + pos[1]) != 0 ||
+	    (off[0][0] == '-') != (off[1][0] == '-') || (off[0][0] !=
+	    '-' && fabs(atof(off[0]) - atof(off[1])) > tol)) {
+		fprintf(stderr, "golden: minute %d: %s", minute, rec);
+		fprintf(stderr, "golden: expected %s", line);
+		return (1);
+	}
+	return (0);
+}
+
+static volatile sig_atomic_t terminate; /* SIGTERM received */
+
+static void sigterm(int sig)
+{
+	(void)sig;
+	terminate = 1;
+}
+
+/*
+ * chu_read - read a whole block. Returns 0 if successful, -1 at end of
+ * input, on error or on SIGTERM.
+ */
+static int chu_read(int fd, int16_t *buf, size_t len)
+{
+	size_t	done = 0;
+	ssize_t	n;
+
+	while (done < len) {
+		if (terminate || (n = read(fd, (char *)buf + done, len -
+		    done)) <= 0)
+			return (-1);
+		done += n;
+	}
+	return (0);
+}
+
+int main(int argc, char **argv)
+{
+	const char *usage_str = "usage: chu [-c paths] [-n blocksize] [-o file] [-u unit] file\n       chu -r [-e tolerance] [-g golden | -o golden] [-n blocksize] [-t start] file [file...]\n";
+	struct wavfile cap[NCHAN];
+	int16_t	*buf[NCHAN];
+	int16_t	*ibuf = NULL;
+	struct chuunit *up;
+	struct sigaction sa;
+	struct timespec t1, t2;
+	FILE	*gold = NULL, *out = NULL;
+	char	rec[RECLEN];
+	unsigned int blksiz = SECOND;
+	unsigned int nfile = 0, npath = 1, n, i, j;
+	unsigned int unit = SHMUNIT;
+	unsigned int update;
+	size_t	nsamp = 0, k, sec;
+	double	tol = GOLDTOL;
+	double	dtemp;
+	long	start = -1;
+	l_fp	t0, t;
+	int	minutes = 0, sampled = 0, errs = 0;
+	int	replay = 0;
+	int	in_fd = -1, c;
+
+	while ((c = getopt(argc, argv, "c:e:g:n:o:rt:u:")) != -1) {
+		switch (c) {
+		case 'c':
+			npath = atoi(optarg);
+			break;
+		case 'e':
+			tol = atof(optarg);
+			break;
+		case 'g':
+			if (!(gold = fopen(optarg, "r"))) {
+				perror(optarg);
+				return (1);
+			}
+			break;
+		case 'n':
+			blksiz = atoi(optarg);
+			break;
+		case 'o':
+			if (!(out = fopen(optarg, "w"))) {
+				perror(optarg);
+				return (1);
+			}
+			break;
+		case 'r':
+			replay = 1;
+			break;
+		case 't':
+			start = atol(optarg);
+			break;
+		case 'u':
+			unit = atoi(optarg);
+			break;
+		default:
+			fputs(usage_str, stderr);
+			return (1);
+		}
+	}
+	nfile = argc - optind;
+	if (nfile < 1 || nfile > (replay ? NCHAN : 1) || (!replay && gold !=
+	    NULL)) {
+		fputs(usage_str, stderr);
+		return (1);
+	}
+	if (blksiz < 1 || blksiz > SECOND) {
+		fprintf(stderr, "chu: bad block size %u\n", blksiz);
+		return (1);
+	}
+	if (npath < 1 || npath > NCHAN) {
+		fprintf(stderr, "chu: bad path count %u\n", npath);
+		return (1);
+	}
+
+	if (replay) {
+
+		/*
+		 * Map the captures. The replay is as long as the
+		 * shortest.
+		 */
+		nsamp = (size_t)-1;
+		for (i = 0; i < nfile; i++) {
+			if (wav_map(argv[optind + i], SECOND, &cap[i]) < 0)
+				return (1);
+			if (cap[i].nsamp < nsamp)
+				nsamp = cap[i].nsamp;
+		}
+		npath = nfile > 1 ? nfile : cap[0].nchan < NCHAN ?
+		    cap[0].nchan : NCHAN;
+	} else {
+		if ((in_fd = open(argv[optind], O_RDONLY)) < 0) {
+			perror(argv[optind]);
+			return (1);
+		}
+		if (!(ibuf = (int16_t *)malloc(blksiz * npath *
+		    sizeof(int16_t))))
+			return (1);
+	}
+	for (i = 0; i < NCHAN; i++) {
+		buf[i] = NULL;
+		if (i < npath && !(buf[i] = (int16_t *)malloc(blksiz *
+		    sizeof(int16_t))))
+			return (1);
+	}
+	if (!(up = chu_start()))
+		return (1);
+	if (npath > 1 && chu_multi(up, npath) < 0) {
+		fprintf(stderr, "chu: cannot start %u paths\n", npath);
+		return (1);
+	}
+	if (!replay && !(up->shmTime = shm_get(unit, 1))) {
+		fprintf(stderr, "chu: cannot attach NTP shared memory unit %u\n",
+		    unit);
+		return (1);
+	}
+
 	/*
-	 * Apparently, the codec uses only the high order bits of the
-	 * gain control field. Thus, it may take awhile for changes to
-	 * wiggle the hardware bits.
+	 * Unless told otherwise, a capture ended when the file was last
+	 * modified. Live input starts now.
 	 */
-	if (up->clipcnt == 0) {
-		up->gain += 4;
-		if (up->gain > MAXGAIN)
-			up->gain = MAXGAIN;
-	} else if (up->clipcnt > MAXCLP) {
-		up->gain -= 4;
-		if (up->gain < 0)
-			up->gain = 0;
+	if (replay) {
+		if (start < 0)
+			start = cap[0].mtime - nsamp / SECOND;
+		t0.l_ui = start + JAN_1970;
+		t0.l_uf = 0;
+	} else {
+		get_systime(&t0);
 	}
-	up->clipcnt = 0;
-}
+	update = t0.l_ui;
+
+	/*
+	 * SIGTERM interrupts the read, so the loop can exit. The decoder
+	 * writes its trace lines with write(2) and the rest with
+	 * printf(), so keep them in order.
+	 */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigterm;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	for (k = sec = 0; ; k += n) {
+		if (replay) {
+			if (k >= nsamp)
+				break;
+			n = nsamp - k < blksiz ? nsamp - k : blksiz;
+			for (i = 0; i < npath; i++) {
+				const struct wavfile *fp = &cap[nfile > 1 ?
+				    i : 0];
+				const int16_t *sp = fp->samp + k *
+				    fp->nchan + (nfile > 1 ? 0 : i);
+
+				for (j = 0; j < n; j++)
+					buf[i][j] = sp[j * fp->nchan];
+			}
+			DTOLFP((double)(k + n) / SECOND, &t);
+			L_ADD(&t, &t0);
+		} else {
+			n = blksiz;
+			if (chu_read(in_fd, ibuf, n * npath *
+			    sizeof(int16_t)) < 0)
+				break;
+			get_systime(&t);
+			for (i = 0; i < npath; i++) {
+				for (j = 0; j < n; j++)
+					buf[i][j] = ibuf[j * npath + i];
+			}
+		}
+		if (npath > 1)
+			chu_receive_multi(up, buf, n, t);
+		else
+			chu_receive(up, buf[0], n, t);
+		for (; sec < (k + n) / SECOND; sec++) {
+			if (!chu_second(0, up, update))
+				continue;
 
+			minutes++;
+			if (up->nstage > 0) {
+				sampled++;
+				update = up->rcvtime.l_ui;
+				snprintf(rec, sizeof(rec), "%.6f %.6f %s\n",
+				    up->offset, up->jitter, up->a_lastcode);
+			} else {
+				snprintf(rec, sizeof(rec), "- - %s\n",
+				    up->a_lastcode);
+			}
+			if (out != NULL) {
+				fputs(rec, out);
+				if (!replay)
+					fflush(out);
+			}
+			if (gold != NULL)
+				errs += chu_golden(gold, rec, minutes, tol);
+		}
+	}
+	if (replay) {
+		clock_gettime(CLOCK_MONOTONIC, &t2);
+		dtemp = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) *
+		    1e-9;
+		fprintf(stderr, "replay: %.0f s in %.3f s (%.0fx)\n",
+		    (double)k / SECOND, dtemp, dtemp > 0 ? k / SECOND /
+		    dtemp : 0);
+		fprintf(stderr, "replay: %d minutes %d sampled\n", minutes,
+		    sampled);
+	}
+	if (gold != NULL) {
+		while (fgets(rec, sizeof(rec), gold) != NULL) {
+			fprintf(stderr, "golden: expected %s", rec);
+			errs++;
+		}
+		fprintf(stderr, "golden: %d minutes %d differ\n", minutes, errs);
+		fclose(gold);
+	}
+	if (out != NULL)
+		fclose(out);
+	chu_shutdown(up);
+	for (i = 0; i < NCHAN; i++)
+		free(buf[i]);
+	free(ibuf);
+	if (replay) {
+		for (i = 0; i < nfile; i++)
+			wav_unmap(&cap[i]);
+	} else {
+		close(in_fd);
+	}
+	return (errs > 0);
+}
+#endif /* NO_MAIN */
@@ -1,36 +1,56 @@
 /*
- * refclock_irig - audio IRIG-B/E demodulator/decoder
+ * refclock_irig - audio IRIG-A/B/E demodulator/decoder
  */
-#include "ntp_calendar.h"
 
-#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
-#include <sys/ioctl.h>
-#include "audio.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include "ntp_fp.h"
+#include "ntpshm.h"
+#include "irigrec.h"
+#include "pool.h"
+#include "simd.h"
 
 /*
- * Audio IRIG-B/E demodulator/decoder
+ * Audio IRIG-A/B/E demodulator/decoder
  *
  * This driver synchronizes the computer time using data encoded in
- * IRIG-B/E signals commonly produced by GPS receivers and other timing
- * devices. The IRIG signal is an amplitude-modulated carrier with
+ * IRIG-A/B/E signals commonly produced by GPS receivers and other
+ * timing devices. The IRIG signal is an amplitude-modulated carrier with
  * pulse-width modulated data bits. For IRIG-B, the carrier frequency is
  * 1000 Hz and bit rate 100 b/s; for IRIG-E, the carrier frequenchy is
  * 100 Hz and bit rate 10 b/s. The driver automatically recognizes which
  & format is in use.
  *
- * The driver requires an audio codec or sound card with sampling rate 8
- * kHz and mu-law companding. This is the same standard as used by the
- * telephone industry and is supported by most hardware and operating
- * systems, including Solaris, SunOS, FreeBSD, NetBSD and Linux. In this
- * implementation, only one audio driver and codec can be supported on a
- * single machine.
+ * For IRIG-A, the carrier frequency is 10 kHz and bit rate 1000 b/s,
+ * which needs a codec running at 48 or 96 kHz. The frames are a tenth
+ * of a second, numbered by a tenths-of-seconds digit, and only the
+ * first frame of each second is timestamped. With ten times the carrier
+ * frequency of IRIG-B the timing is about ten times finer. IRIG-G, with
+ * its 100-kHz carrier, is beyond the reach of any audio codec.
+ *
+ * The program reads 16-bit linear samples at 8 kHz (IRIG-B/E) or at 48
+ * or 96 kHz (IRIG-A) from a file or FIFO, such as one fed by arecord(1)
+ * from the line input of a sound card, and timestamps each buffer as
+ * its read returns. It runs without ntpd; the offsets go to an NTP
+ * shared memory segment, from which ntpd or chrony reads them with its
+ * SHM driver.
  *
- * The program processes 8000-Hz mu-law companded samples using separate
- * signal filters for IRIG-B and IRIG-E, a comb filter, envelope
- * detector and automatic threshold corrector. Cycle crossings relative
- * to the corrected slice level determine the width of each pulse and
- * its value - zero, one or position identifier.
+ * The program processes 8000-Hz samples using separate signal filters
+ * for IRIG-B and IRIG-E, a comb filter, envelope detector and automatic
+ * threshold corrector. Cycle crossings relative to the corrected slice
+ * level determine the width of each pulse and its value - zero, one or
+ * position identifier. The 48- and 96-kHz samples are resampled to 80
+ * kHz by a polyphase filter, where IRIG-A has the eight samples per
+ * carrier cycle and ten cycles per bit of IRIG-B at 8 kHz. From there
+ * IRIG-A goes through the IRIG-B filter, which scales with the sample
+ * rate to a 10-kHz carrier, and the same demodulator.
  *
  * The data encode 20 BCD digits which determine the second, minute,
  * hour and day of the year and sometimes the year and synchronization
@@ -43,17 +63,14 @@
  * which are then encoded as the BCD digits of the timecode.
  *
  * The timecode and reference timestamp are updated once each second
- * with IRIG-B (ten seconds with IRIG-E) and local clock offset samples
- * saved for later processing. At poll intervals of 64 s, the saved
- * samples are processed by a trimmed-mean filter and used to update the
- * system clock.
- *
- * An automatic gain control feature provides protection against
- * overdriven or underdriven input signal amplitudes. It is designed to
- * maintain adequate demodulator signal amplitude while avoiding
- * occasional noise spikes. In order to assure reliable capture, the
- * decompanded input signal amplitude must be greater than 100 units and
- * the codec sample frequency error less than 250 PPM (.025 percent).
+ * with IRIG-B (ten seconds with IRIG-E). Each time they are valid, the
+ * clock time of the timecode and the reference timestamp are written to
+ * the shared memory segment, where the SHM driver of the time daemon
+ * filters them as it does those of any other reference clock.
+ *
+ * In order to assure reliable capture, the input signal amplitude must
+ * be greater than 100 units and the codec sample frequency error less
+ * than 250 PPM (.025 percent).
  *
  * Monitor Data
  *
@@ -62,21 +79,22 @@
  * connections. The driver produces one line for each timecode in the
  * following format:
  *
- * 00 00 98 23 19:26:52 2782 143 0.694 10 0.3 66.5 3094572411.00027
+ * 00 00 98 23 19:26:52 2782 0.694 10 0.3 66.5 3094572411.00027
  *
- * If clockstats is enabled, the most recent line is written to the
- * clockstats file every 64 s. If verbose recording is enabled (fudge
- * flag 4) each line is written as generated.
+ * Each line is written to the standard output as generated. With -b
+ * the program also writes a binary record of each frame, defined in
+ * irigrec.h, which has the control functions and straight binary
+ * seconds as well.
  *
  * The first field containes the error flags in hex, where the hex bits
  * are interpreted as below. This is followed by the year of century,
  * day of year and time of day. Note that the time of day is for the
  * previous minute, not the current time. The status indicator and year
  * are not produced by some IRIG devices and appear as zeros. Following
- * these fields are the carrier amplitude (0-3000), codec gain (0-255),
- * modulation index (0-1), time constant (4-10), carrier phase error
- * +-.5) and carrier frequency error (PPM). The last field is the on-
- * time timestamp in NTP format.
+ * these fields are the carrier amplitude (0-3000), modulation index
+ * (0-1), time constant (4-10), carrier phase error (+-.5) and carrier
+ * frequency error (PPM). The last field is the on-time timestamp in NTP
+ * format.
  *
  * The error flags are defined as follows in hex:
  *
@@ -93,12 +111,14 @@
  *	signal format or noisy IRIG signal. It may also be the result of
  *	an IRIG signature check which indicates a failure of the IRIG
  *	signal synchronization source.
- * x10	Data bit error. The data bit length is out of tolerance. This is
- *	usually the result of an overdriven codec, wrong signal format
- *	or noisy IRIG signal.
+ * x10	Data bit error. The data bit length is out of tolerance, or a
+ *	time field is not BCD or out of range. This is usually the
+ *	result of an overdriven codec, wrong signal format or noisy IRIG
+ *	signal.
  * x20	Seconds numbering discrepancy. The decoder second does not match
- *	the IRIG second. This is usually the result of an overdriven
- *	codec, wrong signal format or noisy IRIG signal.
+ *	the IRIG second, or the straight binary seconds do not match the
+ *	time of day. This is usually the result of an overdriven codec,
+ *	wrong signal format or noisy IRIG signal.
  * x40	Codec error (overrun). The machine is not fast enough to keep up
  *	with the codec.
  * x80	Device status error (Spectracom).
@@ -110,35 +130,37 @@
  * broke the 2.7 audio driver in 2.8, which has a 10-ms sawtooth
  * modulation.
  *
- * Unlike other drivers, which can have multiple instantiations, this
- * one supports only one. It does not seem likely that more than one
- * audio codec would be useful in a single machine. More than one would
- * probably chew up too much CPU time anyway.
+ * One codec can carry more than one IRIG signal, such as those of two
+ * GPS clocks on the left and right channels. In multi-channel mode each
+ * channel of the interleaved input has its own decoder, identified as
+ * irig0, irig1 and so on, and the decoders run in parallel on a pool of
+ * threads. After each buffer a vote compares the time of every new
+ * frame with the last good frames of the other channels. A frame is
+ * used only if a strict majority of all the channels agree with it,
+ * and one that half or more disagree with is flagged with
+ * IRIG_ERR_CHECK. Of those, the selected channel is kept
+ * while its frames carry the vote, and otherwise the one with the least
+ * jitter is selected. Only the selected channel is published.
  *
  * Fudge factors
  *
- * Fudge flag4 causes the dubugging output described above to be
- * recorded in the clockstats file. Fudge flag2 selects the audio input
- * port, where 0 is the mike port (default) and 1 is the line-in port.
- * It does not seem useful to select the compact disc player port. Fudge
- * flag3 enables audio monitoring of the input signal. For this purpose,
- * the monitor gain is set t a default value. Fudgetime2 is used as a
+ * Fudgetime1 is added to the offset to account for the cable and other
+ * delays specific to the installation. Fudgetime2 is used as a
  * frequency vernier for broken codec sample frequency.
- *
- * Alarm codes
- *
- * CEVNT_BADTIME	invalid date or time
- * CEVNT_TIMEOUT	no IRIG data since last poll
  */
 /*
  * Interface definitions
  */
-#define	DEVICE_AUDIO	"/dev/audio" /* audio device name */
 #define	PRECISION	(-17)	/* precision assumed (about 10 us) */
-#define	REFID		"IRIG"	/* reference ID */
+#define	PRECISION_A	(-20)	/* IRIG-A precision (about 1 us) */
 #define	DESCRIPTION	"Generic IRIG Audio Driver" /* WRU */
 #define	AUDIO_BUFSIZ	320	/* audio buffer size (40 ms) */
+#define	BMAX		128	/* max timecode length */
+#define	SHMUNIT		4	/* default NTP shared memory unit */
+#define	MAXCHAN		8	/* max input channels */
+#define	VOTEAGE		60	/* max age of a voting frame (frames) */
 #define SECOND		8000	/* nominal sample rate (Hz) */
+#define ASECOND		(10 * SECOND) /* IRIG-A sample rate (Hz) */
 #define BAUD		80	/* samples per baud interval */
 #define OFFSET		128	/* companded sample offset */
 #define SIZE		256	/* decompanding table size */
@@ -151,21 +173,45 @@
 #define	MINAMP		2000.0f	/* minimum signal amplitude */
 #define DRPOUT		100.0f	/* dropout signal amplitude */
 #define MODMIN		0.5f	/* minimum modulation index */
-#define MAXFREQ		(250e-6f * SECOND) /* freq tolerance (.025%) */
+#define MAXFREQ		250e-6f	/* freq tolerance (.025%) */
+#define SLIPHYS		0.03f	/* VFO slip hysteresis (samples) */
+#define DECIM		10	/* IRIG-E decimation factor */
+#define LPFLEN		60	/* IRIG-E filter length */
+#define FMTLOCK		4	/* seconds to lock the format */
+#define FMTCHK		64	/* seconds between format checks */
+#define FMTERR		3	/* error seconds before a format check */
+#define RS48		9	/* 48-kHz resampler taps per phase */
+#define RS96		14	/* 96-kHz resampler taps per phase */
+#define RSMAX		RS96	/* max resampler taps per phase */
+#define NMARK		(FIELD / SUBFLD + 1) /* position identifiers per frame */
 
 /*
  * The on-time synchronization point is the positive-going zero crossing
- * of the first cycle of the second. The IIR baseband filter phase delay
- * is 1.03 ms for IRIG-B and 3.47 ms for IRIG-E. The fudge value 2.68 ms
- * due to the codec and other causes was determined by calibrating to a
- * PPS signal from a GPS receiver.
+ * of the first cycle of the second. The baseband filter phase delay is
+ * 1.03 ms for IRIG-B, 3.69 ms for IRIG-E and 0.103 ms for IRIG-A, plus
+ * that of the resampler. The fudge value 2.68 ms due to the codec and
+ * other causes was determined by calibrating to a PPS signal from a GPS
+ * receiver. Of that, 0.89 ms is not the codec but the demodulator, which
+ * strikes the timestamp 0.89 of a carrier cycle late. With the ten
+ * times shorter IRIG-A carrier cycle this is only 0.09 ms, so IRIG-A
+ * has 0.80 ms less.
  *
  * The results with a 2.4-GHz P4 running FreeBSD 6.1 are generally
  * within .02 ms short-term with .02 ms jitter. The processor load due
  * to the driver is 0.51 percent.
+ *
+ * On a synthetic IRIG-B signal, amplitude 8000 in noise of 300 rms, the
+ * offsets lie within 3-4 us RMS of a straight line, whether the codec
+ * runs at the nominal rate or up to 150 PPM off it and wherever the
+ * carrier falls against the sample grid. IRIG-E is about ten times
+ * worse. IRIG-A from a 48- or 96-kHz codec lies within 0.5-0.6 us,
+ * the VFO of the resampler output tracking the same way at the
+ * nominal rate as off it. These are the limits of the strike, not of the codec and
+ * system clock of a real installation.
  */
 #define IRIG_B	((1.03 + 2.68) / 1000)	/* IRIG-B system delay (s) */
-#define IRIG_E	((3.47 + 2.68) / 1000)	/* IRIG-E system delay (s) */
+#define IRIG_E	((3.69 + 2.68) / 1000)	/* IRIG-E system delay (s) */
+#define IRIG_A	((0.103 + 2.68 - 0.80) / 1000) /* IRIG-A system delay (s) */
 
 /*
  * Data bit definitions
@@ -174,19 +220,110 @@
 #define BIT1		1	/* one */
 #define BITP		2	/* position identifier */
 
+static	char	hexchar[] = "0123456789abcdef";
+
 /*
- * Error flags
+ * IRIG-E decimating filter. 60-tap FIR lowpass, Kaiser window (beta 5),
+ * 380-Hz cutoff (-6 dB), 0.03 dB passband ripple to 150 Hz, -61 dB from
+ * 670 Hz, which folds back onto the 130-Hz passband after decimation to
+ * 800 Hz, phase delay 3.69 ms. The filter is symmetric, so only the first half
+ * is listed.
  */
-#define IRIG_ERR_AMP	0x01	/* low carrier amplitude */
-#define IRIG_ERR_FREQ	0x02	/* frequency tolerance exceeded */
-#define IRIG_ERR_MOD	0x04	/* low modulation index */
-#define IRIG_ERR_SYNCH	0x08	/* frame synch error */
-#define IRIG_ERR_DECODE	0x10	/* frame decoding error */
-#define IRIG_ERR_CHECK	0x20	/* second numbering discrepancy */
-#define IRIG_ERR_ERROR	0x40	/* codec error (overrun) */
-#define IRIG_ERR_SIGERR	0x80	/* IRIG status error (Spectracom) */
+static const float lpfcoef[LPFLEN / 2] = {
+	2.306527e-04f, 4.772332e-04f, 7.994602e-04f, 1.156685e-03f,
+	1.481061e-03f, 1.681203e-03f, 1.651484e-03f, 1.286768e-03f,
+	5.014190e-04f, -7.495519e-04f, -2.450077e-03f, -4.506690e-03f,
+	-6.739529e-03f, -8.883435e-03f, -1.060084e-02f, -1.150671e-02f,
+	-1.120415e-02f, -9.327539e-03f, -5.588894e-03f, 1.782052e-04f,
+	7.982632e-03f, 1.765302e-02f, 2.883238e-02f, 4.099216e-02f,
+	5.346587e-02f, 6.549957e-02f, 7.631485e-02f, 8.517770e-02f,
+	9.146614e-02f, 9.472891e-02f
+};
 
-static	char	hexchar[] = "0123456789abcdef";
+/*
+ * IRIG-A resampling filters. The 48-kHz samples are interpolated by
+ * five and decimated by three, the 96-kHz samples interpolated by five
+ * and decimated by six, to 80 kHz. The filters are FIR lowpass, Kaiser
+ * window (beta 5.65), flat within 0.01 dB to 14 kHz, 45 taps at 240 kHz
+ * with -63 dB from 34 kHz and 70 taps at 480 kHz with -69 dB from 48
+ * kHz, phase delay 91.7 us and 71.9 us. The taps are listed phase by
+ * phase, oldest sample first, and sum to one in each phase.
+ */
+static const float rs48coef[5 * RS48] = {
+	-1.029334e-02f, 4.383604e-02f, -1.335223e-01f, 4.813194e-01f,
+	7.414535e-01f, -1.659447e-01f, 5.555784e-02f, -1.445703e-02f,
+	1.407857e-03f, -4.352444e-03f, 2.110623e-02f, -6.659511e-02f,
+	2.148982e-01f, 9.311855e-01f, -1.285402e-01f, 4.308898e-02f,
+	-1.217171e-02f, 1.681834e-03f, 0.000000e+00f, 0.000000e+00f,
+	0.000000e+00f, 0.000000e+00f, 1.000683e+00f, 0.000000e+00f,
+	0.000000e+00f, 0.000000e+00f, 0.000000e+00f, 1.681834e-03f,
+	-1.217171e-02f, 4.308898e-02f, -1.285402e-01f, 9.311855e-01f,
+	2.148982e-01f, -6.659511e-02f, 2.110623e-02f, -4.352444e-03f,
+	1.407857e-03f, -1.445703e-02f, 5.555784e-02f, -1.659447e-01f,
+	7.414535e-01f, 4.813194e-01f, -1.335223e-01f, 4.383604e-02f,
+	-1.029334e-02f
+};
+
+static const float rs96coef[5 * RS96] = {
+	-3.821525e-03f, 4.889895e-03f, 2.367038e-02f, -4.301403e-02f,
+	-6.412010e-02f, 2.523376e-01f, 5.591518e-01f, 3.384018e-01f,
+	-2.946001e-02f, -6.272808e-02f, 1.922375e-02f, 1.020651e-02f,
+	-4.283326e-03f, -3.437361e-04f, -2.904734e-03f, 5.890533e-04f,
+	2.383260e-02f, -2.265863e-02f, -8.238697e-02f, 1.669663e-01f,
+	5.338084e-01f, 4.183357e-01f, 2.190850e-02f, -7.835903e-02f,
+	9.847233e-03f, 1.584724e-02f, -3.908379e-03f, -9.745975e-04f,
+	-1.873235e-03f, -2.353255e-03f, 2.079966e-02f, -4.417538e-03f,
+	-8.612948e-02f, 8.849552e-02f, 4.854247e-01f, 4.854247e-01f,
+	8.849552e-02f, -8.612948e-02f, -4.417538e-03f, 2.079966e-02f,
+	-2.353255e-03f, -1.873235e-03f, -9.745975e-04f, -3.908379e-03f,
+	1.584724e-02f, 9.847233e-03f, -7.835903e-02f, 2.190850e-02f,
+	4.183357e-01f, 5.338084e-01f, 1.669663e-01f, -8.238697e-02f,
+	-2.265863e-02f, 2.383260e-02f, 5.890533e-04f, -2.904734e-03f,
+	-3.437361e-04f, -4.283326e-03f, 1.020651e-02f, 1.922375e-02f,
+	-6.272808e-02f, -2.946001e-02f, 3.384018e-01f, 5.591518e-01f,
+	2.523376e-01f, -6.412010e-02f, -4.301403e-02f, 2.367038e-02f,
+	4.889895e-03f, -3.821525e-03f
+};
+
+/*
+ * IRIG formats. All are demodulated at eight samples per carrier cycle
+ * and ten cycles per bit, so they differ only in the sample rate, the
+ * decimation ahead of the demodulator and the framing.
+ */
+struct irigfmt {
+	char	name;		/* format letter */
+	unsigned int rate;	/* VFO sample rate (Hz) */
+	unsigned int decim;	/* VFO samples per baseband sample */
+	int	period;		/* seconds per timestamped frame */
+	int	tenths;		/* ten frames per second */
+	int	precision;	/* best precision claimed (log2 s) */
+	double	fdelay;		/* system delay (s) */
+};
+
+static const struct irigfmt fmt_a = {'A', ASECOND, 1, 1, 1, PRECISION_A, IRIG_A};
+static const struct irigfmt fmt_b = {'B', SECOND, 1, 1, 0, PRECISION, IRIG_B};
+static const struct irigfmt fmt_e = {'E', SECOND, DECIM, 10, 0, PRECISION, IRIG_E};
+
+/*
+ * Input sample rates. At 8 kHz the samples go straight to the VFO and
+ * the format is IRIG-B or IRIG-E; at 48 and 96 kHz they are resampled
+ * to the IRIG-A rate. irig_receive() calls a copy of irig_block() for
+ * each rate with the constants below, so the loops are unrolled and no
+ * branch is left on the rate.
+ */
+struct irigrate {
+	unsigned int rate;	/* input sample rate (Hz) */
+	int	interp;		/* interpolation factor */
+	int	decim;		/* decimation factor */
+	int	taps;		/* taps per phase */
+	const float *coef;	/* resampling filter */
+	double	delay;		/* resampling filter delay (s) */
+	const struct irigfmt *fmt; /* initial format */
+};
+
+static const struct irigrate rate_8 = {SECOND, 1, 1, 0, NULL, 0, &fmt_b};
+static const struct irigrate rate_48 = {48000, 5, 3, RS48, rs48coef, 22 / 240e3, &fmt_a};
+static const struct irigrate rate_96 = {96000, 5, 6, RS96, rs96coef, 34.5 / 480e3, &fmt_a};
 
 /*
  * IRIG unit control structure
@@ -210,17 +347,20 @@ struct irigunit {
 	/*
 	 * Audio codec variables
 	 */
-	float signal;		/* peak signal for AGC */
-	int	port;		/* codec port */
-	int	gain;		/* codec gain */
-	int	mongain;	/* codec monitor gain */
+	const struct irigrate *rs; /* input sample rate */
+	float	signal;		/* peak signal */
 	int	seccnt;		/* second interval counter */
+	float	rshist[2 * RSMAX]; /* resampler history (doubled) */
+	int	rsptr;		/* resampler history pointer */
+	int	rsphase;	/* resampler phase */
+	uint32_t rstick;	/* resampler phase increment (fraction) */
 
 	/*
 	 * RF variables
 	 */
 	float	bpf[9];		/* IRIG-B filter shift register */
-	float	lpf[5];		/* IRIG-E filter shift register */
+	float	lpf[2 * LPFLEN]; /* IRIG-E filter history (doubled) */
+	int	lpfptr;		/* IRIG-E filter history pointer */
 	float	envmin, envmax;	/* envelope min and max */
 	float	slice;		/* envelope slice level */
 	float	intmin, intmax;	/* integrated envelope min and max */
@@ -228,9 +368,8 @@ struct irigunit {
 	float	noise;		/* integrated noise amplitude */
 	float	lastenv[CYCLE];	/* last cycle amplitudes */
 	float	lastint[CYCLE];	/* last integrated cycle amplitudes */
-	float	lastsig;	/* last carrier sample */
+	const struct irigfmt *fmt; /* format */
 	float	fdelay;		/* filter delay */
-	unsigned int decim;		/* sample decimation factor */
 	int	envphase;	/* envelope phase */
 	int	envptr;		/* envelope phase pointer */
 	int	envsw;		/* envelope state */
@@ -238,66 +377,152 @@ struct irigunit {
 	int	tc;		/* time constant */
 	int	tcount;		/* time constant counter */
 	int	badcnt;		/* decimation interval counter */
+	int	probe;		/* both filters running */
+	int	fmtcnt;		/* seconds with the same format */
+	int	fmtchk;		/* seconds to the next format check */
+	int	fmterr;		/* seconds with signal errors */
 
 	/*
 	 * Decoder variables
 	 */
 	int	pulse;		/* cycle counter */
-	int	cycles;		/* carrier cycles */
-	int	dcycles;	/* data cycles */
+	uint32_t cycles;	/* carrier cycles */
+	uint32_t dcycles;	/* data cycles */
 	int	lastbit;	/* last code element */
 	int	second;		/* previous second */
+	int	tenths;		/* previous tenths (IRIG-A) */
 	int	bitcnt;		/* bit count in frame */
 	int	frmcnt;		/* bit count in second */
 	int	xptr;		/* timecode pointer */
 	int	bits;		/* demodulated bits */
+	uint16_t frmbits[SUBFLD]; /* bits of each frame */
+
+	/*
+	 * Precision timing
+	 */
+	double	mark[NMARK];	/* position identifier strikes (s) */
+	int	markbit[NMARK];	/* position identifier bit numbers */
+	int	nmark;		/* position identifiers in frame */
+	double	jitter;		/* strike jitter (s) */
+
+	/*
+	 * Timecode and clock time
+	 */
+	char	a_lastcode[BMAX]; /* last timecode */
+	int	lencode;	/* length of last timecode */
+	int	year;		/* year of century */
+	int	day;		/* day of year */
+	int	hour;		/* hour of day */
+	int	minute;		/* minute of hour */
+	int	sec;		/* second of minute */
+	uint8_t	leap;		/* leap/synchronization code */
+	l_fp	lastrec;	/* last valid reference timestamp */
+	double	offset;		/* last offset */
+
+	/*
+	 * Configuration data
+	 */
+	float	fudgetime1;	/* fudge time1 (s) */
+	float	fudgetime2;	/* fudge time2 (PPM) */
+	char	ident[8];	/* name in the monitor lines */
+	int	chan;		/* input channel */
+	FILE	*recfp;		/* frame records (NULL if none) */
+
+	/*
+	 * Last frame, for the vote in multi-channel mode
+	 */
+	int	nframe;		/* frames decoded */
+	struct irigrec rec;	/* decoded frame */
+	l_fp	frmstamp;	/* reference timestamp */
+	uint32_t goodclock;	/* clock time of the last good frame */
+	l_fp	goodstamp;	/* its reference timestamp (0 if none) */
+
+	/* NTP-SHM segment (NULL if not published) */
+	struct shmTime *shmTime;
+};
+
+/*
+ * Multi-channel unit. Each channel of the interleaved input has its own
+ * decoder; the vote picks the one to publish.
+ */
+struct irigmulti {
+	struct irigunit *unit[MAXCHAN]; /* decoders */
+	int16_t	*seg[MAXCHAN];	/* deinterleaved segment */
+	int	nframe[MAXCHAN]; /* frames seen by the vote */
+	int	carried[MAXCHAN]; /* last frame carried the vote */
+	unsigned int nchan;	/* channels */
+	unsigned int rate;	/* sample rate (Hz) */
+	unsigned int nseg;	/* samples in segment */
+	l_fp	segtime;	/* segment receive time */
+	int	best;		/* selected channel (-1 if none) */
+	struct pool *pool;	/* decoder threads */
+	FILE	*recfp;		/* frame records (NULL if none) */
+
+	/* NTP-SHM segment (NULL if not published) */
+	struct shmTime *shmTime;
 };
 
 /*
  * Function prototypes
  */
 static void irig_rf(struct irigunit *up, float sample);
+static void irig_format(struct irigunit *up);
 static void irig_base(struct irigunit *up, float sample);
-static void irig_baud(struct irigunit *up, int bits); /* decoded bits */
+static void irig_baud(struct irigunit *up);
+static float irig_phase(struct irigunit *up);
 static void irig_decode(struct irigunit *up, int bit); /* data bit (0, 1 or 2) */
+static int irig_bcd(struct irigunit *up, int i, int n);
+static void irig_record(struct irigunit *up, int syncdig);
+static void irig_reference(struct irigunit *up);
+static uint32_t irig_clocktime(struct irigunit *up, uint32_t rec_ui);
+static void irig_publish(struct irigunit *up);
+static void irig_write(struct irigunit *up, struct shmTime *shm);
+static void irig_split(int16_t **out, const int16_t *in, unsigned int n, unsigned int nchan);
+static void irig_job(void *arg, unsigned int chan);
+static void irig_vote(struct irigmulti *mp, unsigned int chan);
 
 /*
- * irig_start - open the devices and initialize data for processing
+ * irig_start - initialize data for processing
+ *
+ * The input sample rate is 8000 Hz for IRIG-B/E or 48000 or 96000 Hz
+ * for IRIG-A. Returns NULL if the rate is none of these.
  */
-struct irigunit *irig_start(int unit) /* instance number (used for PCM) */
+struct irigunit *irig_start(unsigned int rate)
 {
 	struct irigunit *up;
+	const struct irigrate *rs;
 
-	/*
-	 * Local variables
-	 */
-	int	fd;		/* file descriptor */
-
-	/*
-	 * Open audio device
-	 */
-	fd = audio_init(DEVICE_AUDIO, AUDIO_BUFSIZ, unit);
-	if (fd < 0)
-		return NULL;
+	if (rate == rate_8.rate)
+		rs = &rate_8;
+	else if (rate == rate_48.rate)
+		rs = &rate_48;
+	else if (rate == rate_96.rate)
+		rs = &rate_96;
+	else
+		return (NULL);
 
 	/*
 	 * Allocate and initialize unit structure
 	 */
-	up = emalloc(sizeof(*up));
+	if (!(up = malloc(sizeof(*up))))
+		return (NULL);
 	memset(up, 0, sizeof(*up));
 
 	/*
-	 * Initialize miscellaneous variables
+	 * Initialize miscellaneous variables. Only at 8 kHz is there a
+	 * choice of format to probe.
 	 */
-	up->precision = PRECISION;
-	up->clockdesc = DESCRIPTION;
-	memcpy((char *)&up->refid, REFID, 4);
+	up->rs = rs;
+	up->fmt = rs->fmt;
+	up->fdelay = rs->fmt->fdelay + rs->delay;
+	up->probe = rs->interp == 1;
 	up->tc = MINTC;
-	up->decim = 1;
-	up->gain = 127;
+	up->xptr = 2 * SUBFLD;
+	strcpy(up->ident, "irig");
 
-	DTOLFP(1. / SECOND, &up->tick);
-    return up;
+	DTOLFP(1. / rate, &up->tick);
+	up->rstick = up->tick.l_uf / rs->interp;
+	return (up);
 }
 
 
@@ -306,77 +531,339 @@ struct irigunit *irig_start(int unit) /* instance number (used for PCM) */
  */
 void irig_shutdown(struct irigunit *up)
 {
-	efree(up);
+	free(up);
 }
 
 
 /*
- * irig_receive - receive data from the audio device
+ * irig_vfo - variable frequency oscillator
  *
- * This routine reads input samples and adjusts the logical clock to
- * track the irig clock by dropping or duplicating codec samples.
+ * The codec oscillator runs at the nominal rate of 8000 samples per
+ * second, or 125 us per sample. A frequency change of one unit results
+ * in either duplicating or deleting one sample per second, which
+ * results in a frequency change of 125 PPM. IRIG-A runs at the 80-kHz
+ * rate of the resampler output, where one unit is 12.5 PPM.
+ *
+ * The phase is the fraction of a sample by which the carrier lags the
+ * sample grid. A sample is deleted or duplicated only when it passes
+ * half a sample by SLIPHYS, so a carrier that sits near the half-sample
+ * point does not slip back and forth with the noise.
  */
-void irig_receive(struct irigunit *up, int16_t *recv_buffer, unsigned int recv_length)
+static inline void irig_vfo(struct irigunit *up, float sample)
+{
+	up->phase += up->freq / up->fmt->rate;
+	up->phase += up->fudgetime2 / 1e6f;
+	if (up->phase >= .5f + SLIPHYS) {
+		up->phase -= 1.0f;
+	} else if (up->phase < -.5f - SLIPHYS) {
+		up->phase += 1.0f;
+		irig_rf(up, sample);
+		irig_rf(up, sample);
+	} else {
+		irig_rf(up, sample);
+	}
+}
+
+/*
+ * irig_block - process a buffer at one input sample rate
+ *
+ * This routine is always inlined with a constant rate descriptor, so
+ * there is a copy for each rate with the resampler loops unrolled. At
+ * 8 kHz each sample goes to the VFO. At the higher rates each sample is
+ * pushed into the resampler history and the 80-kHz samples that fall
+ * from it to the next one are computed, each timestamped at its place
+ * between the two. The history is stored twice, so the last taps
+ * samples are always contiguous.
+ */
+SIMD_INLINE void irig_block(struct irigunit *up, int16_t *recv_buffer, unsigned int recv_length, l_fp t, const struct irigrate *rs)
 {
-	/*
-	 * Local variables
-	 */
 	float	sample;		/* codec sample */
-	unsigned int bufcnt; /* buffer counter */
-	l_fp	ltemp;		/* l_fp temp */
+	float	*hist;		/* resampler window */
+	const float *coef;	/* resampler phase */
+	float	dtemp;
+	unsigned int bufcnt;	/* buffer counter */
+	int	i;
 
-	/*
-	 * Main loop - read until there ain't no more. Note codec
-	 * samples are bit-inverted.
-	 */
-	DTOLFP((double)recv_length / SECOND, &ltemp);
-	L_SUB(&rbufp->recv_time, &ltemp);
-	up->timestamp = rbufp->recv_time;
 	for (bufcnt = 0; bufcnt < recv_length; bufcnt++) {
 		sample = (float)recv_buffer[bufcnt];
+		dtemp = fabsf(sample);
+		if (dtemp > up->signal)
+			up->signal = dtemp;
+		up->signal += (dtemp - up->signal) / 1000;
+		if (rs->interp == 1) {
+			up->timestamp = t;
+			irig_vfo(up, sample);
 
-		/*
-		 * Variable frequency oscillator. The codec oscillator
-		 * runs at the nominal rate of 8000 samples per second,
-		 * or 125 us per sample. A frequency change of one unit
-		 * results in either duplicating or deleting one sample
-		 * per second, which results in a frequency change of
-		 * 125 PPM.
-		 */
-		up->phase += (up->freq + clock_codec) / SECOND;
-		up->phase += up->fudgetime2 / 1e6f;
-		if (up->phase >= .5f) {
-			up->phase -= 1.0f;
-		} else if (up->phase < -.5f) {
-			up->phase += 1.0f;
-			irig_rf(peer, sample);
-			irig_rf(peer, sample);
+			/*
+			 * Once each second, determine the IRIG format.
+			 */
+			up->seccnt = (up->seccnt + 1) % SECOND;
+			if (up->seccnt == 0)
+				irig_format(up);
 		} else {
-			irig_rf(peer, sample);
+			up->rsptr = (up->rsptr + 1) % rs->taps;
+			up->rshist[up->rsptr] = up->rshist[up->rsptr +
+			    rs->taps] = sample;
+			hist = &up->rshist[up->rsptr + 1];
+			for (; up->rsphase < rs->interp; up->rsphase +=
+			    rs->decim) {
+				coef = &rs->coef[up->rsphase * rs->taps];
+				sample = 0;
+				for (i = 0; i < rs->taps; i++)
+					sample += coef[i] * hist[i];
+				up->timestamp = t;
+				L_ADDUF(&up->timestamp, up->rsphase *
+				    up->rstick);
+				irig_vfo(up, sample);
+			}
+			up->rsphase -= rs->interp;
 		}
-		L_ADD(&up->timestamp, &up->tick);
-		sample = fabsf(sample);
-		if (sample > up->signal)
-			up->signal = sample;
-		up->signal += (sample - up->signal) / 1000;
+		L_ADD(&t, &up->tick);
+	}
+}
 
-		/*
-		 * Once each second, determine the IRIG format and gain.
-		 */
-		up->seccnt = (up->seccnt + 1) % SECOND;
-		if (up->seccnt == 0) {
-			if (up->irig_b > up->irig_e) {
-				up->decim = 1;
-				up->fdelay = IRIG_B;
-			} else {
-				up->decim = 10;
-				up->fdelay = IRIG_E;
+/*
+ * irig_receive - receive data from the audio device
+ *
+ * This routine reads input samples and adjusts the logical clock to
+ * track the irig clock by dropping or duplicating codec samples. The
+ * receive time is that of the end of the buffer.
+ */
+void irig_receive(struct irigunit *up, int16_t *recv_buffer, unsigned int recv_length, l_fp recv_time)
+{
+	l_fp	ltemp;		/* l_fp temp */
+
+	DTOLFP((double)recv_length / up->rs->rate, &ltemp);
+	L_SUB(&recv_time, &ltemp);
+	if (up->rs == &rate_48)
+		irig_block(up, recv_buffer, recv_length, recv_time, &rate_48);
+	else if (up->rs == &rate_96)
+		irig_block(up, recv_buffer, recv_length, recv_time, &rate_96);
+	else
+		irig_block(up, recv_buffer, recv_length, recv_time, &rate_8);
+}
+
+
+/*
+ * irig_multi_shutdown - shut down a multi-channel unit
+ */
+void irig_multi_shutdown(struct irigmulti *mp)
+{
+	unsigned int i;
+
+	if (mp->pool != NULL)
+		pool_destroy(mp->pool);
+	for (i = 0; i < mp->nchan; i++) {
+		irig_shutdown(mp->unit[i]);
+		free(mp->seg[i]);
+	}
+	free(mp);
+}
+
+/*
+ * irig_multi - start a multi-channel unit
+ *
+ * This routine starts a decoder for each of nchan channels at the
+ * sample rate rate, identified as irig0, irig1 and so on, and a pool of
+ * nthreads threads to run them. From then on the unit is fed with
+ * irig_receive_multi(). Returns NULL if it cannot.
+ */
+struct irigmulti *irig_multi(unsigned int nchan, unsigned int rate, unsigned int nthreads)
+{
+	struct irigmulti *mp;
+	unsigned int i;
+
+	if (nchan < 1 || nchan > MAXCHAN)
+		return (NULL);
+	if (!(mp = calloc(1, sizeof(*mp))))
+		return (NULL);
+	mp->nchan = nchan;
+	mp->rate = rate;
+	mp->best = -1;
+	for (i = 0; i < nchan; i++) {
+		if (!(mp->unit[i] = irig_start(rate)) ||
+		    !(mp->seg[i] = malloc(rate * sizeof(int16_t))))
+			goto fail;
+		snprintf(mp->unit[i]->ident, sizeof(mp->unit[i]->ident),
+		    "irig%u", i);
+		mp->unit[i]->chan = i;
+	}
+	if (!(mp->pool = pool_create(nthreads)))
+		goto fail;
+	return (mp);
+
+fail:
+	irig_multi_shutdown(mp);
+	return (NULL);
+}
+
+/*
+ * irig_receive_multi - receive data from all channels at once
+ *
+ * This routine is the multi-channel version of irig_receive(). The
+ * buffer holds recv_length frames of nchan interleaved samples and the
+ * receive time is that of the end of the buffer. A second at a time,
+ * the samples are split into channels, decoded on the pool threads and
+ * any new frames put to the vote in channel order. The frame records
+ * are written after the vote, so they carry its flags.
+ */
+void irig_receive_multi(struct irigmulti *mp, int16_t *recv_buffer, unsigned int recv_length, l_fp recv_time)
+{
+	unsigned int bufcnt;	/* buffer counter */
+	unsigned int i;
+	l_fp	ltemp;
+
+	for (bufcnt = 0; bufcnt < recv_length; bufcnt += mp->nseg) {
+		mp->nseg = recv_length - bufcnt;
+		if (mp->nseg > mp->rate)
+			mp->nseg = mp->rate;
+		irig_split(mp->seg, &recv_buffer[bufcnt * mp->nchan],
+		    mp->nseg, mp->nchan);
+		DTOLFP((double)(recv_length - bufcnt - mp->nseg) / mp->rate,
+		    &ltemp);
+		mp->segtime = recv_time;
+		L_SUB(&mp->segtime, &ltemp);
+		pool_run(mp->pool, irig_job, mp, mp->nchan);
+		for (i = 0; i < mp->nchan; i++) {
+			if (mp->unit[i]->nframe != mp->nframe[i]) {
+				mp->nframe[i] = mp->unit[i]->nframe;
+				irig_vote(mp, i);
+				if (mp->recfp != NULL)
+					fwrite(&mp->unit[i]->rec,
+					    sizeof(struct irigrec), 1,
+					    mp->recfp);
 			}
-			up->irig_b = up->irig_e = 0;
 		}
 	}
 }
 
+/*
+ * irig_split - deinterleave a segment
+ *
+ * Stereo, the usual case, goes through the vector unit sixteen samples
+ * at a time. Other layouts are split a frame at a time.
+ */
+static void irig_split(int16_t **out, const int16_t *in, unsigned int n, unsigned int nchan)
+{
+	v8hi	even, odd;
+	unsigned int i, j;
+
+	i = 0;
+	if (nchan == 2) {
+		for (; i + VLEN <= n; i += VLEN) {
+			v8hi_unzip(v8hi_load(&in[2 * i]),
+			    v8hi_load(&in[2 * i + VLEN]), &even, &odd);
+			v8hi_store(&out[0][i], even);
+			v8hi_store(&out[1][i], odd);
+		}
+	}
+	for (; i < n; i++) {
+		for (j = 0; j < nchan; j++)
+			out[j][i] = in[i * nchan + j];
+	}
+}
+
+/*
+ * irig_job - decode the segment of one channel
+ *
+ * This routine runs on a pool thread and touches only its own unit.
+ */
+static void irig_job(void *arg, unsigned int chan)
+{
+	struct irigmulti *mp = (struct irigmulti *)arg;
+
+	irig_receive(mp->unit[chan], mp->seg[chan], mp->nseg, mp->segtime);
+}
+
+/*
+ * irig_vote - vote on a new frame
+ *
+ * Each decoder keeps the clock time and reference timestamp of its
+ * last good frame, so a bad frame does not take a channel out of the
+ * vote, and the frames of the same buffer are all there when it is
+ * taken. A good frame is compared with the last good frame of each other
+ * channel, if that is no more than VOTEAGE frames away: the decoded
+ * times must differ by the difference of the reference timestamps,
+ * rounded to the second. A frame carries the vote if, counting itself,
+ * a strict majority of all the channels agree with it. It is flagged
+ * IRIG_ERR_CHECK if so many disagree that it could not carry the vote
+ * whatever the channels without a good frame said. A frame that is
+ * neither, such as one that meets only a wrong channel while the others
+ * are still acquiring, is not used but not flagged either. With two
+ * channels that disagree both are flagged, as neither can be trusted,
+ * and a channel alone has no one to confirm it, so nothing is published
+ * until both agree.
+ *
+ * The selected channel stays selected while its frames carry the vote.
+ * Otherwise the channel with the new frame is selected if its frame
+ * carries the vote and no other channel whose recent frame did has less
+ * jitter. Only frames of the selected channel are published.
+ */
+static void irig_vote(struct irigmulti *mp, unsigned int chan)
+{
+	struct irigunit *up = mp->unit[chan];
+	struct irigunit *vp;
+	double	span;		/* frame interval (s) */
+	double	dtemp;
+	l_fp	ltemp;
+	int	ok[MAXCHAN] = {0}; /* eligible channels */
+	int	agree = 0, disagree = 0;
+	unsigned int i;
+
+	span = up->fmt->period;
+	mp->carried[chan] = 0;
+	if (up->rec.ok) {
+		for (i = 0; i < mp->nchan; i++) {
+			vp = mp->unit[i];
+			if (i == chan)
+				continue;
+			ltemp = up->frmstamp;
+			L_SUB(&ltemp, &vp->goodstamp);
+			LFPTOD(&ltemp, dtemp);
+			if (fabs(dtemp) > VOTEAGE * span)
+				continue;
+			if ((int32_t)(up->rec.clock - vp->goodclock) ==
+			    (int32_t)floor(dtemp + .5))
+				agree++;
+			else
+				disagree++;
+		}
+		if (2 * disagree >= (int)mp->nchan) {
+			up->rec.errflg |= IRIG_ERR_CHECK;
+			printf("%s: disagrees with %d of %d channels\n",
+			    up->ident, disagree, agree + disagree);
+		} else if (2 * (agree + 1) > (int)mp->nchan) {
+			mp->carried[chan] = 1;
+		}
+	}
+
+	/*
+	 * Select a channel. A channel is eligible if its last frame
+	 * carried the vote and is recent.
+	 */
+	for (i = 0; i < mp->nchan; i++) {
+		vp = mp->unit[i];
+		ltemp = up->frmstamp;
+		L_SUB(&ltemp, &vp->goodstamp);
+		LFPTOD(&ltemp, dtemp);
+		ok[i] = mp->carried[i] && dtemp < 1.5 * span;
+	}
+	if (mp->best >= 0 && !ok[mp->best])
+		mp->best = -1;
+	if (mp->best < 0 && ok[chan]) {
+		for (i = 0; i < mp->nchan; i++) {
+			if (i != chan && ok[i] &&
+			    mp->unit[i]->jitter < up->jitter)
+				break;
+		}
+		if (i == mp->nchan) {
+			mp->best = chan;
+			printf("irig: selected %s\n", up->ident);
+		}
+	}
+	if (mp->best == (int)chan && mp->shmTime != NULL)
+		irig_write(up, mp->shmTime);
+}
 
 /*
  * irig_rf - RF processing
@@ -385,8 +872,12 @@ void irig_receive(struct irigunit *up, int16_t *recv_buffer, unsigned int recv_l
  * and a lowpass filter for IRIG-E. In case of IRIG-E, the samples are
  * decimated by a factor of ten. Note that the codec filters function as
  * roofing filters to attenuate both the high and low ends of the
- * passband. IIR filter coefficients were determined using Matlab Signal
- * Processing Toolkit.
+ * passband. The IRIG-B IIR filter coefficients were determined using
+ * Matlab Signal Processing Toolkit.
+ *
+ * Once the format is locked only the filter for that format runs. The
+ * IRIG-E filter is evaluated only for the samples that survive the
+ * decimation, so it costs three multiplies per input sample.
  */
 static void irig_rf(struct irigunit *up, float sample)
 {
@@ -394,63 +885,103 @@ static void irig_rf(struct irigunit *up, float sample)
 	 * Local variables
 	 */
 	float	irig_b, irig_e;	/* irig filter outputs */
+	float	*lpf;		/* IRIG-E filter window */
+	int	i;
 
 	/*
 	 * IRIG-B filter. Matlab 4th-order IIR elliptic, 800-1200 Hz
 	 * bandpass, 0.3 dB passband ripple, -50 dB stopband ripple,
 	 * phase delay 1.03 ms.
 	 */
-	irig_b  = (up->bpf[8] = up->bpf[7]) * 0.6505491f;
-	irig_b += (up->bpf[7] = up->bpf[6]) * -3.87518f;
-	irig_b += (up->bpf[6] = up->bpf[5]) * 11.5118f;
-	irig_b += (up->bpf[5] = up->bpf[4]) * -21.41264f;
-	irig_b += (up->bpf[4] = up->bpf[3]) * 27.12837f;
-	irig_b += (up->bpf[3] = up->bpf[2]) * -23.84486f;
-	irig_b += (up->bpf[2] = up->bpf[1]) * 14.27663f;
-	irig_b += (up->bpf[1] = up->bpf[0]) * -5.352734f;
-	up->bpf[0] = sample - irig_b;
-	irig_b = up->bpf[0] * 4.952157e-003f
-	       + up->bpf[1] * -2.055878e-002f
-	       + up->bpf[2] * 4.401413e-002f
-	       + up->bpf[3] * -6.558851e-002f
-	       + up->bpf[4] * 7.462108e-002f
-	       + up->bpf[5] * -6.558851e-002f
-	       + up->bpf[6] * 4.401413e-002f
-	       + up->bpf[7] * -2.055878e-002f
-	       + up->bpf[8] * 4.952157e-003f;
-	up->irig_b += irig_b * irig_b;
+	if (up->probe || up->fmt->decim == 1) {
+		irig_b  = (up->bpf[8] = up->bpf[7]) * 0.6505491f;
+		irig_b += (up->bpf[7] = up->bpf[6]) * -3.87518f;
+		irig_b += (up->bpf[6] = up->bpf[5]) * 11.5118f;
+		irig_b += (up->bpf[5] = up->bpf[4]) * -21.41264f;
+		irig_b += (up->bpf[4] = up->bpf[3]) * 27.12837f;
+		irig_b += (up->bpf[3] = up->bpf[2]) * -23.84486f;
+		irig_b += (up->bpf[2] = up->bpf[1]) * 14.27663f;
+		irig_b += (up->bpf[1] = up->bpf[0]) * -5.352734f;
+		up->bpf[0] = sample - irig_b;
+		irig_b = up->bpf[0] * 4.952157e-003f
+		       + up->bpf[1] * -2.055878e-002f
+		       + up->bpf[2] * 4.401413e-002f
+		       + up->bpf[3] * -6.558851e-002f
+		       + up->bpf[4] * 7.462108e-002f
+		       + up->bpf[5] * -6.558851e-002f
+		       + up->bpf[6] * 4.401413e-002f
+		       + up->bpf[7] * -2.055878e-002f
+		       + up->bpf[8] * 4.952157e-003f;
+		up->irig_b += irig_b * irig_b;
+		if (up->fmt->decim == 1)
+			irig_base(up, irig_b);
+	}
 
 	/*
-	 * IRIG-E filter. Matlab 4th-order IIR elliptic, 130-Hz lowpass,
-	 * 0.3 dB passband ripple, -50 dB stopband ripple, phase delay
-	 * 3.47 ms.
+	 * IRIG-E filter and decimation by a factor of ten. The history
+	 * is stored twice, so the last LPFLEN samples are always
+	 * contiguous. Its energy is summed at the decimated rate.
 	 */
-	irig_e = (up->lpf[4] = up->lpf[3]) * 0.8694604f;
-	irig_e += (up->lpf[3] = up->lpf[2]) * -3.589893f;
-	irig_e += (up->lpf[2] = up->lpf[1]) * 5.570154f;
-	irig_e += (up->lpf[1] = up->lpf[0]) * -3.849667f;
-	up->lpf[0] = sample - irig_e;
-	irig_e = up->lpf[0] * 3.215696e-003f
-	       + up->lpf[1] * -1.174951e-002f
-	       + up->lpf[2] * 1.712074e-002f
-	       + up->lpf[3] * -1.174951e-002f
-	       + up->lpf[4] * 3.215696e-003f;
-	up->irig_e += irig_e * irig_e;
+	if (up->probe || up->fmt->decim == DECIM) {
+		up->lpfptr = (up->lpfptr + 1) % LPFLEN;
+		up->lpf[up->lpfptr] = up->lpf[up->lpfptr + LPFLEN] = sample;
+		up->badcnt = (up->badcnt + 1) % DECIM;
+		if (up->badcnt != 0)
+			return;
 
-	/*
-	 * Decimate by a factor of either 1 (IRIG-B) or 10 (IRIG-E).
-	 */
-    if (up->fdelay == IRIG_E) {
-	    up->badcnt = (up->badcnt + 1) % 10;
-	    if (up->badcnt == 0) {
+		lpf = &up->lpf[up->lpfptr + 1];
+		irig_e = 0;
+		for (i = 0; i < LPFLEN / 2; i++)
+			irig_e += lpfcoef[i] * (lpf[i] + lpf[LPFLEN - 1 - i]);
+		up->irig_e += irig_e * irig_e;
+		if (up->fmt->decim == DECIM)
 			irig_base(up, irig_e);
-        }
-    } else {
-	    up->badcnt = (up->badcnt + 1);
-	    if (up->badcnt == 0) {
-			irig_base(up, irig_b);
-        }
-    }
+	}
+}
+
+/*
+ * irig_format - determine the IRIG format
+ *
+ * Until the format is locked both filters run and each second the one
+ * with the greater energy selects the format. After FMTLOCK seconds
+ * with the same format only its filter runs. Both run again for one
+ * second every FMTCHK seconds, or after FMTERR seconds in a row with
+ * signal errors, in case the source has changed format.
+ */
+static void irig_format(struct irigunit *up)
+{
+	const struct irigfmt *fmt;
+
+	if (up->errflg & (IRIG_ERR_AMP | IRIG_ERR_MOD | IRIG_ERR_SYNCH))
+		up->fmterr++;
+	else
+		up->fmterr = 0;
+	if (up->probe) {
+		fmt = up->irig_b > up->irig_e * DECIM ? &fmt_b : &fmt_e;
+		if (fmt != up->fmt) {
+			up->fmt = fmt;
+			up->fdelay = fmt->fdelay;
+			up->fmtcnt = 0;
+		}
+		if (++up->fmtcnt >= FMTLOCK) {
+			up->probe = 0;
+			up->fmtchk = FMTCHK;
+			up->fmterr = 0;
+		}
+	} else if (--up->fmtchk <= 0 || up->fmterr >= FMTERR) {
+
+		/*
+		 * Start the idle filter from rest. If the check confirms
+		 * the format, the lock resumes after the one second.
+		 */
+		if (up->fmt == &fmt_b)
+			memset(up->lpf, 0, sizeof(up->lpf));
+		else
+			memset(up->bpf, 0, sizeof(up->bpf));
+		up->probe = 1;
+		up->fmtcnt = FMTLOCK - 1;
+	}
+	up->irig_b = up->irig_e = 0;
 }
 
 /*
@@ -486,13 +1017,25 @@ static void irig_base(struct irigunit *up, float sample)
 	up->lastint[carphase] = lope;
 
 	/*
-	 * Phase detector. Find the negative-going zero crossing
-	 * relative to sample 4 in the 8-sample sycle. A phase change of
-	 * 360 degrees produces an output change of one unit.
+	 * Phase detector. At the end of each 8-sample cycle find the
+	 * negative-going zero crossing relative to sample 4. A phase
+	 * change of 360 degrees produces an output change of one unit.
+	 * Counting only the sample the crossing falls on left a dead
+	 * zone a sample wide, in which the VFO drifted until it slipped;
+	 * with the codec running slow the carrier then sat a sample and
+	 * more early, the demodulator sampled well off the peaks and each
+	 * slip jumped the amplitude enough to garble the next bit or two.
+	 *
+	 * The error is taken against the VFO phase, which already holds
+	 * the fraction of a sample the grid cannot follow. Against sample
+	 * 4 alone, a carrier a fraction of a sample off at the nominal
+	 * rate left an error the loop could never null, so the VFO slipped
+	 * back and forth several times a second and the filter transient
+	 * of each slip spoiled the strikes after it.
 	 */
-	if (up->lastsig > 0 && lope <= 0)
-		up->zxing += (float)(carphase - 4) / CYCLE;
-	up->lastsig = lope;
+	if (carphase == CYCLE - 1)
+		up->zxing += (irig_phase(up) - up->phase / up->fmt->decim) /
+		    CYCLE;
 
 	/*
 	 * End of the baud. Update signal/noise estimates and PLL
@@ -523,16 +1066,16 @@ static void irig_base(struct irigunit *up, float sample)
 		 * frequency is clamped so that the PLL capture range
 		 * cannot be exceeded.
 		 */
-		dtemp = up->zxing * up->decim / BAUD;
+		dtemp = up->zxing * up->fmt->decim / BAUD;
 		up->yxing = dtemp;
 		up->zxing = 0.;
 		up->phase += dtemp / up->tc;
 		up->freq += dtemp / (4.0f * up->tc * up->tc);
-		if (up->freq > MAXFREQ) {
-			up->freq = MAXFREQ;
+		if (up->freq > MAXFREQ * up->fmt->rate) {
+			up->freq = MAXFREQ * up->fmt->rate;
 			up->errflg |= IRIG_ERR_FREQ;
-		} else if (up->freq < -MAXFREQ) {
-			up->freq = -MAXFREQ;
+		} else if (up->freq < -MAXFREQ * up->fmt->rate) {
+			up->freq = -MAXFREQ * up->fmt->rate;
 			up->errflg |= IRIG_ERR_FREQ;
 		}
 	}
@@ -585,7 +1128,7 @@ static void irig_base(struct irigunit *up, float sample)
 	switch(up->pulse) {
 
 	case 0:
-		irig_baud(peer, up->dcycles);
+		irig_baud(up);
 		if (env < up->envmin)
 			up->envmin = env;
 		up->slice = (up->envmax + up->envmin) / 2;
@@ -610,7 +1153,7 @@ static void irig_base(struct irigunit *up, float sample)
 /*
  * irig_baud - update the PLL and decode the pulse-width signal
  */
-static void irig_baud(struct irigunit *up, int bits) /* decoded bits */
+static void irig_baud(struct irigunit *up)
 {
 	float	dtemp;
 	l_fp	ltemp;
@@ -623,7 +1166,7 @@ static void irig_baud(struct irigunit *up, int bits) /* decoded bits */
 	 * persist for lots of samples.
 	 */
 	up->exing = -up->yxing;
-	if (fabsf(up->envxing - up->envphase) <= 1) {
+	if (abs(up->envxing - up->envphase) <= 1) {
 		up->tcount++;
 		if (up->tcount > 20 * up->tc) {
 			up->tc++;
@@ -642,10 +1185,12 @@ static void irig_baud(struct irigunit *up, int bits) /* decoded bits */
 	/*
 	 * Strike the baud timestamp as the positive zero crossing of
 	 * the first bit, accounting for the codec delay and filter
-	 * delay.
+	 * delay. The PLL holds the carrier zero crossing only to the
+	 * nearest sample; the remainder comes from the carrier phase.
 	 */
 	up->prvstamp = up->chrstamp;
-	dtemp = up->decim * (up->exing / SECOND) + up->fdelay;
+	dtemp = up->fmt->decim * ((up->exing - irig_phase(up)) /
+	    up->fmt->rate) + up->fdelay;
 	DTOLFP(dtemp, &ltemp);
 	up->chrstamp = up->timestamp;
 	L_SUB(&up->chrstamp, &ltemp);
@@ -682,6 +1227,35 @@ static void irig_baud(struct irigunit *up, int bits) /* decoded bits */
 }
 
 
+/*
+ * irig_phase - carrier phase in the last cycle
+ *
+ * This routine fits a sinusoid at the carrier frequency to the eight
+ * samples of the last cycle and returns how far the negative-going
+ * zero crossing lies past sample 4, in samples. It is both the PLL
+ * phase detector and the fine correction to the timestamp. The fit
+ * is exact for a clean carrier and uses every sample, where
+ * interpolating between the two samples either side of the crossing
+ * would have the error of a chord and the noise of two. The raw
+ * samples are used rather than the integrated ones, which take half a
+ * second to catch up each time the VFO slips a sample.
+ */
+static float irig_phase(struct irigunit *up)
+{
+	static const float cosine[CYCLE] = {
+		1, M_SQRT1_2, 0, -M_SQRT1_2, -1, -M_SQRT1_2, 0, M_SQRT1_2
+	};
+	float	c, s;		/* cosine and sine components */
+	int	i;
+
+	c = s = 0;
+	for (i = 0; i < CYCLE; i++) {
+		c += up->lastenv[i] * cosine[i];
+		s += up->lastenv[i] * cosine[(i + 6) % CYCLE];
+	}
+	return (atan2f(-c, s) * CYCLE / (2 * M_PI));
+}
+
 /*
  * irig_decode - decode the data
  *
@@ -696,8 +1270,8 @@ static void irig_decode(struct irigunit *up, int bit) /* data bit (0, 1 or 2) */
 	 * Local variables
 	 */
 	int	syncdig;	/* sync digit (Spectracom) */
-	char sbs[6 + 1];	/* binary seconds since 0h */
 	int	temp;
+	l_fp	ltemp;
 
 	/*
 	 * Assemble frame bits.
@@ -717,14 +1291,31 @@ static void irig_decode(struct irigunit *up, int bit) /* data bit (0, 1 or 2) */
 			up->errflg |= IRIG_ERR_SYNCH;
 		up->frmcnt = 1;
 		up->refstamp = up->prvstamp;
+		up->nmark = 0;
 	}
 	up->lastbit = bit;
+
+	/*
+	 * Save the beginning of each position identifier relative to
+	 * the reference timestamp for irig_reference().
+	 */
+	if (bit == BITP && (up->frmcnt % SUBFLD == 0 || up->frmcnt == 1) &&
+	    up->nmark < NMARK) {
+		ltemp = up->prvstamp;
+		L_SUB(&ltemp, &up->refstamp);
+		LFPTOD(&ltemp, up->mark[up->nmark]);
+		up->markbit[up->nmark++] = (up->frmcnt + FIELD - 1) % FIELD;
+	}
 	if (up->frmcnt % SUBFLD == 0) {
 		/*
-		 * End of frame. Encode two hexadecimal digits in
-		 * little-endian timecode field. Note frame 1 is shifted
-		 * right one bit to account for the marker PI.
+		 * End of frame. Keep the bits for the control functions
+		 * and straight binary seconds, then encode two
+		 * hexadecimal digits in little-endian timecode field.
+		 * Note frame 1 is shifted right one bit to account for
+		 * the marker PI.
 		 */
+		up->frmbits[(up->frmcnt + FIELD - SUBFLD) % FIELD / SUBFLD] =
+		    up->bits;
 		temp = up->bits;
 		if (up->frmcnt == 10)
 			temp >>= 1;
@@ -733,7 +1324,21 @@ static void irig_decode(struct irigunit *up, int bit) /* data bit (0, 1 or 2) */
 			up->timecode[--up->xptr] = hexchar[(temp >> 5) &
 			    0xf];
 		}
-		if (up->frmcnt == 0) {
+		if (up->frmcnt == 0)
+			up->xptr = 2 * SUBFLD;
+
+		/*
+		 * IRIG-A sends ten frames a second, numbered by the
+		 * tenths digit. Each must follow the one before, but
+		 * only the first of the second goes on to be decoded.
+		 */
+		if (up->frmcnt == 0 && up->fmt->tenths) {
+			temp = up->timecode[10] - '0';
+			if (temp != (up->tenths + 1) % 10)
+				up->errflg |= IRIG_ERR_CHECK;
+			up->tenths = temp;
+		}
+		if (up->frmcnt == 0 && up->tenths == 0) {
 			/*
 			 * End of second. Decode the timecode and wind
 			 * the clock. Not all IRIG generators have the
@@ -745,20 +1350,21 @@ static void irig_decode(struct irigunit *up, int bit) /* data bit (0, 1 or 2) */
 			 * control. If so, all BCD digits are set to
 			 * zero if the source is bad. In this case the
 			 * refclock_process() will reject the timecode
-			 * as invalid.
+			 * as invalid. A time digit over nine fails the
+			 * range check in irig_check(); the year and sync
+			 * digit share the control functions, which need
+			 * not be BCD, so there it only means no year.
 			 */
-			up->xptr = 2 * SUBFLD;
-            memcpy(sbs, up->timecode, 6); sbs[6] = '\0';
-            pp->year = (((up->timecode[6] - 0x30) * 10) + (up->timecode[7] - 0x30));
-            syncdig = (up->timecode[8] - 0x30);
-            pp->day = (((up->timecode[11] - 0x30) * 100)
-                    +  ((up->timecode[12] - 0x30) * 10)
-                    +   (up->timecode[13] - 0x30));
-            pp->hour   = (((up->timecode[14] - 0x30) * 10) + (up->timecode[15] - 0x30));
-            pp->minute = (((up->timecode[16] - 0x30) * 10) + (up->timecode[17] - 0x30));
-            pp->second = (((up->timecode[18] - 0x30) * 10) + (up->timecode[19] - 0x30));
+			up->year = irig_bcd(up, 6, 2);
+			if (up->year < 0)
+				up->year = 0;
+			syncdig = up->frmbits[5] >> 5 & 0xf;
+			up->day = irig_bcd(up, 11, 3);
+			up->hour = irig_bcd(up, 14, 2);
+			up->minute = irig_bcd(up, 16, 2);
+			up->sec = irig_bcd(up, 18, 2);
 			up->leap = LEAP_NOWARNING;
-			up->second = (up->second + up->decim) % 60;
+			up->second = (up->second + up->fmt->period) % 60;
 
 			/*
 			 * Raise an alarm if the day field is zero,
@@ -772,41 +1378,406 @@ static void irig_decode(struct irigunit *up, int bit) /* data bit (0, 1 or 2) */
 			 * decoded second, which happens with a garbled
 			 * IRIG signal. We are very particular.
 			 */
-			if (pp->day == 0 || (pp->year != 0 && syncdig == 0))
+			if (up->day == 0 || (up->year != 0 && syncdig == 0))
 				up->errflg |= IRIG_ERR_SIGERR;
-			if (pp->second != up->second)
+			if (up->sec != up->second)
 				up->errflg |= IRIG_ERR_CHECK;
-			up->second = pp->second;
+			up->second = up->sec;
 
 			/*
 			 * Wind the clock only if there are no errors
 			 * and the time constant has reached the
 			 * maximum.
 			 */
-			if (up->errflg == 0 && up->tc == MAXTC) {
-				pp->lastref = pp->lastrec;
-				pp->lastrec = up->refstamp;
-				if (!refclock_process(pp))
-					refclock_report(peer, CEVNT_BADTIME);
+			irig_reference(up);
+			up->frmstamp = up->refstamp;
+			irig_record(up, syncdig);
+			up->errflg |= irig_check(&up->rec);
+			up->rec.errflg = up->errflg;
+			up->rec.ok = up->errflg == 0 && up->tc == MAXTC;
+			if (up->rec.ok) {
+				up->lastrec = up->refstamp;
+				up->goodclock = up->rec.clock;
+				up->goodstamp = up->frmstamp;
+				irig_publish(up);
 			}
-			snprintf(pp->a_lastcode, sizeof(pp->a_lastcode),
-			    "%02x %02d %03d %02d:%02d:%02d %4.0f %3d %6.3f %2d %6.2f %6.1f %s",
-			    up->errflg, pp->year, pp->day,
-			    pp->hour, pp->minute, pp->second,
-			    up->maxsignal, up->gain, up->modndx,
-			    up->tc, up->exing * 1e6 / SECOND, up->freq *
-			    1e6 / SECOND, ulfptoa(&pp->lastrec, 6));
-			pp->lencode = strlen(pp->a_lastcode);
+			up->lencode = snprintf(up->a_lastcode,
+			    sizeof(up->a_lastcode),
+			    "%02x %02d %03d %02d:%02d:%02d %4.0f %6.3f %2d %6.2f %6.1f %u.%06u",
+			    up->errflg, up->year, up->day,
+			    up->hour, up->minute, up->sec,
+			    up->maxsignal, up->modndx,
+			    up->tc, up->exing * 1e6 / up->fmt->rate, up->freq *
+			    1e6 / up->fmt->rate, up->lastrec.l_ui,
+			    (unsigned int)(up->lastrec.l_uf / FRAC * 1e6));
+			printf("%s %s\n", up->ident, up->a_lastcode);
+			if (up->recfp != NULL)
+				fwrite(&up->rec, sizeof(up->rec), 1,
+				    up->recfp);
 			up->errflg = 0;
-			if (pp->sloppyclockflag & CLK_FLAG4) {
-				record_clock_stats(&peer->srcadr, pp->a_lastcode);
-#ifdef DEBUG
-				if (debug)
-					printf("irig %s\n", pp->a_lastcode);
-#endif /* DEBUG */
-			}
+			up->nframe++;
 		}
 	}
 	up->frmcnt = (up->frmcnt + 1) % FIELD;
 }
 
+
+/*
+ * irig_bcd - decode the n BCD digits of the timecode from digit i
+ *
+ * Returns -1 if any is not a decimal digit.
+ */
+static int irig_bcd(struct irigunit *up, int i, int n)
+{
+	int	val = 0;
+
+	for (; n > 0; i++, n--) {
+		if (up->timecode[i] < '0' || up->timecode[i] > '9')
+			return (-1);
+		val = val * 10 + up->timecode[i] - '0';
+	}
+	return (val);
+}
+
+/*
+ * irig_record - fill in the record of the frame
+ *
+ * The control functions and straight binary seconds are taken from the
+ * frame bits rather than the timecode, which leaves out the bit in the
+ * middle of each frame. The error flags and whether the frame is good
+ * are left to the caller.
+ */
+static void irig_record(struct irigunit *up, int syncdig)
+{
+	struct irigrec *rp = &up->rec;
+	int	i;
+
+	memset(rp, 0, sizeof(*rp));
+	rp->stamp_ui = up->refstamp.l_ui;
+	rp->stamp_uf = up->refstamp.l_uf;
+	rp->clock = irig_clocktime(up, up->refstamp.l_ui);
+	for (i = 7; i >= 5; i--)
+		rp->cf = rp->cf << 9 | (up->frmbits[i] & 0x1ff);
+	rp->sbs = (up->frmbits[8] & 0x1ff) | (up->frmbits[9] & 0xff) << 9;
+	rp->jitter = up->jitter;
+	rp->day = up->day;
+	rp->year = up->year;
+	rp->hour = up->hour;
+	rp->minute = up->minute;
+	rp->sec = up->sec;
+	rp->syncdig = syncdig;
+	rp->format = up->fmt->name;
+	rp->chan = up->chan;
+}
+
+/*
+ * irig_reference - refine the reference timestamp
+ *
+ * Every position identifier in the frame begins on a known bit
+ * boundary, so each is an estimate of the reference time. This routine
+ * fits a straight line to their strikes against bit number, which
+ * takes out any difference between the sample clock and the IRIG
+ * clock over the frame, moves the reference timestamp to the intercept
+ * and sets the jitter to the RMS residual of the fit. With fewer than
+ * three strikes there is no fit, so the reference timestamp is left
+ * alone and the jitter set to one sample of the decoder.
+ */
+static void irig_reference(struct irigunit *up)
+{
+	double	x[NMARK];	/* bit times (s) */
+	double	sx, sy, sxx, sxy; /* sums */
+	double	a, b, dtemp;	/* intercept and slope */
+	l_fp	ltemp;
+	int	i, n = up->nmark;
+
+	up->nmark = 0;
+	if (n < 3) {
+		up->jitter = (double)up->fmt->decim / up->fmt->rate;
+		return;
+	}
+
+	sx = sy = sxx = sxy = 0;
+	for (i = 0; i < n; i++) {
+		x[i] = up->markbit[i] * up->fmt->decim * (double)BAUD /
+		    up->fmt->rate;
+		sx += x[i]; sy += up->mark[i];
+		sxx += x[i] * x[i]; sxy += x[i] * up->mark[i];
+	}
+	b = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+	a = (sy - b * sx) / n;
+	dtemp = 0;
+	for (i = 0; i < n; i++)
+		dtemp += (up->mark[i] - a - b * x[i]) *
+		    (up->mark[i] - a - b * x[i]);
+	up->jitter = sqrt(dtemp / (n - 2));
+	DTOLFP(a, &ltemp);
+	L_ADD(&up->refstamp, &ltemp);
+}
+
+/*
+ * irig_clocktime - compute the clock time of the timecode
+ *
+ * Not all IRIG generators send the year, so the year is the one of the
+ * receive time rec_ui, unless the timecode then falls more than half a
+ * year from the receive time, as it does across New Year, in which case
+ * the previous or next year is used instead. Returns the clock time in
+ * NTP seconds.
+ */
+static uint32_t irig_clocktime(struct irigunit *up, uint32_t rec_ui)
+{
+	struct calendar jt;
+	int32_t	tmp;
+	uint32_t yst;
+
+	tmp = ((24 * (up->day - 1) + up->hour) * 60 + up->minute) * 60 +
+	    up->sec;
+
+	/*
+	 * The NTP time stamps (l_fp) count seconds unsigned mod 2**32,
+	 * so the differences are taken the same way.
+	 */
+	caljulian(rec_ui / 86400, &jt);	/* yearday is zero-based */
+	yst = (rec_ui / 86400 - jt.yearday) * 86400;
+	if ((int32_t)(yst + tmp - rec_ui) > 183 * 86400) {
+		caljulian(yst / 86400 - 1, &jt);
+		yst -= (jt.yearday + 1) * 86400;
+	} else if ((int32_t)(rec_ui - yst - tmp) > 183 * 86400) {
+		caljulian(yst / 86400 + 366, &jt);
+		yst += (366 - jt.yearday) * 86400;
+	}
+	return (yst + tmp);
+}
+
+/*
+ * irig_publish - publish the second to the NTP shared memory segment
+ *
+ * The clock time is the second of the timecode and the receive time the
+ * reference timestamp less fudge time1. The offset is kept for the
+ * monitor. In multi-channel mode the units have no segment and the
+ * vote publishes the selected one with irig_write().
+ */
+static void irig_publish(struct irigunit *up)
+{
+	l_fp	lasttim, rec, lftemp;
+
+	lasttim.l_ui = up->rec.clock;
+	lasttim.l_uf = 0;
+	rec = up->lastrec;
+	DTOLFP(up->fudgetime1, &lftemp);
+	L_SUB(&rec, &lftemp);
+	lftemp = lasttim;
+	L_SUB(&lftemp, &rec);
+	LFPTOD(&lftemp, up->offset);
+	printf("%s: sample offset %.6f jitter %.6f\n", up->ident,
+	    up->offset, up->jitter);
+	if (up->shmTime != NULL)
+		irig_write(up, up->shmTime);
+}
+
+/*
+ * irig_write - write the last good second to a shared memory segment
+ *
+ * The precision follows the jitter, but is never claimed better than
+ * that of the format.
+ */
+static void irig_write(struct irigunit *up, struct shmTime *shm)
+{
+	struct timedelta_t td;
+	l_fp	rec, lftemp;
+	int	precision;
+
+	rec = up->lastrec;
+	DTOLFP(up->fudgetime1, &lftemp);
+	L_SUB(&rec, &lftemp);
+	td.real.tv_sec = up->rec.clock - JAN_1970;
+	td.real.tv_nsec = 0;
+	td.clock.tv_sec = rec.l_ui - JAN_1970;
+	td.clock.tv_nsec = (long)((double)rec.l_uf / FRAC * 1e9);
+	for (precision = up->fmt->precision; precision < 0 &&
+	    up->jitter > ldexp(1., precision); precision++)
+		;
+	ntp_write(shm, &td, precision);
+}
+
+
+#ifndef NO_MAIN
+/*
+ * Main program. The samples are read from a file or FIFO in blocks of
+ * AUDIO_BUFSIZ, each timestamped with the system time as its read
+ * returns, and the offsets are written to NTP shared memory unit
+ * SHMUNIT or the one given with -u. The sample rate is 8000 Hz for
+ * IRIG-B/E, or 48000 or 96000 Hz for IRIG-A given with -s. With -r the
+ * input is a recording instead: each block is timestamped from its
+ * position in the file, counting from the Unix time given with -t, so a
+ * run is repeatable, and nothing is written to shared memory. With -c
+ * the input has that many interleaved channels, each with its own
+ * decoder thread, and the vote picks the one to publish. With -b a
+ * binary record of each frame (irigrec.h) is written to the file given.
+ * SIGTERM stops the program at the end of the current block.
+ */
+static volatile sig_atomic_t terminate; /* SIGTERM received */
+
+static void sigterm(int sig)
+{
+	(void)sig;
+	terminate = 1;
+}
+
+/*
+ * irig_read - read a whole block. Returns 0 if successful, -1 at end of
+ * input, on error or on SIGTERM.
+ */
+static int irig_read(int fd, int16_t *buf, size_t len)
+{
+	size_t	done = 0;
+	ssize_t	n;
+
+	while (done < len) {
+		n = read(fd, (char *)buf + done, len - done);
+		if (n <= 0 || terminate)
+			return (-1);
+		done += n;
+	}
+	return (0);
+}
+
+int main(int argc, char **argv)
+{
+	const char *usage_str = "usage: irig [-b recfile] [-c channels] [-f fudge] [-n blocksize] [-s rate] [-u unit] file\n       irig -r [-b recfile] [-c channels] [-f fudge] [-n blocksize] [-s rate] [-t start] file\n";
+	struct irigunit *up = NULL;
+	struct irigmulti *mp = NULL;
+	struct shmTime *shm = NULL;
+	struct sigaction sa;
+	FILE	*recfp = NULL;
+	int16_t	*buf;
+	unsigned int blksiz = AUDIO_BUFSIZ;
+	unsigned int unit = SHMUNIT;
+	unsigned int nchan = 1, i;
+	unsigned int rate = SECOND;
+	unsigned long nsamp = 0;
+	double	fudge = 0;
+	long	start = -1;
+	int	replay = 0;
+	int	in_fd, c;
+	l_fp	t0, t;
+
+	while ((c = getopt(argc, argv, "b:c:f:n:rs:t:u:")) != -1) {
+		switch (c) {
+		case 'b':
+			if (!(recfp = fopen(optarg, "w"))) {
+				perror(optarg);
+				return (1);
+			}
+			break;
+		case 'c':
+			nchan = atoi(optarg);
+			break;
+		case 'f':
+			fudge = atof(optarg) / 1000;
+			break;
+		case 'n':
+			blksiz = atoi(optarg);
+			break;
+		case 'r':
+			replay = 1;
+			break;
+		case 's':
+			rate = atoi(optarg);
+			break;
+		case 't':
+			start = atol(optarg);
+			break;
+		case 'u':
+			unit = atoi(optarg);
+			break;
+		default:
+			fputs(usage_str, stderr);
+			return (1);
+		}
+	}
+	if (optind != argc - 1) {
+		fputs(usage_str, stderr);
+		return (1);
+	}
+	if (rate != SECOND && rate != 48000 && rate != 96000) {
+		fprintf(stderr, "irig: bad sample rate %u\n", rate);
+		return (1);
+	}
+	if (blksiz < 1 || blksiz > rate) {
+		fprintf(stderr, "irig: bad block size %u\n", blksiz);
+		return (1);
+	}
+	if (nchan < 1 || nchan > MAXCHAN) {
+		fprintf(stderr, "irig: bad channel count %u\n", nchan);
+		return (1);
+	}
+	if ((in_fd = open(argv[optind], O_RDONLY)) < 0) {
+		perror(argv[optind]);
+		return (1);
+	}
+	if (!(buf = (int16_t *)malloc(blksiz * nchan * sizeof(int16_t))))
+		return (1);
+	if (!replay && !(shm = shm_get(unit, 1))) {
+		fprintf(stderr, "irig: cannot attach NTP shared memory unit %u\n",
+		    unit);
+		return (1);
+	}
+	if (nchan > 1) {
+		if (!(mp = irig_multi(nchan, rate, nchan))) {
+			fprintf(stderr, "irig: cannot start %u channels\n",
+			    nchan);
+			return (1);
+		}
+		for (i = 0; i < nchan; i++)
+			mp->unit[i]->fudgetime1 = fudge;
+		mp->shmTime = shm;
+		mp->recfp = recfp;
+	} else {
+		if (!(up = irig_start(rate)))
+			return (1);
+		up->fudgetime1 = fudge;
+		up->shmTime = shm;
+		up->recfp = recfp;
+	}
+
+	/*
+	 * Unless told otherwise, a recording starts at the current time.
+	 */
+	get_systime(&t0);
+	if (start >= 0)
+		t0.l_ui = start + JAN_1970;
+	t0.l_uf = 0;
+
+	/*
+	 * SIGTERM interrupts the read, so the loop can exit.
+	 */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sigterm;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGTERM, &sa, NULL);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	while (!terminate && irig_read(in_fd, buf, blksiz * nchan *
+	    sizeof(int16_t)) == 0) {
+		nsamp += blksiz;
+		if (replay) {
+			DTOLFP((double)nsamp / rate, &t);
+			L_ADD(&t, &t0);
+		} else {
+			get_systime(&t);
+		}
+		if (mp != NULL)
+			irig_receive_multi(mp, buf, blksiz, t);
+		else
+			irig_receive(up, buf, blksiz, t);
+	}
+	if (mp != NULL)
+		irig_multi_shutdown(mp);
+	else
+		irig_shutdown(up);
+	if (recfp != NULL)
+		fclose(recfp);
+	free(buf);
+	close(in_fd);
+	return (0);
+}
+#endif /* NO_MAIN */
@@ -0,0 +1,80 @@
+/*
+ * irigrec.h - IRIG decoder frame records
+ *
+ * With -b the decoder writes a fixed-size binary record for each
+ * timestamped frame: the decoded time, the control functions, the
+ * straight binary seconds, the error flags and the reference
+ * timestamp. A consumer reads these instead of parsing the monitor
+ * lines, and can check a batch of them with irig_check().
+ *
+ * The records are in host byte order and layout, so they are for
+ * programs on the same kind of machine.
+ */
+#ifndef IRIGREC_H
+#define IRIGREC_H
+
+#include <stdint.h>
+
+/*
+ * Error flags
+ */
+#define IRIG_ERR_AMP	0x01	/* low carrier amplitude */
+#define IRIG_ERR_FREQ	0x02	/* frequency tolerance exceeded */
+#define IRIG_ERR_MOD	0x04	/* low modulation index */
+#define IRIG_ERR_SYNCH	0x08	/* frame synch error */
+#define IRIG_ERR_DECODE	0x10	/* frame decoding error */
+#define IRIG_ERR_CHECK	0x20	/* second numbering discrepancy */
+#define IRIG_ERR_ERROR	0x40	/* codec error (overrun) */
+#define IRIG_ERR_SIGERR	0x80	/* IRIG status error (Spectracom) */
+
+/*
+ * The control functions are the 27 bits in positions 50-58, 60-68 and
+ * 70-78 of the frame, the first in bit 0. Their use depends on the
+ * generator; IEEE 1344 puts the year there, for instance, and
+ * Spectracom the year and a sync digit. The straight binary seconds of
+ * the day are the 17 bits in positions 80-88 and 90-97, least
+ * significant first, and are zero if the generator does not send them.
+ * In multi-channel mode the vote may add IRIG_ERR_CHECK to a frame that
+ * was good enough to publish; such a frame is not published.
+ */
+struct irigrec {
+	uint32_t stamp_ui;	/* reference timestamp (NTP s) */
+	uint32_t stamp_uf;	/* reference timestamp (fraction) */
+	uint32_t clock;		/* clock time of the timecode (NTP s) */
+	uint32_t cf;		/* control functions */
+	uint32_t sbs;		/* straight binary seconds */
+	float	jitter;		/* strike jitter (s) */
+	uint16_t errflg;	/* error flags */
+	uint16_t day;		/* day of year */
+	uint8_t	year;		/* year of century */
+	uint8_t	hour;		/* hour */
+	uint8_t	minute;		/* minute */
+	uint8_t	sec;		/* second */
+	uint8_t	syncdig;	/* sync digit (Spectracom) */
+	char	format;		/* format letter */
+	uint8_t	chan;		/* input channel */
+	uint8_t	ok;		/* good enough to publish */
+};
+
+/*
+ * irig_check - check the decoded time of a record
+ *
+ * Returns IRIG_ERR_DECODE if a field is out of range and
+ * IRIG_ERR_CHECK if the straight binary seconds are sent but do not
+ * agree with the time of day. A zero day is left to the decoder, which
+ * takes it as the signature of a source that has lost synchronization.
+ */
+static inline int irig_check(const struct irigrec *rp)
+{
+	int	flags = 0;
+
+	if (rp->year > 99 || rp->day > 366 || rp->hour > 23 ||
+	    rp->minute > 59 || rp->sec > 60)
+		flags |= IRIG_ERR_DECODE;
+	if (rp->sbs != 0 && rp->sbs != ((uint32_t)rp->hour * 60 +
+	    rp->minute) * 60 + rp->sec)
+		flags |= IRIG_ERR_CHECK;
+	return (flags);
+}
+
+#endif /* IRIGREC_H */
@@ -0,0 +1,133 @@
+/*
+ * pool.c - fork/join thread pool for the DSP routines
+ *
+ * The workers sleep on a condition variable until pool_run() posts a
+ * batch. Jobs are handed out from a shared counter, so the batch is
+ * balanced even when the jobs differ in length, and the last thread to
+ * finish a job wakes the caller. Batches are expected to be large, of
+ * the order of a second of audio, so the locking cost is negligible.
+ */
+#include <stdlib.h>
+#include <pthread.h>
+#include "pool.h"
+
+struct pool {
+	pthread_mutex_t lock;
+	pthread_cond_t	work;		/* batch posted or shutdown */
+	pthread_cond_t	done;		/* batch finished */
+	pthread_t	*thread;	/* worker threads */
+	unsigned int	nthreads;	/* number of worker threads */
+	unsigned long	batch;		/* batch serial number */
+	pool_func	func;		/* job function */
+	void		*arg;		/* job argument */
+	unsigned int	njobs;		/* jobs in batch */
+	unsigned int	next;		/* next job to hand out */
+	unsigned int	busy;		/* jobs not yet finished */
+	int		quit;		/* shutdown flag */
+};
+
+/*
+ * pool_work - take jobs from the current batch until there are none
+ * left. Called and returns with the lock held.
+ */
+static void pool_work(struct pool *pool)
+{
+	unsigned int job;
+
+	while (pool->next < pool->njobs) {
+		job = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+		pool->func(pool->arg, job);
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done);
+	}
+}
+
+static void *pool_thread(void *arg)
+{
+	struct pool *pool = arg;
+	unsigned long batch = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (!pool->quit && pool->batch == batch)
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->quit)
+			break;
+		batch = pool->batch;
+		pool_work(pool);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return (NULL);
+}
+
+/*
+ * pool_create - start a pool of nthreads threads, counting the caller
+ */
+struct pool *pool_create(unsigned int nthreads)
+{
+	struct pool *pool;
+	unsigned int i;
+
+	if (!(pool = (struct pool *)calloc(1, sizeof(struct pool))))
+		return (NULL);
+	if (nthreads > 1 && !(pool->thread = (pthread_t *)calloc(nthreads - 1,
+	    sizeof(pthread_t)))) {
+		free(pool);
+		return (NULL);
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for (i = 0; i + 1 < nthreads; i++) {
+		if (pthread_create(&pool->thread[i], NULL, pool_thread, pool))
+			break;
+		pool->nthreads++;
+	}
+	return (pool);
+}
+
+/*
+ * pool_run - run jobs 0 through njobs-1 and wait for them to finish
+ */
+void pool_run(struct pool *pool, pool_func func, void *arg, unsigned int njobs)
+{
+	if (njobs == 0)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->func = func;
+	pool->arg = arg;
+	pool->njobs = njobs;
+	pool->next = 0;
+	pool->busy = njobs;
+	pool->batch++;
+	if (pool->nthreads > 0)
+		pthread_cond_broadcast(&pool->work);
+	pool_work(pool);
+	while (pool->busy > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * pool_destroy - stop the workers and free the pool
+ */
+void pool_destroy(struct pool *pool)
+{
+	unsigned int i;
+
+	if (pool == NULL)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->nthreads; i++)
+		pthread_join(pool->thread[i], NULL);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work);
+	pthread_cond_destroy(&pool->done);
+	free(pool->thread);
+	free(pool);
+}
@@ -0,0 +1,20 @@
+/*
+ * pool.h - fork/join thread pool for the DSP routines
+ *
+ * A pool runs a batch of independent jobs, numbered 0 through n-1, on
+ * a fixed set of worker threads and returns when all of them are done.
+ * The calling thread takes jobs as well, so a pool with one thread runs
+ * everything inline.
+ */
+#ifndef POOL_H
+#define POOL_H
+
+struct pool;
+
+typedef void (*pool_func)(void *arg, unsigned int job);
+
+struct pool *pool_create(unsigned int nthreads);
+void pool_run(struct pool *pool, pool_func func, void *arg, unsigned int njobs);
+void pool_destroy(struct pool *pool);
+
+#endif /* POOL_H */
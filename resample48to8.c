@@ -53,9 +53,9 @@ const float fdmdv_os_filter_small[] = {
 
 void codec2_48_to_8(float *out8k, float *in48k, unsigned int n)
 {
-    unsigned int i, j;
+    int i, j;
 
-    for(i=0; i<n; i++) {
+    for(i=0; i<(int)n; i++) {
       out8k[i] = 0.0;
       for(j=0; j<24; j++) {
         out8k[i] += fdmdv_os_filter[j]*(in48k[6*i - j] + in48k[6*i + 47 - j]);
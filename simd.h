@@ -0,0 +1,114 @@
+/*
+ * simd.h - vector types and helpers for the DSP block routines
+ *
+ * The block routines are written with the GCC/Clang vector extensions,
+ * so the same source compiles to SSE2 or AVX2 on x86 and to NEON on
+ * ARM. On x86 the kernels are cloned for AVX2 and the baseline
+ * instruction set and the dynamic loader picks the clone that fits the
+ * processor at run time. Elsewhere the kernels are compiled once for
+ * the target architecture.
+ */
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * The helpers below are always inlined, so each clone of a kernel gets
+ * its own copy compiled for the same instruction set and no vector is
+ * ever passed across a call. The warning about the AVX calling
+ * convention therefore does not apply.
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+# pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+#define VLEN		8	/* floats per vector */
+
+typedef float	v8sf __attribute__((vector_size(32)));	/* 8 floats */
+typedef int32_t	v8si __attribute__((vector_size(32)));	/* 8 ints */
+typedef int16_t	v8hi __attribute__((vector_size(16)));	/* 8 shorts */
+
+#define SIMD_INLINE	static inline __attribute__((always_inline))
+
+#ifndef __has_attribute
+# define __has_attribute(x) 0
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__linux__) && \
+    __has_attribute(target_clones)
+# define SIMD_CLONES	__attribute__((target_clones("avx2", "default")))
+#else
+# define SIMD_CLONES
+#endif
+
+/*
+ * Unaligned loads and stores. The memcpy() compiles to a single vector
+ * move.
+ */
+SIMD_INLINE v8sf v8sf_load(const float *p)
+{
+	v8sf v;
+
+	memcpy(&v, p, sizeof(v));
+	return (v);
+}
+
+SIMD_INLINE void v8sf_store(float *p, v8sf v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+SIMD_INLINE v8hi v8hi_load(const int16_t *p)
+{
+	v8hi v;
+
+	memcpy(&v, p, sizeof(v));
+	return (v);
+}
+
+SIMD_INLINE void v8hi_store(int16_t *p, v8hi v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+SIMD_INLINE v8sf v8sf_set1(float x)
+{
+	v8sf v = {x, x, x, x, x, x, x, x};
+
+	return (v);
+}
+
+/*
+ * Lane select. Comparisons return lanes of all ones or all zeros, so
+ * the select is done bitwise: a where the mask is set, b elsewhere.
+ */
+SIMD_INLINE v8sf v8sf_select(v8si mask, v8sf a, v8sf b)
+{
+	return ((v8sf)(((v8si)a & mask) | ((v8si)b & ~mask)));
+}
+
+/*
+ * Even and odd lanes of the sixteen shorts in a and b, which splits a
+ * block of interleaved stereo samples into its two channels.
+ */
+SIMD_INLINE void v8hi_unzip(v8hi a, v8hi b, v8hi *even, v8hi *odd)
+{
+#ifdef __clang__
+	*even = __builtin_shufflevector(a, b, 0, 2, 4, 6, 8, 10, 12, 14);
+	*odd = __builtin_shufflevector(a, b, 1, 3, 5, 7, 9, 11, 13, 15);
+#else
+	*even = __builtin_shuffle(a, b, (v8hi){0, 2, 4, 6, 8, 10, 12, 14});
+	*odd = __builtin_shuffle(a, b, (v8hi){1, 3, 5, 7, 9, 11, 13, 15});
+#endif
+}
+
+/*
+ * Horizontal sum of the lanes of an integer vector.
+ */
+SIMD_INLINE int v8si_hsum(v8si v)
+{
+	return (v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7]);
+}
+
+#endif /* SIMD_H */
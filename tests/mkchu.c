@@ -0,0 +1,170 @@
+/*
+ * mkchu - synthesize a CHU capture for the replay tests
+ *
+ * usage: mkchu [-c paths] [-d step] [-m minutes] [-n noise] file
+ *
+ * Writes a WAV file, 16-bit PCM at 8 kHz, with one channel per path.
+ * The capture starts at 14:00:00 on day 123 and holds the format A and
+ * B bursts of each minute at amplitude 3000 in Gaussian noise of the
+ * given rms (default 300). Path n is delayed by 1 ms plus n times the
+ * step (s, default 0.0005), so the tests can move the other paths
+ * against the first. In multipath captures each path in turn fades into
+ * heavy noise for three seconds of nine. The noise generators are
+ * seeded, so a capture is the same every time it is made.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <getopt.h>
+
+#define SECOND		8000	/* sample rate (Hz) */
+#define AMP		3000	/* burst amplitude */
+#define FADE		2000	/* noise rms in a fade */
+#define DELAY		0.001	/* delay of path 0 (s) */
+#define NCHAN		3	/* max paths */
+#define DAY		123	/* day of year */
+#define HOUR		14	/* hour of the first minute */
+
+static uint32_t seed[NCHAN] = {7, 11, 13};	/* noise generators */
+static double phase[NCHAN];			/* FSK phase */
+
+static int urand(int s, int m)
+{
+	seed[s] = seed[s] * 1664525 + 1013904223;
+	return ((seed[s] >> 8) % m);
+}
+
+static double gauss(int s)
+{
+	double	u, v;
+
+	u = (urand(s, 1 << 20) + 0.5) / (1 << 20);
+	v = (urand(s, 1 << 20) + 0.5) / (1 << 20);
+	return (sqrt(-2 * log(u)) * cos(2 * M_PI * v));
+}
+
+/*
+ * chu_sig - one second of path s. Second 31 holds the format B burst
+ * and seconds 32-39 the format A bursts, each ten characters at 300 bps
+ * centered on the half second. A one is 2225 Hz, a zero 2025 Hz.
+ */
+static void chu_sig(int16_t *buf, int sec, int min, double nrms, int s,
+    double delay)
+{
+	int	bytes[10], i;
+	double	t0 = 0.5 - 10 * 11 / 300.0 + delay; /* burst start */
+	double	t, v;
+
+	if (sec >= 32 && sec <= 39) {
+		int	d[10] = {6, DAY / 100, DAY / 10 % 10, DAY % 10, HOUR /
+			    10, HOUR % 10, min / 10, min % 10, 3, sec % 10};
+
+		for (i = 0; i < 5; i++)
+			bytes[i] = bytes[i + 5] = d[2 * i] | d[2 * i + 1] << 4;
+	} else if (sec == 31) {
+		int	d[10] = {0, 1, 2, 0, 2, 6, 3, 7, 0, 0};
+
+		for (i = 0; i < 5; i++) {
+			bytes[i] = d[2 * i] | d[2 * i + 1] << 4;
+			bytes[i + 5] = ~bytes[i] & 0xff;
+		}
+	}
+	for (i = 0; i < SECOND; i++) {
+		t = (double)i / SECOND;
+		v = nrms * gauss(s);
+		if (sec >= 31 && sec <= 39 && t >= t0 && t < t0 + 110 /
+		    300.0) {
+			int	bit = (int)((t - t0) * 300), c = bit / 11;
+			int	b = bit % 11, x;
+
+			x = b == 0 ? 0 : b >= 9 ? 1 : (bytes[c] >> (b - 1)) & 1;
+			phase[s] += 2 * M_PI * (x ? 2225 : 2025) / SECOND;
+			if (phase[s] > 2 * M_PI)
+				phase[s] -= 2 * M_PI;
+			v += AMP * sin(phase[s]);
+		}
+		if (v > 32767)
+			v = 32767;
+		if (v < -32768)
+			v = -32768;
+		buf[i] = (int16_t)v;
+	}
+}
+
+static void le(FILE *fp, uint32_t v, int n)
+{
+	while (n-- > 0) {
+		fputc(v & 0xff, fp);
+		v >>= 8;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static int16_t buf[NCHAN][SECOND];
+	FILE	*fp;
+	double	noise = 300, step = 0.0005, nrms;
+	uint32_t data;
+	int	nchan = 1, minutes = 3;
+	int	c, n, i;
+
+	while ((c = getopt(argc, argv, "c:d:m:n:")) != -1) {
+		switch (c) {
+		case 'c':
+			nchan = atoi(optarg);
+			break;
+		case 'd':
+			step = atof(optarg);
+			break;
+		case 'm':
+			minutes = atoi(optarg);
+			break;
+		case 'n':
+			noise = atof(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || nchan < 1 || nchan > NCHAN || minutes <
+	    1 || minutes > 59) {
+usage:
+		fputs("usage: mkchu [-c paths] [-d step] [-m minutes] [-n noise] file\n",
+		    stderr);
+		return (1);
+	}
+	if (!(fp = fopen(argv[optind], "wb"))) {
+		perror(argv[optind]);
+		return (1);
+	}
+	data = (uint32_t)minutes * 60 * SECOND * 2 * nchan;
+	fwrite("RIFF", 1, 4, fp);
+	le(fp, 36 + data, 4);
+	fwrite("WAVEfmt ", 1, 8, fp);
+	le(fp, 16, 4);
+	le(fp, 1, 2);
+	le(fp, nchan, 2);
+	le(fp, SECOND, 4);
+	le(fp, SECOND * 2 * nchan, 4);
+	le(fp, 2 * nchan, 2);
+	le(fp, 16, 2);
+	fwrite("data", 1, 4, fp);
+	le(fp, data, 4);
+	for (n = 0; n < minutes * 60; n++) {
+		for (c = 0; c < nchan; c++) {
+			nrms = nchan > 1 && n % 60 / 3 % 3 == c ? FADE : noise;
+			chu_sig(buf[c], n % 60, n / 60, nrms, c, DELAY + c *
+			    step);
+		}
+		for (i = 0; i < SECOND; i++) {
+			for (c = 0; c < nchan; c++)
+				le(fp, (uint16_t)buf[c][i], 2);
+		}
+	}
+	if (fclose(fp) != 0) {
+		perror(argv[optind]);
+		return (1);
+	}
+	return (0);
+}
@@ -0,0 +1,186 @@
+/*
+ * mkirig - synthesize an IRIG capture for the replay tests
+ *
+ * usage: mkirig [-a amplitude] [-c channels] [-d delay] [-f format]
+ *	      [-n noise] [-p ppm] [-r rate] [-s seconds] [-t start]
+ *	      [-x shift] file
+ *
+ * Writes raw 16-bit samples of IRIG-B (default), IRIG-E or IRIG-A, the
+ * time counting from the Unix time given with -t. The carrier is keyed
+ * to 0.3 of its peak amplitude (default 8000) between the pulses, and
+ * Gaussian noise of the given rms (default 300) is added. The frames
+ * carry the BCD time of day and day of year, the year in the control
+ * functions as IEEE 1344 does, and the straight binary seconds. The
+ * signal is late by the delay (us) and the sample clock of the given
+ * rate (default 8000 Hz) is off by the given ppm, so the tests can
+ * place the carrier anywhere against the sample grid. With -c the
+ * capture has that many interleaved channels of the same signal, each
+ * in its own noise, and the time sent on the last one is off by the
+ * given shift (s), so the tests can give the vote a wrong source. The
+ * noise generator is seeded, so a capture is the same every time it is
+ * made.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+
+#define FIELD		100	/* bits per frame */
+#define KEYED		0.3	/* carrier between the pulses */
+#define MAXCHAN		8	/* max channels */
+
+static uint32_t seed = 7;	/* noise generator */
+
+static double gauss(void)
+{
+	double	u, v;
+
+	seed = seed * 1664525 + 1013904223;
+	u = ((seed >> 8) + 0.5) / (1 << 24);
+	seed = seed * 1664525 + 1013904223;
+	v = ((seed >> 8) + 0.5) / (1 << 24);
+	return (sqrt(-2 * log(u)) * cos(2 * M_PI * v));
+}
+
+static void bcd(int *bits, int pos, int val, int n)
+{
+	int	i;
+
+	for (i = 0; i < n; i++)
+		bits[pos + i] = (val >> i) & 1;
+}
+
+/*
+ * irig_frame - the bits of the frame at time t, each 0, 1 or 2 for a
+ * position identifier. IRIG-A has ten frames a second, numbered in the
+ * tenths digit.
+ */
+static void irig_frame(int *bits, time_t t, int tenths, int isa)
+{
+	struct tm tm;
+	int	sbs, i;
+
+	gmtime_r(&t, &tm);
+	for (i = 0; i < FIELD; i++)
+		bits[i] = 0;
+	bits[0] = 2;
+	for (i = 9; i < FIELD; i += 10)
+		bits[i] = 2;
+	bcd(bits, 1, tm.tm_sec % 10, 4);
+	bcd(bits, 6, tm.tm_sec / 10, 3);
+	bcd(bits, 10, tm.tm_min % 10, 4);
+	bcd(bits, 15, tm.tm_min / 10, 3);
+	bcd(bits, 20, tm.tm_hour % 10, 4);
+	bcd(bits, 25, tm.tm_hour / 10, 2);
+	bcd(bits, 30, (tm.tm_yday + 1) % 10, 4);
+	bcd(bits, 35, (tm.tm_yday + 1) / 10 % 10, 4);
+	bcd(bits, 40, (tm.tm_yday + 1) / 100, 2);
+	if (isa)
+		bcd(bits, 45, tenths, 4);
+	bcd(bits, 50, tm.tm_year % 10, 4);
+	bcd(bits, 55, tm.tm_year / 10 % 10, 4);
+	sbs = (tm.tm_hour * 60 + tm.tm_min) * 60 + tm.tm_sec;
+	bcd(bits, 80, sbs, 9);
+	bcd(bits, 90, sbs >> 9, 8);
+}
+
+int main(int argc, char **argv)
+{
+	FILE	*fp;
+	int	bits[MAXCHAN][FIELD];
+	double	amp = 8000, noise = 300, delay = 0, ppm = 0;
+	double	carrier, bitlen, t, tf, x, y;
+	long	start = 1777816800, secs = 60, shift = 0, n, fr, frame = -1;
+	int	rate = 8000, format = 'B', nchan = 1;
+	int	c, i, bit, width;
+	int16_t	samp;
+
+	while ((c = getopt(argc, argv, "a:c:d:f:n:p:r:s:t:x:")) != -1) {
+		switch (c) {
+		case 'a':
+			amp = atof(optarg);
+			break;
+		case 'c':
+			nchan = atoi(optarg);
+			break;
+		case 'd':
+			delay = atof(optarg) / 1e6;
+			break;
+		case 'f':
+			format = optarg[0];
+			break;
+		case 'n':
+			noise = atof(optarg);
+			break;
+		case 'p':
+			ppm = atof(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 's':
+			secs = atol(optarg);
+			break;
+		case 't':
+			start = atol(optarg);
+			break;
+		case 'x':
+			shift = atol(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || rate <= 0 || secs <= 0 || nchan < 1 ||
+	    nchan > MAXCHAN || (format != 'A' && format != 'B' && format !=
+	    'E')) {
+usage:
+		fputs("usage: mkirig [-a amplitude] [-c channels] [-d delay] [-f format]\n"
+		    "\t      [-n noise] [-p ppm] [-r rate] [-s seconds] [-t start]\n"
+		    "\t      [-x shift] file\n", stderr);
+		return (1);
+	}
+	if (!(fp = fopen(argv[optind], "wb"))) {
+		perror(argv[optind]);
+		return (1);
+	}
+	carrier = format == 'A' ? 10000 : format == 'E' ? 100 : 1000;
+	bitlen = 10 / carrier;
+	for (n = 0; n < secs * rate; n++) {
+		t = (double)n / rate * (1 + ppm / 1e6) - delay;
+		fr = (long)floor(t / (FIELD * bitlen));
+		if (fr != frame) {
+			frame = fr;
+			for (c = 0; c < nchan; c++)
+				irig_frame(bits[c], start + (time_t)floor(fr *
+				    FIELD * bitlen + 1e-9) + (c == nchan - 1 ?
+				    shift : 0), (int)(fr % 10), format == 'A');
+		}
+		tf = t - fr * FIELD * bitlen;
+		bit = (int)floor(tf / bitlen);
+		if (bit > FIELD - 1)
+			bit = FIELD - 1;
+		x = sin(2 * M_PI * carrier * t) * amp;
+		for (c = 0; c < nchan; c++) {
+			i = bits[c][bit];
+			width = i == 2 ? 8 : i == 1 ? 5 : 2;
+			y = x;
+			if (tf - bit * bitlen >= width * bitlen / 10)
+				y *= KEYED;
+			y += noise * gauss();
+			if (y > 32767)
+				y = 32767;
+			if (y < -32768)
+				y = -32768;
+			samp = (int16_t)lrint(y);
+			fwrite(&samp, sizeof(samp), 1, fp);
+		}
+	}
+	if (fclose(fp) != 0) {
+		perror(argv[optind]);
+		return (1);
+	}
+	return (0);
+}
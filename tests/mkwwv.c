@@ -0,0 +1,143 @@
+/*
+ * mkwwv - synthesize a WWV capture for the replay tests
+ *
+ * usage: mkwwv [-m minutes] [-n noise] file
+ *
+ * Writes raw 16-bit samples at 8 kHz of WWV as the receiver hears it,
+ * starting at 14:00:00 on day 123 of 2026. Each second begins with the
+ * 5-ms 1000-Hz tick, or the 800-ms minute pulse in second 0, and after
+ * 30 ms of silence carries the 500- or 600-Hz tone of the minute and
+ * the 100-Hz subcarrier, high for 200, 500 or 800 ms for a zero, one or
+ * position marker and 15 dB lower for the rest of the second. Gaussian
+ * noise of the given rms (default 300) is added. The noise generator is
+ * seeded, so a capture is the same every time it is made.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <getopt.h>
+
+#define SECOND		8000	/* sample rate (Hz) */
+#define MS		(SECOND / 1000) /* samples per millisecond */
+#define AMP		8000	/* tick and minute pulse amplitude */
+#define TONE		0.5	/* tone amplitude */
+#define DATA		0.18	/* subcarrier amplitude */
+#define LOW		0.18	/* subcarrier low level (-15 dB) */
+#define YEAR		26	/* year of century */
+#define DAY		123	/* day of year */
+#define HOUR		14	/* hour of the first minute */
+
+static uint32_t seed = 7;	/* noise generator */
+
+static double gauss(void)
+{
+	double	u, v;
+
+	seed = seed * 1664525 + 1013904223;
+	u = ((seed >> 8) + 0.5) / (1 << 24);
+	seed = seed * 1664525 + 1013904223;
+	v = ((seed >> 8) + 0.5) / (1 << 24);
+	return (sqrt(-2 * log(u)) * cos(2 * M_PI * v));
+}
+
+/*
+ * wwv_bit - the subcarrier pulse of second sec: 0 or 1 for a data bit,
+ * 2 for a position marker, or -1 for second 0, which has none. The
+ * minutes, hours, day and year go in BCD, least significant bit first,
+ * in the positions of the WWV timecode.
+ */
+static int wwv_bit(int sec, int min, int hour)
+{
+	static const struct {
+		int	pos;	/* first second */
+		int	n;	/* bits */
+	} field[] = {
+		{4, 4}, {10, 4}, {15, 3}, {20, 4}, {25, 2}, {30, 4},
+		{35, 4}, {40, 2}, {51, 4}
+	};
+	int	val[9];
+	unsigned int i;
+
+	if (sec == 0)
+		return (-1);
+	if (sec % 10 == 9)
+		return (2);
+	val[0] = YEAR % 10;
+	val[1] = min % 10;
+	val[2] = min / 10;
+	val[3] = hour % 10;
+	val[4] = hour / 10;
+	val[5] = DAY % 10;
+	val[6] = DAY / 10 % 10;
+	val[7] = DAY / 100;
+	val[8] = YEAR / 10;
+	for (i = 0; i < sizeof(field) / sizeof(field[0]); i++) {
+		if (sec >= field[i].pos && sec < field[i].pos + field[i].n)
+			return ((val[i] >> (sec - field[i].pos)) & 1);
+	}
+	return (0);
+}
+
+int main(int argc, char **argv)
+{
+	FILE	*fp;
+	double	noise = 300, t, x;
+	int	minutes = 10;
+	int	c, n, i, bit, width, sec, min, tone;
+	int16_t	samp;
+
+	while ((c = getopt(argc, argv, "m:n:")) != -1) {
+		switch (c) {
+		case 'm':
+			minutes = atoi(optarg);
+			break;
+		case 'n':
+			noise = atof(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || minutes < 1 || minutes > 59) {
+usage:
+		fputs("usage: mkwwv [-m minutes] [-n noise] file\n", stderr);
+		return (1);
+	}
+	if (!(fp = fopen(argv[optind], "wb"))) {
+		perror(argv[optind]);
+		return (1);
+	}
+	for (n = 0; n < minutes * 60; n++) {
+		sec = n % 60;
+		min = n / 60;
+		bit = wwv_bit(sec, min, HOUR);
+		width = bit == 2 ? 800 : bit == 1 ? 500 : 200;
+		tone = min % 2 ? 500 : 600;
+		for (i = 0; i < SECOND; i++) {
+			t = (double)i / SECOND;
+			x = 0;
+			if (i < (sec == 0 ? 800 : 5) * MS)
+				x = sin(2 * M_PI * 1000 * t);
+			else if (i >= 30 * MS) {
+				if (sec != 0 && sec < 59)
+					x = TONE * sin(2 * M_PI * tone * t);
+				if (bit >= 0)
+					x += DATA * (i < width * MS ? 1 :
+					    LOW) * sin(2 * M_PI * 100 * t);
+			}
+			x = x * AMP + noise * gauss();
+			if (x > 32767)
+				x = 32767;
+			if (x < -32768)
+				x = -32768;
+			samp = (int16_t)lrint(x);
+			fwrite(&samp, sizeof(samp), 1, fp);
+		}
+	}
+	if (fclose(fp) != 0) {
+		perror(argv[optind]);
+		return (1);
+	}
+	return (0);
+}
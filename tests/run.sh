@@ -0,0 +1,152 @@
+#!/bin/sh
+#
+# run.sh - decoder regression tests
+#
+# usage: tests/run.sh [workdir]
+#
+# Builds the decoders and the signal generators in the work directory,
+# default a fresh one under /tmp, replays synthetic captures through
+# them and checks the results. Prints a line for each check and exits
+# 1 if any fails.
+#
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O2 -Wall}
+top=$(cd "$(dirname "$0")/.." && pwd)
+work=${1:-$(mktemp -d /tmp/decoder-tests.XXXXXX)}
+fails=0
+
+#
+# irigfit - replay an IRIG capture and print the number of offsets and
+# their RMS residual (us) about a straight line, after the first 40 s
+#
+irigfit() {
+	./irig -r -t 1777816800 "$@" 2>&1 | awk '
+	/sample offset/ { off = $4; next }
+	/^irig[0-9]* [0-9a-f][0-9a-f] / && off != "" {
+		split($NF, t, "."); x = t[1] + t[2] / 1e6; y = off * 1e6
+		off = ""
+		if (x0 == "")
+			x0 = x
+		x -= x0
+		if (x < 40)
+			next
+		n++; X[n] = x; Y[n] = y
+		sx += x; sy += y; sxx += x * x; sxy += x * y
+	} END {
+		if (n < 3) { print 0, 1e6; exit }
+		b = (n * sxy - sx * sy) / (n * sxx - sx * sx); a = (sy - b * sx) / n
+		for (i = 1; i <= n; i++) s += (Y[i] - a - b * X[i]) ^ 2
+		printf "%d %.3f\n", n, sqrt(s / (n - 2))
+	}'
+}
+
+check() {
+	if [ "$1" -eq 0 ]; then
+		echo "ok   $2"
+	else
+		echo "FAIL $2"
+		fails=$((fails + 1))
+	fi
+}
+
+mkdir -p "$work" && cd "$work" || exit 1
+$CC $CFLAGS -o chu "$top/chu.c" "$top/wavfile.c" "$top/pool.c" \
+    "$top/ntpshm.c" "$top/ntp_systime.c" "$top/caljulian.c" "$top/md5.c" -lm -lpthread &&
+$CC $CFLAGS -o mkchu "$top/tests/mkchu.c" -lm &&
+$CC $CFLAGS -o irig "$top/irig.c" "$top/pool.c" "$top/ntpshm.c" \
+    "$top/ntp_systime.c" "$top/caljulian.c" "$top/md5.c" -lm -lpthread &&
+$CC $CFLAGS -o mkirig "$top/tests/mkirig.c" -lm &&
+$CC $CFLAGS -o wwv "$top/wwv.c" "$top/wwvtlm.c" "$top/wavfile.c" \
+    "$top/pool.c" "$top/ntp_systime.c" "$top/caljulian.c" "$top/md5.c" \
+    -lm -lpthread &&
+$CC $CFLAGS -o mkwwv "$top/tests/mkwwv.c" -lm || exit 1
+
+#
+# CHU golden file: chu1.wav is two minutes of one path from mkchu and
+# chu1.gold the minute records of a good replay of it.
+#
+./chu -r -t 1777816800 -g "$top/tests/chu1.gold" "$top/tests/chu1.wav" \
+    >/dev/null 2>&1
+check $? "chu replay matches golden file"
+
+#
+# WAV parser: a WAVE_FORMAT_EXTENSIBLE header with a fmt chunk too
+# short to hold the subformat must be rejected, not read past the
+# chunk into the samples, which here would pass for the PCM tag.
+#
+printf 'RIFF\050\000\000\000WAVEfmt \020\000\000\000\376\377\001\000' >ext.wav
+printf '\100\037\000\000\200\076\000\000\002\000\020\000' >>ext.wav
+printf 'data\004\000\000\000\001\000\002\000' >>ext.wav
+! ./chu -r ext.wav >/dev/null 2>&1
+check $? "short extensible fmt chunk rejected"
+
+#
+# CHU multipath: the offset of each minute combines the bursts of all
+# three paths, so delaying paths 1 and 2 by 300 and 600 us must move
+# the mean offset by at least 100 us.
+#
+./mkchu -c 3 -m 4 -d 0 chu3a.wav &&
+./mkchu -c 3 -m 4 -d 0.0003 chu3b.wav || exit 1
+./chu -r -t 1777816800 -o chu3a.txt chu3a.wav >/dev/null 2>&1
+./chu -r -t 1777816800 -o chu3b.txt chu3b.wav >/dev/null 2>&1
+awk '$1 != "-" {
+	if (FILENAME == ARGV[1]) { a += $1; na++ } else { b += $1; nb++ }
+} END { exit !(na > 0 && nb > 0 && a / na - b / nb > 100e-6) }' \
+    chu3a.txt chu3b.txt
+check $? "chu multipath offset follows paths 1-2"
+
+#
+# IRIG-B timing at and near the nominal sample rate, and with the
+# carrier half a sample off the grid: the offsets of 300 s of a clean
+# signal must lie within 6 us RMS of a straight line. A VFO that slips
+# back and forth scatters them by 30 us and more.
+#
+for args in "-p 0" "-p 1" "-p -0.1" "-d 62.5" "-p -30"; do
+	./mkirig -s 300 $args irigb.raw || exit 1
+	irigfit irigb.raw | awk '{ exit !($1 >= 240 && $2 < 6) }'
+	check $? "irig-b timing $args"
+done
+
+#
+# IRIG-A from the resampler at the nominal 48- and 96-kHz codec rates,
+# also a little off it and with the carrier off the grid: 120 s must
+# give the offsets within 1.5 us RMS, about three times what a VFO
+# that tracks the carrier achieves.
+#
+for rate in 48000 96000; do
+	for args in "-p 0" "-p 1" "-d 5.2"; do
+		./mkirig -f A -r $rate -s 120 $args iriga.raw || exit 1
+		irigfit -s $rate iriga.raw | awk '{ exit !($1 >= 70 && $2 < 1.5) }'
+		check $? "irig-a $rate timing $args"
+	done
+done
+
+#
+# IRIG vote: the last of two or three channels sends the time a second
+# late, in noise that spoils a good part of the frames. With two
+# channels neither can be confirmed, so none may be selected. With
+# three the wrong one must never be selected and the two right ones
+# never flagged for disagreeing with it.
+#
+./mkirig -c 2 -x 1 -n 1000 -s 120 irigv.raw || exit 1
+./irig -r -t 1777816800 -c 2 irigv.raw >irigv.txt 2>&1
+! grep -q "selected" irigv.txt
+check $? "irig vote with irig1 a second off"
+./mkirig -c 3 -x 1 -n 1000 -s 120 irigv.raw || exit 1
+./irig -r -t 1777816800 -c 3 irigv.raw >irigv.txt 2>&1
+grep -q "selected" irigv.txt && ! grep -q "selected irig2" irigv.txt &&
+    ! grep -q "^irig[01]: disagrees" irigv.txt
+check $? "irig vote with irig2 a second off"
+
+#
+# WWV batch acquisition: the reachability register is seeded from the
+# minutes folded, so fewer than three must be refused and three must
+# reach minute sync on a clean capture.
+#
+./mkwwv -m 6 wwv.raw || exit 1
+./wwv -r -t 1777816800 -a 3 wwv.raw 2>&1 | grep -q "MSYNC [0-9]"
+check $? "wwv -a 3 reaches minute sync"
+! ./wwv -r -t 1777816800 -a 2 wwv.raw >/dev/null 2>&1
+check $? "wwv -a 2 refused"
+
+exit $((fails > 0))
@@ -142,7 +142,7 @@ static inline float fast_sinf(float x) {
 }
 
 /* Accumulate a tone, amp % of full scale, into the buffer. */
-static void addtone(int16_t *start, size_t len, unsigned hz, unsigned amp)
+void addtone(int16_t *start, size_t len, unsigned hz, unsigned amp)
 {
   float step = 2.0f * (float)M_PI * hz / SAMPHZ;
   float pos = step/2;
@@ -295,6 +295,7 @@ void dosecond(int16_t *buf, time_t t, struct tm const *tm, unsigned const *bits)
     }
 }
 
+#ifndef NO_MAIN
 /* * Format and write out the given second. This avoids calling * gmtime
 except when the minute changes. * * The "len" parameter is nominally
 SAMPHZ, but can be shorter * or longer as needed to correct the playing
@@ -407,4 +408,4 @@ int main(void)
 	}
 	return 0;
 }
-
+#endif /* NO_MAIN */
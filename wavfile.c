@@ -0,0 +1,123 @@
+/*
+ * wavfile.c - recorded captures for the replay drivers
+ *
+ * See wavfile.h.
+ */
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "wavfile.h"
+
+#define FMTLEN		16	/* min fmt chunk length */
+#define EXTLEN		(24 + 16) /* fmt chunk length with subformat */
+
+static unsigned int le16(const uint8_t *p)
+{
+	return (p[0] | p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+	return (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+}
+
+/*
+ * wav_parse - find the samples in a mapped capture. Returns the offset
+ * of the first sample and sets the sample count and number of
+ * channels, or returns -1 if the file is a WAV file we cannot use.
+ *
+ * The format tag of WAVE_FORMAT_EXTENSIBLE is followed by the real one
+ * at the start of the subformat GUID, which is only there if the fmt
+ * chunk is long enough to hold it.
+ */
+long wav_parse(const uint8_t *map, size_t len, unsigned int rate,
+    size_t *nsamp, unsigned int *nchan)
+{
+	const uint8_t *fmt = NULL;
+	size_t	pos, size, fmtsize = 0;
+	unsigned int tag;
+
+	if (len < 12 || memcmp(map, "RIFF", 4) || memcmp(map + 8, "WAVE", 4)) {
+		*nsamp = len / sizeof(int16_t);
+		*nchan = 1;
+		return (0);
+	}
+	for (pos = 12; pos + 8 <= len; pos += 8 + size + (size & 1)) {
+		size = le32(map + pos + 4);
+		if (!memcmp(map + pos, "fmt ", 4) && size >= FMTLEN &&
+		    pos + 8 + size <= len) {
+			fmt = map + pos + 8;
+			fmtsize = size;
+		} else if (!memcmp(map + pos, "data", 4)) {
+			if (fmt == NULL)
+				break;
+			tag = le16(fmt);
+			if (tag == 0xfffe) {	/* WAVE_FORMAT_EXTENSIBLE */
+				if (fmtsize < EXTLEN)
+					break;
+				tag = le16(fmt + 24);
+			}
+			*nchan = le16(fmt + 2);
+			if (tag != 1 || *nchan < 1 || le32(fmt + 4) != rate ||
+			    le16(fmt + 14) != 16)
+				break;
+			if (size > len - pos - 8)
+				size = len - pos - 8;
+			*nsamp = size / (sizeof(int16_t) * *nchan);
+			return (pos + 8);
+		}
+	}
+	return (-1);
+}
+
+/*
+ * wav_map - map a capture. Returns 0 if successful, -1 if not, with the
+ * reason on stderr.
+ */
+int wav_map(const char *path, unsigned int rate, struct wavfile *fp)
+{
+	struct stat st;
+	long	off;
+	int	fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		perror(path);
+		return (-1);
+	}
+	if (fstat(fd, &st) < 0) {
+		perror(path);
+		close(fd);
+		return (-1);
+	}
+	fp->map = (const uint8_t *)mmap(NULL, st.st_size, PROT_READ,
+	    MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (fp->map == MAP_FAILED) {
+		perror(path);
+		return (-1);
+	}
+	madvise((void *)fp->map, st.st_size, MADV_SEQUENTIAL);
+	fp->len = st.st_size;
+	fp->mtime = st.st_mtime;
+	if ((off = wav_parse(fp->map, st.st_size, rate, &fp->nsamp,
+	    &fp->nchan)) < 0) {
+		fprintf(stderr, "%s: not 16-bit PCM at %u Hz\n", path, rate);
+		wav_unmap(fp);
+		return (-1);
+	}
+	fp->samp = (const int16_t *)(fp->map + off);
+	return (0);
+}
+
+/*
+ * wav_unmap - unmap a capture
+ */
+void wav_unmap(struct wavfile *fp)
+{
+	munmap((void *)fp->map, fp->len);
+	fp->map = NULL;
+}
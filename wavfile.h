@@ -0,0 +1,32 @@
+/*
+ * wavfile.h - recorded captures for the replay drivers
+ *
+ * A capture is either a WAV file, 16-bit PCM at the rate the decoder
+ * expects, with any number of interleaved channels, or raw 16-bit
+ * samples in host byte order, taken as one channel. wav_map() maps the
+ * file read-only and finds the samples, so the replay drivers of wwv
+ * and chu can walk them in place.
+ */
+#ifndef WAVFILE_H
+#define WAVFILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+struct wavfile {
+	const uint8_t *map;	/* mapped file */
+	off_t	len;		/* file length */
+	const int16_t *samp;	/* first sample */
+	size_t	nsamp;		/* samples per channel */
+	unsigned int nchan;	/* channels */
+	time_t	mtime;		/* last modified */
+};
+
+long wav_parse(const uint8_t *map, size_t len, unsigned int rate,
+    size_t *nsamp, unsigned int *nchan);
+int wav_map(const char *path, unsigned int rate, struct wavfile *fp);
+void wav_unmap(struct wavfile *fp);
+
+#endif /* WAVFILE_H */
@@ -10,8 +10,17 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
 #include "ntp_fp.h"
 #include "ntp_unixtime.h"
+#include "simd.h"
+#include "pool.h"
+#include "wwvtlm.h"
+#include "wavfile.h"
 #define CLOCK_CODEC_OFFSET 0
 #define MAXGAIN 16383
 
@@ -110,6 +119,11 @@ struct shmTime {
 #define	AUDIO_PHI	5e-6f	/* dispersion growth factor */
 #define	TBUF		128	/* max monitor line length */
 #define BMAX        128 /* max timecode length */
+#define NSTAGE		8	/* median filter stages (minutes) */
+#define NPUBLISH	4	/* min median filter samples to publish */
+#define SNAPVER		2	/* snapshot version */
+#define SNAPAGE		600	/* max snapshot age (s) */
+#define SNAPINT		60	/* snapshot interval (s) */
 
 /*
  * Tunable parameters. The DGAIN parameter can be changed to fit the
@@ -217,6 +231,10 @@ struct shmTime {
 #define IN100		((100 * 80) / SECOND) /* 100 Hz increment */
 #define IN1000		((1000 * 80) / SECOND) /* 1000 Hz increment */
 #define IN1200		((1200 * 80) / SECOND) /* 1200 Hz increment */
+#define MIXPER		40	/* sync mixer period (samples) */
+#define BLKSIZ		256	/* receive block size (samples) */
+#define SEGSIZ		(SECOND + 1) /* max logical clock samples per segment */
+#define MINMS		(MINUTE / MS) /* milliseconds per minute */
 
 /*
  * Acquisition and tracking time constants
@@ -262,7 +280,7 @@ struct shmTime {
  * Table of sine values at 4.5-degree increments. This is used by the
  * synchronous matched filter demodulators.
  */
-float sintab[] = {
+static const float sintab[] = {
  0.000000e+00,  7.845910e-02,  1.564345e-01,  2.334454e-01, /* 0-3 */
  3.090170e-01,  3.826834e-01,  4.539905e-01,  5.224986e-01, /* 4-7 */
  5.877853e-01,  6.494480e-01,  7.071068e-01,  7.604060e-01, /* 8-11 */
@@ -286,6 +304,13 @@ float sintab[] = {
  0.000000e+00
 };
 
+/*
+ * Sync mixer table built from sintab by wwv_mixinit(), once for all
+ * units, as they read it from the pool threads
+ */
+static float mixtab[4][MIXPER + VLEN];
+static pthread_once_t mixonce = PTHREAD_ONCE_INIT;
+
 /*
  * Decoder operations at the end of each second are driven by a state
  * machine. The transition matrix consists of a dispatch table indexed
@@ -324,7 +349,7 @@ struct progx {
 #define DA		4	/* day digits (3) */
 #define YR		7	/* year digits (2) */
 
-struct progx progx[] = {
+static const struct progx progx[] = {
 	{SYNC2,	0},		/* 0 latch minute sync pulse */
 	{SYNC3,	0},		/* 1 latch data pulse */
 	{MSCBIT, DST2},		/* 2 dst2 */
@@ -400,7 +425,7 @@ struct progx progx[] = {
 #define P9	(P15 / 4)	/* mark (+1) */
 #define N9	(N15 / 4)	/* space (-1) */
 
-float bcd9[][4] = {
+static const float bcd9[][4] = {
 	{N9, N9, N9, N9}, 	/* 0 */
 	{P9, N9, N9, N9}, 	/* 1 */
 	{N9, P9, N9, N9}, 	/* 2 */
@@ -420,7 +445,7 @@ float bcd9[][4] = {
 #define P6	(P15 / 3)	/* mark (+1) */
 #define N6	(N15 / 3)	/* space (-1) */
 
-float bcd6[][4] = {
+static const float bcd6[][4] = {
 	{N6, N6, N6, 0}, 	/* 0 */
 	{P6, N6, N6, 0}, 	/* 1 */
 	{N6, P6, N6, 0}, 	/* 2 */
@@ -437,7 +462,7 @@ float bcd6[][4] = {
 #define P3	(P15 / 2)	/* mark (+1) */
 #define N3	(N15 / 2)	/* space (-1) */
 
-float bcd3[][4] = {
+static const float bcd3[][4] = {
 	{N3, N3, 0, 0}, 	/* 0 */
 	{P3, N3, 0, 0}, 	/* 1 */
 	{N3, P3, 0, 0}, 	/* 2 */
@@ -451,23 +476,13 @@ float bcd3[][4] = {
 #define P2	(P15 / 2)	/* mark (+1) */
 #define N2	(N15 / 2)	/* space (-1) */
 
-float bcd2[][4] = {
+static const float bcd2[][4] = {
 	{N2, N2, 0, 0}, 	/* 0 */
 	{P2, N2, 0, 0}, 	/* 1 */
 	{N2, P2, 0, 0}, 	/* 2 */
 	{0, 0, 0, 0}		/* backstop */
 };
 
-/*
- * DST decode (DST2 DST1) for prettyprint
- */
-char dstcod[] = {
-	'S',			/* 00 standard time */
-	'I',			/* 01 set clock ahead at 0200 local */
-	'O',			/* 10 set clock back at 0200 local */
-	'D'			/* 11 daylight time */
-};
-
 /*
  * The decoding matrix consists of nine row vectors, one for each digit
  * of the timecode. The digits are stored from least to most significant
@@ -518,6 +533,149 @@ struct chan {
 	struct sync wwvh;	/* wwvh station */
 };
 
+/*
+ * The DSP context (dp) holds the filter delay lines, matched filters
+ * and epoch scanners used by the demodulator. There is one of these
+ * for each unit, so several units can run in the same process while
+ * sharing the read-only tables above.
+ */
+struct wwvdsp {
+	/*
+	 * Variables used by the RF routine (wwv_rf)
+	 */
+	float	lpf[5];		/* 150-Hz lpf delay line */
+	float	bpf[9];		/* 1000/1200-Hz bpf delay line */
+	int	iptr;		/* data channel pointer */
+	float	ibuf[DATSIZ];	/* data I channel delay line */
+	float	qbuf[DATSIZ];	/* data Q channel delay line */
+	int	jptr;		/* sync channel pointer */
+	int	kptr;		/* tick channel pointer */
+
+	int	mixpha;		/* sync mixer phase */
+	float	cibuf[SYNSIZ];	/* wwv I channel delay line */
+	float	cqbuf[SYNSIZ];	/* wwv Q channel delay line */
+	float	ciamp;		/* wwv I channel amplitude */
+	float	cqamp;		/* wwv Q channel amplitude */
+	float	csibuf[TCKSIZ];	/* wwv I tick delay line */
+	float	csqbuf[TCKSIZ];	/* wwv Q tick delay line */
+	float	csiamp;		/* wwv I tick amplitude */
+	float	csqamp;		/* wwv Q tick amplitude */
+
+	float	hibuf[SYNSIZ];	/* wwvh I channel delay line */
+	float	hqbuf[SYNSIZ];	/* wwvh Q channel delay line */
+	float	hiamp;		/* wwvh I channel amplitude */
+	float	hqamp;		/* wwvh Q channel amplitude */
+	float	hsibuf[TCKSIZ];	/* wwvh I tick delay line */
+	float	hsqbuf[TCKSIZ];	/* wwvh Q tick delay line */
+	float	hsiamp;		/* wwvh I tick amplitude */
+	float	hsqamp;		/* wwvh Q tick amplitude */
+
+	float	epobuf[SECOND];	/* second sync comb filter */
+	float	epomax, nxtmax;	/* second sync amplitude buffer */
+	int	epopos;		/* epoch second sync position buffer */
+
+	/*
+	 * Block buffers used by the receive routine (wwv_receive). The
+	 * VFO can duplicate a sample, so the output buffers are twice
+	 * the block size.
+	 */
+	float	xin[BLKSIZ];	/* clipped codec samples */
+	unsigned short xidx[2 * BLKSIZ]; /* codec sample index */
+	float	data[2 * BLKSIZ]; /* lpf output */
+	float	syncx[2 * BLKSIZ]; /* bpf output */
+	float	mix[4][2 * BLKSIZ]; /* sync mixer output */
+
+	/*
+	 * Variables used by the second sync routine (wwv_endpoc)
+	 */
+	int	epoch_mf[3];	/* epoch median filter */
+	int	tepoch;		/* current second epoch */
+	int	xepoch;		/* last second epoch */
+	int	zepoch;		/* last run epoch */
+	int	zcount;		/* last run end time */
+	int	scount;		/* seconds counter */
+	int	syncnt;		/* run length counter */
+	int	maxrun;		/* longest run length */
+	int	mepoch;		/* longest run end epoch */
+	int	mcount;		/* longest run end time */
+	int	avgcnt;		/* averaging interval counter */
+	int	avginc;		/* averaging ratchet */
+
+	/*
+	 * Variables used by the epoch scanner (wwv_epoch)
+	 */
+	float	sigmin, sigzer, sigone; /* data signal latches */
+	float	engmax, engmin;	/* data signal energy */
+
+	/*
+	 * Variables used by the seconds state machine (wwv_rsec)
+	 */
+	float	bcddld[4];	/* BCD data bits */
+	float	bitvec[61];	/* bit integrator for misc bits */
+};
+
+/*
+ * In multi-stream mode each of the NCHAN radio channels has its own
+ * audio stream, for instance from a wideband SDR tuned to all the
+ * carriers at once. A probe context (pr) for each stream runs the
+ * bandpass filter and the 800-ms minute sync matched filters, so the
+ * minute sync discriminators for all channels run in parallel rather
+ * than one channel at a time. The probes work a segment at a time,
+ * which is the part of the input up to the end of the current logical
+ * second, and share the VFO sample map of the main decoder.
+ */
+struct wwvprobe {
+	float	bpf[9];		/* 1000/1200-Hz bpf delay line */
+	int	mixpha;		/* sync mixer phase */
+	int	jptr;		/* sync channel pointer */
+	float	cibuf[SYNSIZ];	/* wwv I channel delay line */
+	float	cqbuf[SYNSIZ];	/* wwv Q channel delay line */
+	float	hibuf[SYNSIZ];	/* wwvh I channel delay line */
+	float	hqbuf[SYNSIZ];	/* wwvh Q channel delay line */
+	float	ciamp, cqamp;	/* wwv I/Q channel amplitude */
+	float	hiamp, hqamp;	/* wwvh I/Q channel amplitude */
+
+	float	xin[SECOND];	/* clipped codec samples */
+	float	syncx[SEGSIZ];	/* bpf output */
+	float	mix[4][SEGSIZ];	/* sync mixer output */
+	float	wamp[SEGSIZ];	/* wwv minute sync amplitude */
+	float	hamp[SEGSIZ];	/* wwvh minute sync amplitude */
+};
+
+/*
+ * Multi-stream context (mp)
+ */
+struct wwvmulti {
+	struct pool *pool;	/* probe thread pool */
+	struct wwvprobe *probe[NCHAN]; /* probe contexts */
+	const int16_t *seg[NCHAN]; /* segment samples (NULL if no stream) */
+	unsigned int nin;	/* codec samples in segment */
+	unsigned int nout;	/* logical clock samples in segment */
+	unsigned int next;	/* next segment sample for wwv_qrz() */
+	int	valid;		/* probes ran for this segment */
+	unsigned short xidx[SEGSIZ]; /* VFO sample map */
+};
+
+/*
+ * Batch acquisition context (ap)
+ *
+ * The minute sync templates are rectangular 800-ms bursts of 1000 Hz
+ * and 1200 Hz, so correlating with them is a sliding sum of the mixer
+ * outputs. The acquisition engine decimates the mixer outputs to 1-ms
+ * partial sums as they arrive, then once a minute runs the 800-ms
+ * window over the whole minute in one pass and folds the envelope over
+ * the last nmin minutes.
+ */
+struct wwvacq {
+	int	nmin;		/* minutes folded */
+	int	nfold;		/* minutes in the fold so far */
+	int	head;		/* newest minute in the ring */
+	float	part[4][MINMS];	/* 1-ms mixer sums (wwv I/Q, wwvh I/Q) */
+	float	*env[2];	/* wwv/wwvh envelope ring (nmin minutes) */
+	int	peak[2][AMAX];	/* wwv/wwvh envelope peak each minute */
+	float	fold[MINMS];	/* folded envelope */
+};
+
 /*
  * WWV unit control structure (up)
  */
@@ -593,9 +751,11 @@ struct wwvunit {
     uint32_t    yearstart;  /* beginning of year */
 
     /* Median filter */
-    double filter[64]; /* median filter sample array */
+    double filter[NSTAGE]; /* median filter samples, arrival order */
+    double sorted[NSTAGE]; /* median filter samples, ascending order */
     unsigned int coderecv;   /* put pointer */
-    unsigned int codeproc;   /* get pointer */
+    unsigned int nstage;     /* number of samples */
+    double offset; /* trimmed mean offset */
     double jitter; /* jitter */
     double disp; /* dispersion */
 
@@ -607,6 +767,40 @@ struct wwvunit {
 
     /* NTP-SHM buffer */
     struct shmTime *shmTime;
+
+	/* DSP context */
+	struct wwvdsp *dsp;
+
+	/* Multi-stream context (NULL if single stream) */
+	struct wwvmulti *multi;
+
+	/* Batch acquisition context (NULL if not used) */
+	struct wwvacq *acq;
+
+	/* Restored from snapshot, resume at next buffer */
+	int	restore;
+
+	/* Telemetry ring, drained by the main loop */
+	struct tlmring *tlm;
+};
+
+/*
+ * Snapshot header. The snapshot is the header followed by the unit
+ * structure and the DSP context, written as they are in memory. The
+ * pointers in the unit structure are rebuilt when the snapshot is
+ * loaded, except the station pointer, which is saved as an index into
+ * the channel data. The sizes make sure a snapshot is only loaded by
+ * the same build, more or less, and the digest catches a torn or
+ * damaged file.
+ */
+struct wwvsnap {
+	char	magic[4];	/* "WWVS" */
+	uint32_t version;	/* SNAPVER */
+	uint32_t unitsize;	/* sizeof(struct wwvunit) */
+	uint32_t dspsize;	/* sizeof(struct wwvdsp) */
+	int64_t	saved;		/* time saved (s) */
+	int32_t	sptr;		/* station pointer index (-1 if none) */
+	uint8_t	digest[16];	/* MD5 of unit and DSP context */
 };
 
 /*
@@ -616,10 +810,30 @@ struct wwvunit {
 static void wwv_epoch(struct wwvunit *up);
 void wwv_receive(struct wwvunit *up, int16_t *recv_buffer, unsigned int recv_length, l_fp recv_time);
 void wwv_rf(struct wwvunit *up, float isig);
+static void wwv_block(struct wwvunit *up, const int16_t *buf, unsigned int nin, unsigned int nout);
+int wwv_multi(struct wwvunit *up, unsigned int nthreads);
+void wwv_receive_multi(struct wwvunit *up, int16_t *recv_buffer[NCHAN], unsigned int recv_length, l_fp recv_time);
+static void wwv_probe(void *arg, unsigned int chan);
+static void wwv_probe_qrz(struct wwvunit *up);
+static unsigned int wwv_vfo(struct wwvunit *up, unsigned short *xidx, unsigned int avail, unsigned int *nin);
+static unsigned int wwv_clip(float *out, const int16_t *in, unsigned int n);
+static void wwv_mix(float *mix, unsigned int stride, const float *syncx, int *mixpha, unsigned int n);
+static void wwv_mixinit(void);
+static inline float wwv_lpf(float *lpf, float isig);
+static inline float wwv_bpf(float *bpf, float isig);
+static void wwv_demod(struct wwvunit *up, unsigned int k);
 static void wwv_endpoc(struct wwvunit *up, int epopos);
 static void wwv_rsec(struct wwvunit *up, float bit);
 static void wwv_qrz(struct wwvunit *up, struct sync *sp, int pdelay);
-static void wwv_corr4(struct wwvunit *up, struct decvec *vp, float	data[], float tab[][4]);
+int wwv_save(struct wwvunit *up, const char *statefile);
+static int wwv_restore(struct wwvunit *up, const char *statefile);
+static void wwv_resume(struct wwvunit *up, l_fp recv_time);
+void MD5(unsigned char *dst, const unsigned char *src, unsigned int len);
+int wwv_acquire(struct wwvunit *up, int nmin);
+static void wwv_acq(struct wwvunit *up, float ci, float cq, float hi, float hq);
+static void wwv_acqmin(struct wwvunit *up, int station, struct sync *sp, int pdelay);
+static void wwv_tlm8(struct wwvunit *up, struct sync *sp, long epoch);
+static void wwv_corr4(struct wwvunit *up, struct decvec *vp, float	data[], const float tab[][4]);
 static void wwv_gain(struct wwvunit *up);
 static void wwv_tsec(struct wwvunit *up);
 static int timecode(struct wwvunit *, char *);
@@ -628,6 +842,10 @@ static int wwv_newchan(struct wwvunit *up);
 static void wwv_newgame(struct wwvunit *up);
 static float wwv_metric(struct sync *);
 static void wwv_clock(struct wwvunit *up);
+static time_t wwv_yeartime(struct wwvunit *up);
+static void wwv_publish(struct wwvunit *up, time_t offset);
+static unsigned int wwv_search(const double *off, unsigned int n, double x);
+unsigned int wwv_sample(struct wwvunit *up);
 
 static uint8_t qsy[NCHAN] = {5, 10, 15, 20}; /* frequencies (MHz) */
 
@@ -682,8 +900,11 @@ static float wwv_snr(float signal, float noise)
 
 /*
  * wwv_start - open the devices and initialize data for processing
+ *
+ * If statefile names a recent snapshot saved by wwv_save(), the unit
+ * picks up where it left off; otherwise it starts from scratch.
  */
-struct wwvunit *wwv_start(int unit)
+struct wwvunit *wwv_start(int unit, const char *statefile)
 {
     struct wwvunit *up;
 
@@ -694,12 +915,22 @@ struct wwvunit *wwv_start(int unit)
         return (0);
     }
 	memset(up, 0, sizeof(struct wwvunit));
+	if (!(up->dsp = (struct wwvdsp *)calloc(1, sizeof(struct wwvdsp)))) {
+		free(up);
+		return (0);
+	}
+	if (!(up->tlm = tlm_create())) {
+		free(up->dsp);
+		free(up);
+		return (0);
+	}
 
 	/*
 	 * Initialize miscellaneous variables
 	 */
 	up->clockdesc = DESCRIPTION;
 	DTOLFP(1. / SECOND, &up->tick);
+	pthread_once(&mixonce, wwv_mixinit);
 
 	/*
 	 * Initialize the decoding matrix with the radix for each digit
@@ -716,18 +947,217 @@ struct wwvunit *wwv_start(int unit)
 	up->decvec[YR + 1].radix = 10;
 
 	/*
-	 * Let the games begin.
+	 * Let the games begin, unless they are already under way.
 	 */
-	wwv_newgame(up);
+	if (statefile == NULL || wwv_restore(up, statefile) < 0)
+		wwv_newgame(up);
 	return up;
 }
 
+/*
+ * wwv_save - save a snapshot of the unit
+ *
+ * The snapshot is written to a temporary file, which is then synced
+ * and renamed over the old one, so a crash leaves either the old or the
+ * new snapshot but never a partial one. Returns 0 if successful, -1 if
+ * not.
+ */
+int wwv_save(struct wwvunit *up, const char *statefile)
+{
+	struct wwvsnap *hp;
+	struct wwvunit *tp;
+	char	tmpfile[256];
+	uint8_t	*buf;
+	size_t	len;
+	int	fd, i, rval;
+
+	len = sizeof(struct wwvsnap) + sizeof(struct wwvunit) +
+	    sizeof(struct wwvdsp);
+	if (!(buf = (uint8_t *)calloc(1, len)))
+		return (-1);
+	hp = (struct wwvsnap *)buf;
+	tp = (struct wwvunit *)(buf + sizeof(struct wwvsnap));
+	memcpy(hp->magic, "WWVS", 4);
+	hp->version = SNAPVER;
+	hp->unitsize = sizeof(struct wwvunit);
+	hp->dspsize = sizeof(struct wwvdsp);
+	hp->saved = time(NULL);
+	hp->sptr = -1;
+	for (i = 0; i < NCHAN; i++) {
+		if (up->sptr == &up->mitig[i].wwv)
+			hp->sptr = 2 * i;
+		else if (up->sptr == &up->mitig[i].wwvh)
+			hp->sptr = 2 * i + 1;
+	}
+	memcpy(tp, up, sizeof(struct wwvunit));
+	tp->clockdesc = NULL;
+	tp->sptr = NULL;
+	tp->shmTime = NULL;
+	tp->dsp = NULL;
+	tp->multi = NULL;
+	tp->acq = NULL;
+	tp->tlm = NULL;
+	memcpy(buf + sizeof(struct wwvsnap) + sizeof(struct wwvunit), up->dsp,
+	    sizeof(struct wwvdsp));
+	MD5(hp->digest, buf + sizeof(struct wwvsnap), len -
+	    sizeof(struct wwvsnap));
+
+	rval = -1;
+	snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", statefile);
+	if ((fd = open(tmpfile, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+		if (write(fd, buf, len) == (ssize_t)len && fsync(fd) == 0)
+			rval = 0;
+		close(fd);
+		if (rval == 0 && rename(tmpfile, statefile) < 0)
+			rval = -1;
+		if (rval < 0)
+			unlink(tmpfile);
+	}
+	free(buf);
+	return (rval);
+}
+
+/*
+ * wwv_restore - load a snapshot of the unit
+ *
+ * This routine loads the snapshot if it is valid and not more than
+ * SNAPAGE old. The decoder then resumes with the next buffer. Returns 0
+ * if successful, -1 if not.
+ */
+static int wwv_restore(struct wwvunit *up, const char *statefile)
+{
+	struct wwvsnap *hp;
+	struct wwvunit unit;
+	struct stat st;
+	uint8_t	digest[16];
+	uint8_t	*buf;
+	size_t	len;
+	time_t	now;
+	int	fd, rval;
+
+	len = sizeof(struct wwvsnap) + sizeof(struct wwvunit) +
+	    sizeof(struct wwvdsp);
+	if ((fd = open(statefile, O_RDONLY)) < 0)
+		return (-1);
+	if (fstat(fd, &st) < 0 || st.st_size != (off_t)len ||
+	    !(buf = (uint8_t *)malloc(len))) {
+		close(fd);
+		return (-1);
+	}
+	rval = -1;
+	hp = (struct wwvsnap *)buf;
+	now = time(NULL);
+	if (read(fd, buf, len) == (ssize_t)len &&
+	    !memcmp(hp->magic, "WWVS", 4) && hp->version == SNAPVER &&
+	    hp->unitsize == sizeof(struct wwvunit) &&
+	    hp->dspsize == sizeof(struct wwvdsp) &&
+	    hp->saved <= now && now - hp->saved <= SNAPAGE &&
+	    hp->sptr < 2 * NCHAN) {
+		MD5(digest, buf + sizeof(struct wwvsnap), len -
+		    sizeof(struct wwvsnap));
+		if (!memcmp(digest, hp->digest, sizeof(digest)))
+			rval = 0;
+	}
+	if (rval == 0) {
+		memcpy(&unit, buf + sizeof(struct wwvsnap),
+		    sizeof(struct wwvunit));
+		unit.clockdesc = up->clockdesc;
+		unit.shmTime = up->shmTime;
+		unit.dsp = up->dsp;
+		unit.multi = up->multi;
+		unit.acq = up->acq;
+		unit.tlm = up->tlm;
+		*up = unit;
+		memcpy(up->dsp, buf + sizeof(struct wwvsnap) +
+		    sizeof(struct wwvunit), sizeof(struct wwvdsp));
+		if (hp->sptr < 0)
+			up->sptr = NULL;
+		else if (hp->sptr & 1)
+			up->sptr = &up->mitig[hp->sptr / 2].wwvh;
+		else
+			up->sptr = &up->mitig[hp->sptr / 2].wwv;
+		up->restore = 1;
+	}
+	free(buf);
+	close(fd);
+	return (rval);
+}
+
+/*
+ * wwv_resume - resume after a restore
+ *
+ * This routine is called with the timestamp of the first buffer after
+ * a restore. The timestamp saved in the snapshot is that of the next
+ * sample expected, so the difference is the time the decoder was down.
+ * The sample counters are advanced over the gap as if the samples had
+ * been there, and the seconds state machine is advanced one second for
+ * each second missed, carrying the decoding matrix over each minute as
+ * wwv_rsec() would. Nothing is averaged into the integrators for the
+ * missing seconds. The filters and the second sync then pick up the
+ * signal again within a few seconds.
+ */
+static void wwv_resume(struct wwvunit *up, l_fp recv_time)
+{
+	l_fp	ltemp;
+	double	dtemp;
+	long	n, m, nsec;
+
+	up->restore = 0;
+	ltemp = recv_time;
+	L_SUB(&ltemp, &up->timestamp);
+	LFPTOD(&ltemp, dtemp);
+	if (dtemp < 0 || dtemp > SNAPAGE) {
+		wwv_newgame(up);
+		return;
+	}
+	n = (long)(dtemp * SECOND + .5);
+
+	/*
+	 * Count the minute and second epochs crossed.
+	 */
+	m = up->mphase;
+	up->watch += (m + n) / MINUTE;
+	m += SECOND - up->repoch;
+	nsec = (m + n) / SECOND - m / SECOND;
+	up->mphase = (up->mphase + n) % MINUTE;
+	up->rphase = (up->mphase - up->repoch + SECOND) % SECOND;
+	up->datapt = (up->datapt + (n % 80) * IN100) % 80;
+	if (!(up->status & MSYNC))
+		return;
+
+	while (nsec-- > 0) {
+		if ((up->rsec == 59 && !(up->status & LEPSEC)) ||
+		    up->rsec >= 60) {
+			up->status &= ~LEPSEC;
+			wwv_tsec(up);
+			up->rsec = 0;
+		} else {
+			up->rsec++;
+		}
+	}
+}
+
 /*
  * wwv_shutdown - shut down the clock
  */
 void wwv_shutdown(int unit, struct wwvunit *up)
 {
+    int i;
+
     if (up) {
+	    if (up->multi) {
+		    pool_destroy(up->multi->pool);
+		    for (i = 0; i < NCHAN; i++)
+			    free(up->multi->probe[i]);
+		    free(up->multi);
+	    }
+	    if (up->acq) {
+		    free(up->acq->env[0]);
+		    free(up->acq);
+	    }
+	    free(up->tlm);
+	    up->tlm = NULL;
+	    free(up->dsp);
 	    free(up);
     }
 }
@@ -739,67 +1169,461 @@ void wwv_shutdown(int unit, struct wwvunit *up)
  * track the A/D sample clock by dropping or duplicating codec samples.
  * It also controls the A/D signal level with an AGC loop to mimimize
  * quantization noise and avoid overload.
+ *
+ * The buffer is processed in blocks of up to BLKSIZ samples. Each block
+ * is clipped, resampled by the VFO and run through the filters and
+ * sync mixers in separate passes, then the demodulator is cranked once
+ * for each logical clock sample. The clipper and mixers are vector
+ * kernels. A block never extends past the end of the logical second,
+ * since that is where the FLL in wwv_endpoc() changes the VFO
+ * frequency, so the results are the same as feeding wwv_rf() one
+ * sample at a time. The exception is wwv_newgame(), which resets the
+ * frequency at an arbitrary time; in that case the rest of the second
+ * is resampled at the old frequency, which makes no difference to a
+ * decoder that has just restarted.
  */
 void wwv_receive(struct wwvunit *up, int16_t *recv_buffer, unsigned int recv_length, l_fp recv_time)
 {
-	/*
-	 * Local variables
-	 */
-	float sample;		/* codec sample */
-	uint32_t bufcnt;		/* buffer counter */
-	l_fp	ltemp;
+	struct wwvdsp *dp = up->dsp;
+	uint32_t bufcnt;	/* buffer counter */
+	unsigned int nin;	/* codec samples in block */
+	unsigned int nout;	/* logical clock samples in block */
 
 	/*
 	 * Main loop - read until there ain't no more. Note codec
 	 * samples are bit-inverted.
 	 */
-	DTOLFP((double)recv_length / SECOND, &ltemp);
-	//L_SUB(&recv_time, &ltemp);
+	if (up->restore)
+		wwv_resume(up, recv_time);
+	up->timestamp = recv_time;
+	for (bufcnt = 0; bufcnt < recv_length; bufcnt += nin) {
+		nin = recv_length - bufcnt;
+		if (nin > BLKSIZ)
+			nin = BLKSIZ;
+		nout = wwv_vfo(up, dp->xidx, nin, &nin);
+		wwv_block(up, &recv_buffer[bufcnt], nin, nout);
+	}
+}
+
+/*
+ * wwv_block - process one block of codec samples
+ *
+ * The VFO has already mapped the nout logical clock samples of the
+ * block to the nin codec samples in dp->xidx.
+ */
+static void wwv_block(struct wwvunit *up, const int16_t *buf, unsigned int nin, unsigned int nout)
+{
+	struct wwvdsp *dp = up->dsp;
+	unsigned int i, j;
+
+	/*
+	 * Clip noise spikes greater than MAXAMP (6000) and record the
+	 * number of clips to be used later by the AGC.
+	 */
+	up->clipcnt += wwv_clip(dp->xin, buf, nin);
+
+	/*
+	 * Filter the resampled block and mix the sync signals to
+	 * baseband.
+	 */
+	for (i = 0; i < nout; i++) {
+		dp->data[i] = wwv_lpf(dp->lpf, dp->xin[dp->xidx[i]]);
+		dp->syncx[i] = wwv_bpf(dp->bpf, dp->xin[dp->xidx[i]]);
+	}
+	wwv_mix(dp->mix[0], 2 * BLKSIZ, dp->syncx, &dp->mixpha, nout);
+
+	/*
+	 * Crank the demodulator. The timestamp is advanced once for
+	 * each codec sample, including those dropped by the VFO.
+	 */
+	j = 0;
+	for (i = 0; i < nout; i++) {
+		for (; j < dp->xidx[i]; j++)
+			L_ADD(&up->timestamp, &up->tick);
+		wwv_demod(up, i);
+	}
+	for (; j < nin; j++)
+		L_ADD(&up->timestamp, &up->tick);
+}
+
+/*
+ * wwv_multi - switch the unit to multi-stream mode
+ *
+ * This routine allocates a probe for each channel and a pool of
+ * nthreads threads to run them. From then on the unit is fed with
+ * wwv_receive_multi(). Not available with batch acquisition. Returns 0
+ * if successful, -1 if not.
+ */
+int wwv_multi(struct wwvunit *up, unsigned int nthreads)
+{
+	struct wwvmulti *mp;
+	int i;
+
+	if (up->acq != NULL)
+		return (-1);
+	if (!(mp = (struct wwvmulti *)calloc(1, sizeof(struct wwvmulti))))
+		return (-1);
+	for (i = 0; i < NCHAN; i++) {
+		if (!(mp->probe[i] = (struct wwvprobe *)calloc(1,
+		    sizeof(struct wwvprobe))))
+			goto fail;
+	}
+	if (!(mp->pool = pool_create(nthreads)))
+		goto fail;
+	up->multi = mp;
+	up->achan = up->dchan;
+	return (0);
+
+fail:
+	for (i = 0; i < NCHAN; i++)
+		free(mp->probe[i]);
+	free(mp);
+	return (-1);
+}
+
+/*
+ * wwv_receive_multi - receive data from all channels at once
+ *
+ * This routine is the multi-stream version of wwv_receive(). There is
+ * one buffer of recv_length samples for each qsy[] frequency, all
+ * sampled by the same clock; a NULL buffer means that channel is not
+ * available. The buffer for the active channel (achan) feeds the main
+ * decoder exactly as in single-stream mode. Before that, the probes run
+ * the minute sync filters for every channel on the pool threads, one
+ * segment at a time. The main decoder then runs wwv_qrz() on all of
+ * them sample by sample, so wwv_newchan() can pick the best channel
+ * after the first minute rather than scanning them in turn.
+ *
+ * The probes run only while minute sync is being acquired, as wwv_qrz()
+ * does in single-stream mode.
+ */
+void wwv_receive_multi(struct wwvunit *up, int16_t *recv_buffer[NCHAN], unsigned int recv_length, l_fp recv_time)
+{
+	struct wwvdsp *dp = up->dsp;
+	struct wwvmulti *mp = up->multi;
+	uint32_t bufcnt;	/* buffer counter */
+	unsigned int nin;	/* codec samples in segment */
+	unsigned int nout;	/* logical clock samples in segment */
+	unsigned int i, k, m, n;
+
+	if (recv_buffer[up->achan] == NULL) {
+		for (i = 0; i < NCHAN && recv_buffer[i] == NULL; i++);
+		if (i == NCHAN)
+			return;
+		up->achan = i;
+	}
+	if (up->restore)
+		wwv_resume(up, recv_time);
 	up->timestamp = recv_time;
-	for (bufcnt = 0; bufcnt < recv_length; bufcnt++) {
-		sample = ((float)recv_buffer[bufcnt]);
+	for (bufcnt = 0; bufcnt < recv_length; bufcnt += nin) {
+		nin = recv_length - bufcnt;
+		if (nin > SECOND)
+			nin = SECOND;
+		nout = wwv_vfo(up, mp->xidx, nin, &nin);
 
 		/*
-		 * Clip noise spikes greater than MAXAMP (6000) and
-		 * record the number of clips to be used later by the
-		 * AGC.
+		 * Run the probes over the segment.
 		 */
-		if (sample > MAXAMP) {
-			sample = MAXAMP;
-			up->clipcnt++;
-		} else if (sample < -MAXAMP) {
-			sample = -MAXAMP;
-			up->clipcnt++;
+		mp->valid = !(up->status & MSYNC);
+		mp->next = 0;
+		if (mp->valid) {
+			for (i = 0; i < NCHAN; i++)
+				mp->seg[i] = recv_buffer[i] != NULL ?
+				    &recv_buffer[i][bufcnt] : NULL;
+			mp->nin = nin;
+			mp->nout = nout;
+			pool_run(mp->pool, wwv_probe, up, NCHAN);
 		}
 
 		/*
-		 * Variable frequency oscillator. The codec oscillator
-		 * runs at the nominal rate of 8000 samples per second,
-		 * or 125 us per sample. A frequency change of one unit
-		 * results in either duplicating or deleting one sample
-		 * per second, which results in a frequency change of
-		 * 125 PPM.
+		 * Feed the segment to the main decoder in blocks. The
+		 * active channel changes only at the minute epoch, which
+		 * is the last sample of a segment.
 		 */
+		k = 0;
+		for (i = 0; i < nin; i += m) {
+			m = nin - i;
+			if (m > BLKSIZ)
+				m = BLKSIZ;
+			for (n = 0; k < nout && mp->xidx[k] < i + m; n++, k++)
+				dp->xidx[n] = mp->xidx[k] - i;
+			wwv_block(up, &recv_buffer[up->achan][bufcnt + i], m,
+			    n);
+		}
+	}
+}
+
+/*
+ * wwv_probe - run the minute sync filters for one channel
+ *
+ * This routine runs on a pool thread. It touches only its own probe
+ * context and the read-only segment description and tables, and leaves
+ * the amplitudes for wwv_probe_qrz().
+ */
+static void wwv_probe(void *arg, unsigned int chan)
+{
+	struct wwvunit *up = arg;
+	struct wwvmulti *mp = up->multi;
+	struct wwvprobe *pr = mp->probe[chan];
+	float	ci, cq, hi, hq;	/* mixer outputs */
+	unsigned int i;
+
+	if (mp->seg[chan] == NULL)
+		return;
+
+	/*
+	 * The clip count is not used, since the codec gain applies
+	 * only to the stream for the active channel.
+	 */
+	wwv_clip(pr->xin, mp->seg[chan], mp->nin);
+	for (i = 0; i < mp->nout; i++)
+		pr->syncx[i] = wwv_bpf(pr->bpf, pr->xin[mp->xidx[i]]);
+	wwv_mix(pr->mix[0], SEGSIZ, pr->syncx, &pr->mixpha, mp->nout);
+	for (i = 0; i < mp->nout; i++) {
+		ci = pr->mix[0][i];
+		cq = pr->mix[1][i];
+		hi = pr->mix[2][i];
+		hq = pr->mix[3][i];
+		pr->ciamp -= pr->cibuf[pr->jptr];
+		pr->cibuf[pr->jptr] = ci;
+		pr->ciamp += ci;
+		pr->cqamp -= pr->cqbuf[pr->jptr];
+		pr->cqbuf[pr->jptr] = cq;
+		pr->cqamp += cq;
+		pr->hiamp -= pr->hibuf[pr->jptr];
+		pr->hibuf[pr->jptr] = hi;
+		pr->hiamp += hi;
+		pr->hqamp -= pr->hqbuf[pr->jptr];
+		pr->hqbuf[pr->jptr] = hq;
+		pr->hqamp += hq;
+		pr->jptr = (pr->jptr + 1) % SYNSIZ;
+		pr->wamp[i] = sqrtf(pr->ciamp * pr->ciamp + pr->cqamp *
+		    pr->cqamp) / SYNCYC;
+		pr->hamp[i] = sqrtf(pr->hiamp * pr->hiamp + pr->hqamp *
+		    pr->hqamp) / SYNCYC;
+	}
+}
+
+/*
+ * wwv_probe_qrz - run the minute sync discriminators for all channels
+ *
+ * This routine is called by the demodulator once per logical clock
+ * sample in place of the wwv_qrz() calls for the active channel. If
+ * minute sync is lost in the middle of a segment, the probes did not
+ * run and the rest of the segment is skipped.
+ */
+static void wwv_probe_qrz(struct wwvunit *up)
+{
+	struct wwvmulti *mp = up->multi;
+	struct sync *sp;
+	unsigned int i;
+	int	chan;
+
+	i = mp->next++;
+	if (!mp->valid || (up->status & MSYNC))
+		return;
+	for (chan = 0; chan < NCHAN; chan++) {
+		if (mp->seg[chan] == NULL)
+			continue;
+		sp = &up->mitig[chan].wwv;
+		sp->amp = mp->probe[chan]->wamp[i];
+		wwv_qrz(up, sp, (int)(up->fudgetime1 * SECOND));
+		sp = &up->mitig[chan].wwvh;
+		sp->amp = mp->probe[chan]->hamp[i];
+		wwv_qrz(up, sp, (int)(up->fudgetime2 * SECOND));
+	}
+}
+
+/*
+ * wwv_vfo - variable frequency oscillator
+ *
+ * The codec oscillator runs at the nominal rate of 8000 samples per
+ * second, or 125 us per sample. A frequency change of one unit results
+ * in either duplicating or deleting one sample per second, which
+ * results in a frequency change of 125 PPM.
+ *
+ * This routine runs the VFO over at most avail codec samples and
+ * stores the index of the codec sample for each logical clock sample in
+ * xidx. It stops after the codec sample that completes the logical
+ * second, since the frequency may change there, so xidx must have room
+ * for avail + 1 entries and never more than SECOND + 1. It returns the
+ * number of logical clock samples and stores the number of codec
+ * samples consumed.
+ */
+static unsigned int wwv_vfo(struct wwvunit *up, unsigned short *xidx, unsigned int avail, unsigned int *nin)
+{
+	unsigned int left;	/* samples left in the second */
+	unsigned int i, n;
+
+	left = SECOND - up->mphase % SECOND;
+	n = 0;
+	for (i = 0; i < avail && n < left; i++) {
 		up->phase += (up->freq + CLOCK_CODEC_OFFSET) / SECOND;
 		if (up->phase >= .5) {
 			up->phase -= 1.;
 		} else if (up->phase < -.5) {
 			up->phase += 1.;
-			wwv_rf(up, sample);
-			wwv_rf(up, sample);
+			xidx[n++] = i;
+			xidx[n++] = i;
 		} else {
-			wwv_rf(up, sample);
+			xidx[n++] = i;
 		}
-		L_ADD(&up->timestamp, &up->tick);
 	}
+	*nin = i;
+	return (n);
 }
 
-static void memzero_float(float *data, unsigned int len)
+/*
+ * wwv_clip - convert and clip codec samples
+ *
+ * This routine converts the codec samples to float, clips them at
+ * MAXAMP and returns the number of clips.
+ */
+SIMD_CLONES static unsigned int wwv_clip(float *out, const int16_t *in, unsigned int n)
 {
+	v8sf	x, hi, lo;
+	v8si	over, under, nclip;
+	unsigned int clipcnt;
 	unsigned int i;
-	for (i = 0; i < (len/sizeof(float)); i++) {
-		data[i] = 0.0f;
+
+	hi = v8sf_set1(MAXAMP);
+	lo = v8sf_set1(-MAXAMP);
+	nclip = (v8si){0};
+	for (i = 0; i + VLEN <= n; i += VLEN) {
+		x = __builtin_convertvector(v8hi_load(&in[i]), v8sf);
+		over = x > hi;
+		under = x < lo;
+		x = v8sf_select(over, hi, v8sf_select(under, lo, x));
+		nclip -= over | under;
+		v8sf_store(&out[i], x);
+	}
+	clipcnt = v8si_hsum(nclip);
+	for (; i < n; i++) {
+		out[i] = in[i];
+		if (out[i] > MAXAMP) {
+			out[i] = MAXAMP;
+			clipcnt++;
+		} else if (out[i] < -MAXAMP) {
+			out[i] = -MAXAMP;
+			clipcnt++;
+		}
 	}
+	return (clipcnt);
+}
+
+/*
+ * wwv_mix - block sync mixer
+ *
+ * This routine multiplies a block of bpf output samples by the 1000-Hz
+ * and 1200-Hz quadrature sinusoids, starting at the mixer phase in
+ * *mixpha. The four outputs are stored stride floats apart in the order
+ * of the mixer table rows.
+ */
+SIMD_CLONES static void wwv_mix(float *mix, unsigned int stride, const float *syncx, int *mixpha, unsigned int n)
+{
+	v8sf	x;
+	unsigned int k;		/* mixer phase */
+	unsigned int i, j;
+
+	k = *mixpha;
+	for (i = 0; i + VLEN <= n; i += VLEN) {
+		x = v8sf_load(&syncx[i]);
+		for (j = 0; j < 4; j++)
+			v8sf_store(&mix[j * stride + i], x *
+			    v8sf_load(&mixtab[j][k]));
+		k += VLEN;
+		if (k >= MIXPER)
+			k -= MIXPER;
+	}
+	for (; i < n; i++) {
+		for (j = 0; j < 4; j++)
+			mix[j * stride + i] = mixtab[j][k] * syncx[i];
+		k = (k + 1) % MIXPER;
+	}
+	*mixpha = k;
+}
+
+/*
+ * wwv_mixinit - initialize the mixer table
+ *
+ * Rows 0 and 1 are the 1000-Hz sine and cosine, and rows 2 and 3 the
+ * 1200-Hz sine and cosine, at each of the MIXPER phases. They are
+ * scaled to produce unit energy at the maximum value of the matched
+ * filters. Each row is extended by one vector, so the block mixer can
+ * load VLEN consecutive phases starting anywhere in the period. It is
+ * called once, by the first wwv_start(); rebuilding it for each unit
+ * would write it while other units mix from it.
+ */
+static void wwv_mixinit(void)
+{
+	int	i, j;
+
+	for (i = 0; i < MIXPER + VLEN; i++) {
+		j = i % MIXPER;
+		mixtab[0][i] = sintab[(j * IN1000) % 80] / (MS / 2.);
+		mixtab[1][i] = sintab[(j * IN1000 + 20) % 80] / (MS / 2.);
+		mixtab[2][i] = sintab[(j * IN1200) % 80] / (MS / 2.);
+		mixtab[3][i] = sintab[(j * IN1200 + 20) % 80] / (MS / 2.);
+	}
+}
+
+/*
+ * wwv_lpf - data lowpass filter
+ *
+ * Baseband data demodulation. The 100-Hz subcarrier is extracted using
+ * a 150-Hz IIR lowpass filter. This attenuates the 1000/1200-Hz sync
+ * signals, as well as the 440-Hz and 600-Hz tones and most of the noise
+ * and voice modulation components.
+ *
+ * The subcarrier is transmitted 10 dB down from the carrier. The DGAIN
+ * parameter can be adjusted for this and to compensate for the radio
+ * audio response at 100 Hz.
+ *
+ * Matlab IIR 4th-order IIR elliptic, 150 Hz lowpass, 0.2 dB passband
+ * ripple, -50 dB stopband ripple, phase delay 0.97 ms.
+ */
+static inline float wwv_lpf(float *lpf, float isig)
+{
+	float	data;		/* lpf output */
+
+	data  = (lpf[4] = lpf[3]) *  0.8360961f;
+	data += (lpf[3] = lpf[2]) * -3.481740f;
+	data += (lpf[2] = lpf[1]) *  5.452988f;
+	data += (lpf[1] = lpf[0]) * -3.807229f;
+	lpf[0] = isig * DGAIN - data;
+	return ((lpf[0] + lpf[4]) * 3.281435e-03f - (lpf[1] + lpf[3]) * 1.149947e-02f + lpf[2] * 1.654858e-02f);
+}
+
+/*
+ * wwv_bpf - sync bandpass filter
+ *
+ * Baseband sync demodulation. The 1000/1200 sync signals are extracted
+ * using a 600-Hz IIR bandpass filter. This removes the 100-Hz data
+ * subcarrier, as well as the 440-Hz and 600-Hz tones and most of the
+ * noise and voice modulation components.
+ *
+ * Matlab 4th-order IIR elliptic, 800-1400 Hz bandpass, 0.2 dB passband
+ * ripple, -50 dB stopband ripple, phase delay 0.91 ms.
+ */
+static inline float wwv_bpf(float *bpf, float isig)
+{
+	float	syncx;		/* bpf output */
+
+	syncx = (bpf[8] = bpf[7]) * 0.4897278f;
+	syncx += (bpf[7] = bpf[6]) * -2.765914f;
+	syncx += (bpf[6] = bpf[5]) * 8.110921f;
+	syncx += (bpf[5] = bpf[4]) * -15.17732f;
+	syncx += (bpf[4] = bpf[3]) * 19.75197f;
+	syncx += (bpf[3] = bpf[2]) * -18.14365f;
+	syncx += (bpf[2] = bpf[1]) * 11.59783f;
+	syncx += (bpf[1] = bpf[0]) * -4.735040f;
+	bpf[0] = isig - syncx;
+	syncx = (bpf[0] + bpf[8]) * 8.203628e-03
+	      + (bpf[1] + bpf[7]) * -2.375732e-02
+	      + (bpf[2] + bpf[6]) * 3.353214e-02
+	      + (bpf[3] + bpf[5]) * -4.080258e-02
+	      +  bpf[4] * 4.605479e-02;
+	return (syncx);
 }
 
 /*
@@ -810,6 +1634,26 @@ static void memzero_float(float *data, unsigned int len)
  * quadrature phase. The routine also determines the minute synch epoch,
  * as well as certain signal maxima, minima and related values.
  *
+ * This is the one-sample-at-a-time version of the block passes in
+ * wwv_receive(). It filters the sample, mixes the sync signal to
+ * baseband and cranks the demodulator.
+ */
+void wwv_rf(struct wwvunit *up, float isig)
+{
+	struct wwvdsp *dp = up->dsp;
+
+	dp->data[0] = wwv_lpf(dp->lpf, isig);
+	dp->syncx[0] = wwv_bpf(dp->bpf, isig);
+	wwv_mix(dp->mix[0], 2 * BLKSIZ, dp->syncx, &dp->mixpha, 1);
+	wwv_demod(up, 0);
+}
+
+/*
+ * wwv_demod - demodulate baseband signals
+ *
+ * This routine processes logical clock sample k of the block buffers,
+ * which hold the filtered data signal and the mixed sync signals.
+ *
  * There are two 1-s ramps used by this program. Both count the 8000
  * logical clock samples spanning exactly one second. The epoch ramp
  * counts the samples starting at an arbitrary time. The rphase ramp
@@ -832,94 +1676,23 @@ static void memzero_float(float *data, unsigned int len)
  * as required for the WWV second sync signal (5 cycles at 1000 Hz) and
  * WWVH second sync signal (6 cycles at 1200 Hz).
  */
-void wwv_rf(struct wwvunit *up, float isig)
+static void wwv_demod(struct wwvunit *up,
+	unsigned int k		/* block sample index */
+	)
 {
+	struct wwvdsp *dp = up->dsp;
 	struct sync *sp, *rp;
-
-	static float lpf[5];	/* 150-Hz lpf delay line */
-	float data;		/* lpf output */
-	static float bpf[9];	/* 1000/1200-Hz bpf delay line */
-	float syncx;		/* bpf output */
-	static float mf[41];	/* 1000/1200-Hz mf delay line */
-	float mfsync;		/* mf output */
-
-	static int iptr;	/* data channel pointer */
-	static float ibuf[DATSIZ]; /* data I channel delay line */
-	static float qbuf[DATSIZ]; /* data Q channel delay line */
-
-	static int jptr;	/* sync channel pointer */
-	static int kptr;	/* tick channel pointer */
-
-	static int csinptr;	/* wwv channel phase */
-	static float cibuf[SYNSIZ]; /* wwv I channel delay line */
-	static float cqbuf[SYNSIZ]; /* wwv Q channel delay line */
-	static float ciamp;	/* wwv I channel amplitude */
-	static float cqamp;	/* wwv Q channel amplitude */
-
-	static float csibuf[TCKSIZ]; /* wwv I tick delay line */
-	static float csqbuf[TCKSIZ]; /* wwv Q tick delay line */
-	static float csiamp;	/* wwv I tick amplitude */
-	static float csqamp;	/* wwv Q tick amplitude */
-
-	static int hsinptr;	/* wwvh channel phase */
-	static float hibuf[SYNSIZ]; /* wwvh I channel delay line */
-	static float hqbuf[SYNSIZ]; /* wwvh Q channel delay line */
-	static float hiamp;	/* wwvh I channel amplitude */
-	static float hqamp;	/* wwvh Q channel amplitude */
-
-	static float hsibuf[TCKSIZ]; /* wwvh I tick delay line */
-	static float hsqbuf[TCKSIZ]; /* wwvh Q tick delay line */
-	static float hsiamp;	/* wwvh I tick amplitude */
-	static float hsqamp;	/* wwvh Q tick amplitude */
-
-	static float epobuf[SECOND]; /* second sync comb filter */
-	static float epomax, nxtmax; /* second sync amplitude buffer */
-	static int epopos;	/* epoch second sync position buffer */
-
-	static int iniflg;	/* initialization flag */
+	float	data = dp->data[k]; /* lpf output */
+	float	ci = dp->mix[0][k]; /* wwv I mixer output */
+	float	cq = dp->mix[1][k]; /* wwv Q mixer output */
+	float	hi = dp->mix[2][k]; /* wwvh I mixer output */
+	float	hq = dp->mix[3][k]; /* wwvh Q mixer output */
+	float	mfsync;		/* mf output */
 	int	epoch;		/* comb filter index */
+	int	acq;		/* batch acquisition active */
 	float	dtemp;
 	int	i;
 
-	if (!iniflg) {
-		iniflg = 1;
-		lpf[4] = lpf[3] = lpf[2] = lpf[1] = lpf[0] = 0.0f;
-		bpf[8] = bpf[7] = bpf[6] = bpf[5] = bpf[4] = bpf[3] = bpf[2] = bpf[1] = bpf[0] = 0.0f;
-		memzero_float(mf, sizeof(mf));
-		memzero_float(ibuf, sizeof(ibuf));
-		memzero_float(qbuf, sizeof(qbuf));
-		memzero_float(cibuf, sizeof(cibuf));
-		memzero_float(cqbuf, sizeof(cqbuf));
-		memzero_float(csibuf, sizeof(csibuf));
-		memzero_float(csqbuf, sizeof(csqbuf));
-		memzero_float(hibuf, sizeof(hibuf));
-		memzero_float(hqbuf, sizeof(hqbuf));
-		memzero_float(hsibuf, sizeof(hsibuf));
-		memzero_float(hsqbuf, sizeof(hsqbuf));
-		memzero_float(epobuf, sizeof(epobuf));
-	}
-
-	/*
-	 * Baseband data demodulation. The 100-Hz subcarrier is
-	 * extracted using a 150-Hz IIR lowpass filter. This attenuates
-	 * the 1000/1200-Hz sync signals, as well as the 440-Hz and
-	 * 600-Hz tones and most of the noise and voice modulation
-	 * components.
-	 *
-	 * The subcarrier is transmitted 10 dB down from the carrier.
-	 * The DGAIN parameter can be adjusted for this and to
-	 * compensate for the radio audio response at 100 Hz.
-	 *
-	 * Matlab IIR 4th-order IIR elliptic, 150 Hz lowpass, 0.2 dB
-	 * passband ripple, -50 dB stopband ripple, phase delay 0.97 ms.
-	 */
-	data  = (lpf[4] = lpf[3]) *  0.8360961f;
-	data += (lpf[3] = lpf[2]) * -3.481740f;
-	data += (lpf[2] = lpf[1]) *  5.452988f;
-	data += (lpf[1] = lpf[0]) * -3.807229f;
-	lpf[0] = isig * DGAIN - data;
-	data = (lpf[0] + lpf[4]) * 3.281435e-03f - (lpf[1] + lpf[3]) * 1.149947e-02f + lpf[2] * 1.654858e-02f;
-
 	/*
 	 * The 100-Hz data signal is demodulated using a pair of
 	 * quadrature multipliers, matched filters and a phase lock
@@ -933,40 +1706,16 @@ void wwv_rf(struct wwvunit *up, float isig)
 	i = up->datapt;
 	up->datapt = (up->datapt + IN100) % 80;
 	dtemp = sintab[i] * data / (MS / 2. * DATCYC);
-	up->irig -= ibuf[iptr];
-	ibuf[iptr] = dtemp;
+	up->irig -= dp->ibuf[dp->iptr];
+	dp->ibuf[dp->iptr] = dtemp;
 	up->irig += dtemp;
 
 	i = (i + 20) % 80;
 	dtemp = sintab[i] * data / (MS / 2. * DATCYC);
-	up->qrig -= qbuf[iptr];
-	qbuf[iptr] = dtemp;
+	up->qrig -= dp->qbuf[dp->iptr];
+	dp->qbuf[dp->iptr] = dtemp;
 	up->qrig += dtemp;
-	iptr = (iptr + 1) % DATSIZ;
-
-	/*
-	 * Baseband sync demodulation. The 1000/1200 sync signals are
-	 * extracted using a 600-Hz IIR bandpass filter. This removes
-	 * the 100-Hz data subcarrier, as well as the 440-Hz and 600-Hz
-	 * tones and most of the noise and voice modulation components.
-	 *
-	 * Matlab 4th-order IIR elliptic, 800-1400 Hz bandpass, 0.2 dB
-	 * passband ripple, -50 dB stopband ripple, phase delay 0.91 ms.
-	 */
-	syncx = (bpf[8] = bpf[7]) * 0.4897278f;
-	syncx += (bpf[7] = bpf[6]) * -2.765914f;
-	syncx += (bpf[6] = bpf[5]) * 8.110921f;
-	syncx += (bpf[5] = bpf[4]) * -15.17732f;
-	syncx += (bpf[4] = bpf[3]) * 19.75197f;
-	syncx += (bpf[3] = bpf[2]) * -18.14365f;
-	syncx += (bpf[2] = bpf[1]) * 11.59783f;
-	syncx += (bpf[1] = bpf[0]) * -4.735040f;
-	bpf[0] = isig - syncx;
-	syncx = (bpf[0] + bpf[8]) * 8.203628e-03
-	      + (bpf[1] + bpf[7]) * -2.375732e-02
-	      + (bpf[2] + bpf[6]) * 3.353214e-02
-	      + (bpf[3] + bpf[5]) * -4.080258e-02
-	      +  bpf[4] * 4.605479e-02;
+	dp->iptr = (dp->iptr + 1) % DATSIZ;
 
 	/*
 	 * The 1000/1200 sync signals are demodulated using a pair of
@@ -992,62 +1741,75 @@ void wwv_rf(struct wwvunit *up, float isig)
 	epoch = up->mphase % SECOND;
 
 	/*
-	 * WWV
+	 * While the batch acquisition engine is looking for the minute
+	 * sync pulse, it takes the place of the 800-ms matched filters
+	 * and wwv_qrz(). The second sync filters run as usual.
 	 */
-	i = csinptr;
-	csinptr = (csinptr + IN1000) % 80;
-
-	dtemp = sintab[i] * syncx / (MS / 2.);
-	ciamp -= cibuf[jptr];
-	cibuf[jptr] = dtemp;
-	ciamp += dtemp;
-	csiamp -= csibuf[kptr];
-	csibuf[kptr] = dtemp;
-	csiamp += dtemp;
+	acq = up->acq != NULL && up->multi == NULL &&
+	    !(up->status & MSYNC);
 
-	i = (i + 20) % 80;
-	dtemp = sintab[i] * syncx / (MS / 2.);
-	cqamp -= cqbuf[jptr];
-	cqbuf[jptr] = dtemp;
-	cqamp += dtemp;
-	csqamp -= csqbuf[kptr];
-	csqbuf[kptr] = dtemp;
-	csqamp += dtemp;
+	/*
+	 * WWV
+	 */
+	if (!acq) {
+		dp->ciamp -= dp->cibuf[dp->jptr];
+		dp->cibuf[dp->jptr] = ci;
+		dp->ciamp += ci;
+		dp->cqamp -= dp->cqbuf[dp->jptr];
+		dp->cqbuf[dp->jptr] = cq;
+		dp->cqamp += cq;
+	}
+	dp->csiamp -= dp->csibuf[dp->kptr];
+	dp->csibuf[dp->kptr] = ci;
+	dp->csiamp += ci;
+	dp->csqamp -= dp->csqbuf[dp->kptr];
+	dp->csqbuf[dp->kptr] = cq;
+	dp->csqamp += cq;
 
 	sp = &up->mitig[up->achan].wwv;
-	sp->amp = sqrtf(ciamp * ciamp + cqamp * cqamp) / SYNCYC;
-	if (!(up->status & MSYNC))
-		wwv_qrz(up, sp, (int)(up->fudgetime1 * SECOND));
+	if (!acq) {
+		sp->amp = sqrtf(dp->ciamp * dp->ciamp + dp->cqamp *
+		    dp->cqamp) / SYNCYC;
+		if (!(up->status & MSYNC) && up->multi == NULL)
+			wwv_qrz(up, sp, (int)(up->fudgetime1 * SECOND));
+	}
 
 	/*
 	 * WWVH
 	 */
-	i = hsinptr;
-	hsinptr = (hsinptr + IN1200) % 80;
-
-	dtemp = sintab[i] * syncx / (MS / 2.);
-	hiamp -= hibuf[jptr];
-	hibuf[jptr] = dtemp;
-	hiamp += dtemp;
-	hsiamp -= hsibuf[kptr];
-	hsibuf[kptr] = dtemp;
-	hsiamp += dtemp;
-
-	i = (i + 20) % 80;
-	dtemp = sintab[i] * syncx / (MS / 2.);
-	hqamp -= hqbuf[jptr];
-	hqbuf[jptr] = dtemp;
-	hqamp += dtemp;
-	hsqamp -= hsqbuf[kptr];
-	hsqbuf[kptr] = dtemp;
-	hsqamp += dtemp;
+	if (!acq) {
+		dp->hiamp -= dp->hibuf[dp->jptr];
+		dp->hibuf[dp->jptr] = hi;
+		dp->hiamp += hi;
+		dp->hqamp -= dp->hqbuf[dp->jptr];
+		dp->hqbuf[dp->jptr] = hq;
+		dp->hqamp += hq;
+	}
+	dp->hsiamp -= dp->hsibuf[dp->kptr];
+	dp->hsibuf[dp->kptr] = hi;
+	dp->hsiamp += hi;
+	dp->hsqamp -= dp->hsqbuf[dp->kptr];
+	dp->hsqbuf[dp->kptr] = hq;
+	dp->hsqamp += hq;
 
 	rp = &up->mitig[up->achan].wwvh;
-	rp->amp = sqrtf(hiamp * hiamp + hqamp * hqamp) / SYNCYC;
-	if (!(up->status & MSYNC))
-		wwv_qrz(up, rp, (int)(up->fudgetime2 * SECOND));
-	jptr = (jptr + 1) % SYNSIZ;
-	kptr = (kptr + 1) % TCKSIZ;
+	if (!acq) {
+		rp->amp = sqrtf(dp->hiamp * dp->hiamp + dp->hqamp *
+		    dp->hqamp) / SYNCYC;
+		if (!(up->status & MSYNC) && up->multi == NULL)
+			wwv_qrz(up, rp, (int)(up->fudgetime2 * SECOND));
+	}
+	dp->jptr = (dp->jptr + 1) % SYNSIZ;
+	dp->kptr = (dp->kptr + 1) % TCKSIZ;
+	if (acq)
+		wwv_acq(up, ci, cq, hi, hq);
+
+	/*
+	 * In multi-stream mode the probes cover all channels, including
+	 * the active one.
+	 */
+	if (up->multi != NULL)
+		wwv_probe_qrz(up);
 
 	/*
 	 * The following section is called once per minute. It does
@@ -1108,9 +1870,9 @@ void wwv_rf(struct wwvunit *up, float isig)
 	 * only if the station has been reliably determined.
 	 */
 	if (up->status & SELV)
-		mfsync = sqrtf(csiamp * csiamp + csqamp * csqamp) / TCKCYC;
+		mfsync = sqrtf(dp->csiamp * dp->csiamp + dp->csqamp * dp->csqamp) / TCKCYC;
 	else if (up->status & SELH)
-		mfsync = sqrtf(hsiamp * hsiamp + hsqamp * hsqamp) / TCKCYC;
+		mfsync = sqrtf(dp->hsiamp * dp->hsiamp + dp->hsqamp * dp->hsqamp) / TCKCYC;
 	else
 		mfsync = 0;
 
@@ -1125,27 +1887,27 @@ void wwv_rf(struct wwvunit *up, float isig)
 	 * SNR should plummet. The signal is scaled to produce unit
 	 * energy at the maximum value.
 	 */
-	dtemp = (epobuf[epoch] += (mfsync - epobuf[epoch]) / up->avgint);
-	if (dtemp > epomax) {
+	dtemp = (dp->epobuf[epoch] += (mfsync - dp->epobuf[epoch]) / up->avgint);
+	if (dtemp > dp->epomax) {
 		int	j;
 
-		epomax = dtemp;
-		epopos = epoch;
+		dp->epomax = dtemp;
+		dp->epopos = epoch;
 		j = epoch - 6 * MS;
 		if (j < 0)
 			j += SECOND;
-		nxtmax = fabsf(epobuf[j]);
+		dp->nxtmax = fabsf(dp->epobuf[j]);
 	}
 	if (epoch == 0) {
-		up->epomax = epomax;
-		up->eposnr = wwv_snr(epomax, nxtmax);
-		epopos -= TCKCYC * MS;
-		if (epopos < 0)
-			epopos += SECOND;
-		wwv_endpoc(up, epopos);
+		up->epomax = dp->epomax;
+		up->eposnr = wwv_snr(dp->epomax, dp->nxtmax);
+		dp->epopos -= TCKCYC * MS;
+		if (dp->epopos < 0)
+			dp->epopos += SECOND;
+		wwv_endpoc(up, dp->epopos);
 		if (!(up->status & SSYNC))
 			up->alarm |= SYNERR;
-		epomax = 0;
+		dp->epomax = 0;
 		if (!(up->status & MSYNC))
 			wwv_gain(up);
 	}
@@ -1176,8 +1938,6 @@ void wwv_qrz(struct wwvunit *up,
 	int	pdelay		/* propagation delay (samples) */
 	)
 {
-	char tbuf[TBUF];	/* monitor buffer */
-	int tbuf_len;
 	long	epoch;
 
 	/*
@@ -1223,17 +1983,205 @@ void wwv_qrz(struct wwvunit *up,
 			sp->metric = 0;
 		else
 			sp->metric = wwv_metric(sp);
-		{
-        	tbuf_len = snprintf(tbuf, TBUF-1, "wwv8 %04x %3d %s %04x %.0f %.0f/%.1f %ld %ld\n",
-                                up->status, up->gain, sp->refid, sp->reach & 0xffff, sp->metric,
-							    sp->synmax, sp->synsnr, sp->pos % SECOND, epoch);
-        	write(2, tbuf, tbuf_len);
-		}
+		wwv_tlm8(up, sp, epoch);
 		sp->maxeng = sp->noieng = 0;
 	}
 }
 
 
+/*
+ * wwv_acquire - enable batch minute sync acquisition
+ *
+ * This routine sets up the batch acquisition engine, which replaces the
+ * 800-ms matched filters and wwv_qrz() until minute sync is acquired.
+ * The envelope is folded over the last nmin minutes (AMIN to AMAX), so
+ * a weak minute pulse stands out from the noise sooner than it would
+ * in any one minute. The reachability register is seeded from the
+ * minutes in the ring, and the station metric passes TTHR only with
+ * AMIN of them, so a shorter ring could never reach minute sync. Not
+ * available in multi-stream mode. Returns 0 if successful, -1 if not.
+ */
+int wwv_acquire(struct wwvunit *up, int nmin)
+{
+	struct wwvacq *ap;
+
+	if (up->multi != NULL || nmin < AMIN || nmin > AMAX)
+		return (-1);
+	if (!(ap = (struct wwvacq *)calloc(1, sizeof(struct wwvacq))))
+		return (-1);
+	ap->env[0] = (float *)calloc(2 * nmin * MINMS, sizeof(float));
+	if (ap->env[0] == NULL) {
+		free(ap);
+		return (-1);
+	}
+	ap->env[1] = ap->env[0] + nmin * MINMS;
+	ap->nmin = nmin;
+	up->acq = ap;
+	return (0);
+}
+
+/*
+ * wwv_acq - accumulate the mixer outputs for batch acquisition
+ *
+ * This routine is called for each logical clock sample while the
+ * acquisition engine is active. The samples of the minute are numbered
+ * from the one after the last minute epoch, so the partial sums are in
+ * time order when the minute ends.
+ */
+static void wwv_acq(struct wwvunit *up, float ci, float cq, float hi, float hq)
+{
+	struct wwvacq *ap = up->acq;
+	int	m;
+
+	m = ((up->mphase + MINUTE - 1) % MINUTE) / MS;
+	ap->part[0][m] += ci;
+	ap->part[1][m] += cq;
+	ap->part[2][m] += hi;
+	ap->part[3][m] += hq;
+	if (up->mphase == 0) {
+		ap->head = (ap->head + 1) % ap->nmin;
+		if (ap->nfold < ap->nmin)
+			ap->nfold++;
+		wwv_acqmin(up, 0, &up->mitig[up->achan].wwv,
+		    (int)(up->fudgetime1 * SECOND));
+		wwv_acqmin(up, 1, &up->mitig[up->achan].wwvh,
+		    (int)(up->fudgetime2 * SECOND));
+		memset(ap->part, 0, sizeof(ap->part));
+	}
+}
+
+/*
+ * wwv_acqmin - batch minute sync discriminator
+ *
+ * This routine is called at the end of the minute for each station. It
+ * slides the 800-ms window over the 1-ms partial sums, which gives the
+ * same amplitude as the matched filter in wwv_rf() at every millisecond
+ * of the minute. The window wraps around the minute, since the pulse
+ * repeats every minute. The envelope goes into the ring and the ring is
+ * folded to find the minute epoch.
+ *
+ * A minute counts toward the reachability register if its own peak is
+ * within AWND (20 ms) of the folded peak, and the register is seeded
+ * only if the folded peak passes the same ATHR and ASNR thresholds as
+ * wwv_qrz(). The station metric is then computed as usual, so after
+ * three good minutes wwv_newchan() can select the station and minute
+ * sync follows.
+ */
+static void wwv_acqmin(struct wwvunit *up,
+	int	station,	/* 0 for wwv, 1 for wwvh */
+	struct sync *sp,	/* sync channel structure */
+	int	pdelay		/* propagation delay (samples) */
+	)
+{
+	struct wwvacq *ap = up->acq;
+	const float *pi = ap->part[2 * station];
+	const float *pq = ap->part[2 * station + 1];
+	float	*env, *fp;
+	double	si, sq;		/* window sums */
+	double	noise;		/* envelope sum */
+	int	i, j, k, m, maxpos;
+	long	pos, epoch;
+
+	/*
+	 * Slide the window over the minute and find this minute's peak.
+	 */
+	env = ap->env[station] + ap->head * MINMS;
+	si = sq = 0;
+	for (i = 0; i < SYNCYC; i++) {
+		si += pi[i];
+		sq += pq[i];
+	}
+	maxpos = 0;
+	for (i = 0; i < MINMS; i++) {
+		env[i] = sqrt(si * si + sq * sq) / SYNCYC;
+		if (env[i] > env[maxpos])
+			maxpos = i;
+		j = (i + SYNCYC) % MINMS;
+		si += pi[j] - pi[i];
+		sq += pq[j] - pq[i];
+	}
+	ap->peak[station][ap->head] = maxpos;
+
+	/*
+	 * Fold the ring and find the peak and the noise.
+	 */
+	fp = ap->fold;
+	memcpy(fp, env, MINMS * sizeof(float));
+	for (k = 1; k < ap->nfold; k++) {
+		env = ap->env[station] + ((ap->head + ap->nmin - k) %
+		    ap->nmin) * MINMS;
+		for (i = 0; i < MINMS; i++)
+			fp[i] += env[i];
+	}
+	maxpos = 0;
+	noise = 0;
+	for (i = 0; i < MINMS; i++) {
+		fp[i] /= ap->nfold;
+		noise += fp[i];
+		if (fp[i] > fp[maxpos])
+			maxpos = i;
+	}
+	sp->synmax = fp[maxpos];
+	sp->synsnr = wwv_snr(sp->synmax, (noise - sp->synmax) / MINMS);
+
+	/*
+	 * Seed the reachability register with the minutes that agree
+	 * with the fold, newest in the low-order bit.
+	 */
+	pos = (maxpos * MS - pdelay) % MINUTE;
+	if (pos < 0)
+		pos += MINUTE;
+	sp->pos = pos;
+	sp->reach = sp->count = 0;
+	epoch = 0;
+	if (sp->synmax > ATHR && sp->synsnr > ASNR) {
+		for (k = 0; k < ap->nfold; k++) {
+			m = ap->peak[station][(ap->head + ap->nmin - k) %
+			    ap->nmin] - maxpos;
+			if (m > MINMS / 2)
+				m -= MINMS;
+			else if (m < -MINMS / 2)
+				m += MINMS;
+			if (k == 0)
+				epoch = m * MS;
+			if (abs(m) < AWND) {
+				sp->reach |= 1 << k;
+				sp->count++;
+			}
+		}
+		sp->lastpos = sp->mepoch = pos;
+	}
+	if (up->watch > ACQSN)
+		sp->metric = 0;
+	else
+		sp->metric = wwv_metric(sp);
+	wwv_tlm8(up, sp, epoch);
+}
+
+
+/*
+ * wwv_tlm8 - queue the minute sync telemetry for a station
+ */
+static void wwv_tlm8(struct wwvunit *up, struct sync *sp, long epoch)
+{
+	struct tlmrec *tp;
+
+	if ((tp = tlm_alloc(up->tlm)) == NULL)
+		return;
+	tp->type = TLM_WWV8;
+	tp->status = up->status;
+	tp->gain = up->gain;
+	memcpy(tp->refid, sp->refid, sizeof(tp->refid));
+	tp->u.wwv8.reach = sp->reach & 0xffff;
+	tp->u.wwv8.metric = sp->metric;
+	tp->u.wwv8.synmax = sp->synmax;
+	tp->u.wwv8.synsnr = sp->synsnr;
+	tp->u.wwv8.pos = sp->pos % SECOND;
+	tp->u.wwv8.epoch = epoch;
+	tlm_commit(up->tlm);
+}
+
+
 /*
  * wwv_endpoc - identify and acquire second sync pulse
  *
@@ -1248,38 +2196,21 @@ void wwv_qrz(struct wwvunit *up,
  */
 static void wwv_endpoc(struct wwvunit *up, int epopos)
 {
-	static int epoch_mf[3]; /* epoch median filter */
-	static int tepoch;	/* current second epoch */
- 	static int xepoch;	/* last second epoch */
- 	static int zepoch;	/* last run epoch */
-	static int zcount;	/* last run end time */
-	static int scount;	/* seconds counter */
-	static int syncnt;	/* run length counter */
-	static int maxrun;	/* longest run length */
-	static int mepoch;	/* longest run end epoch */
-	static int mcount;	/* longest run end time */
-	static int avgcnt;	/* averaging interval counter */
-	static int avginc;	/* averaging ratchet */
-	static int iniflg;	/* initialization flag */
-	char tbuf[TBUF];		/* monitor buffer */
+	struct wwvdsp *dp = up->dsp;
+	struct tlmrec *tp;
 	float dtemp;
 	int tmp2;
 
-	if (!iniflg) {
-		iniflg = 1;
-		memset((char *)epoch_mf, 0, sizeof(epoch_mf));
-	}
-
 	/*
 	 * If the signal amplitude or SNR fall below thresholds, dim the
 	 * second sync lamp and wait for hotter ions. If no stations are
 	 * heard, we are either in a probe cycle or the ions are really
 	 * cold.
 	 */
-	scount++;
+	dp->scount++;
 	if (up->epomax < STHR || up->eposnr < SSNR) {
 		up->status &= ~(SSYNC | FGATE);
-		avgcnt = syncnt = maxrun = 0;
+		dp->avgcnt = dp->syncnt = dp->maxrun = 0;
 		return;
 	}
 	if (!(up->status & (SELV | SELH)))
@@ -1290,23 +2221,23 @@ static void wwv_endpoc(struct wwvunit *up, int epopos)
 	 * second sync pulse. The median sample becomes the candidate
 	 * epoch.
 	 */
-	epoch_mf[2] = epoch_mf[1];
-	epoch_mf[1] = epoch_mf[0];
-	epoch_mf[0] = epopos;
-	if (epoch_mf[0] > epoch_mf[1]) {
-		if (epoch_mf[1] > epoch_mf[2])
-			tepoch = epoch_mf[1];	/* 0 1 2 */
-		else if (epoch_mf[2] > epoch_mf[0])
-			tepoch = epoch_mf[0];	/* 2 0 1 */
+	dp->epoch_mf[2] = dp->epoch_mf[1];
+	dp->epoch_mf[1] = dp->epoch_mf[0];
+	dp->epoch_mf[0] = epopos;
+	if (dp->epoch_mf[0] > dp->epoch_mf[1]) {
+		if (dp->epoch_mf[1] > dp->epoch_mf[2])
+			dp->tepoch = dp->epoch_mf[1];	/* 0 1 2 */
+		else if (dp->epoch_mf[2] > dp->epoch_mf[0])
+			dp->tepoch = dp->epoch_mf[0];	/* 2 0 1 */
 		else
-			tepoch = epoch_mf[2];	/* 0 2 1 */
+			dp->tepoch = dp->epoch_mf[2];	/* 0 2 1 */
 	} else {
-		if (epoch_mf[1] < epoch_mf[2])
-			tepoch = epoch_mf[1];	/* 2 1 0 */
-		else if (epoch_mf[2] < epoch_mf[0])
-			tepoch = epoch_mf[0];	/* 1 0 2 */
+		if (dp->epoch_mf[1] < dp->epoch_mf[2])
+			dp->tepoch = dp->epoch_mf[1];	/* 2 1 0 */
+		else if (dp->epoch_mf[2] < dp->epoch_mf[0])
+			dp->tepoch = dp->epoch_mf[0];	/* 1 0 2 */
 		else
-			tepoch = epoch_mf[2];	/* 1 2 0 */
+			dp->tepoch = dp->epoch_mf[2];	/* 1 2 0 */
 	}
 
 
@@ -1321,30 +2252,36 @@ static void wwv_endpoc(struct wwvunit *up, int epopos)
 	 * interval while the comb filter charges up and noise
 	 * dissapates..
 	 */
-	tmp2 = (tepoch - xepoch) % SECOND;
+	tmp2 = (dp->tepoch - dp->xepoch) % SECOND;
 	if (tmp2 == 0) {
-		syncnt++;
-		if (syncnt > SCMP && up->status & MSYNC && (up->status &
-		    FGATE || scount - zcount <= up->avgint)) {
+		dp->syncnt++;
+		if (dp->syncnt > SCMP && up->status & MSYNC && (up->status &
+		    FGATE || dp->scount - dp->zcount <= up->avgint)) {
 			up->status |= SSYNC;
-			up->yepoch = tepoch;
+			up->yepoch = dp->tepoch;
 		}
-	} else if (syncnt >= maxrun) {
-		maxrun = syncnt;
-		mcount = scount;
-		mepoch = xepoch;
-		syncnt = 0;
-	}
-	if (!(up->status & MSYNC)) {
-		int tbuf_len = snprintf(tbuf, TBUF-1, "wwv1 %04x %3d %4d %5.0f %5.1f %5d %4d %4d %4d\n",
-		    up->status, up->gain, tepoch, up->epomax,
-		    up->eposnr, tmp2, avgcnt, syncnt,
-		    maxrun);
-		write(1, tbuf, tbuf_len);
-	}
-	avgcnt++;
-	if (avgcnt < up->avgint) {
-		xepoch = tepoch;
+	} else if (dp->syncnt >= dp->maxrun) {
+		dp->maxrun = dp->syncnt;
+		dp->mcount = dp->scount;
+		dp->mepoch = dp->xepoch;
+		dp->syncnt = 0;
+	}
+	if (!(up->status & MSYNC) && (tp = tlm_alloc(up->tlm)) != NULL) {
+		tp->type = TLM_WWV1;
+		tp->status = up->status;
+		tp->gain = up->gain;
+		tp->u.wwv1.tepoch = dp->tepoch;
+		tp->u.wwv1.epomax = up->epomax;
+		tp->u.wwv1.eposnr = up->eposnr;
+		tp->u.wwv1.tmp2 = tmp2;
+		tp->u.wwv1.avgcnt = dp->avgcnt;
+		tp->u.wwv1.syncnt = dp->syncnt;
+		tp->u.wwv1.maxrun = dp->maxrun;
+		tlm_commit(up->tlm);
+	}
+	dp->avgcnt++;
+	if (dp->avgcnt < up->avgint) {
+		dp->xepoch = dp->tepoch;
 		return;
 	}
 
@@ -1359,15 +2296,15 @@ static void wwv_endpoc(struct wwvunit *up, int epopos)
 	 * epoch difference (125-us units) and time difference (seconds)
 	 * between updates.
 	 */
-	if (syncnt >= maxrun) {
-		maxrun = syncnt;
-		mcount = scount;
-		mepoch = xepoch;
+	if (dp->syncnt >= dp->maxrun) {
+		dp->maxrun = dp->syncnt;
+		dp->mcount = dp->scount;
+		dp->mepoch = dp->xepoch;
 	}
-	xepoch = tepoch;
-	if (maxrun == 0) {
-		mepoch = tepoch;
-		mcount = scount;
+	dp->xepoch = dp->tepoch;
+	if (dp->maxrun == 0) {
+		dp->mepoch = dp->tepoch;
+		dp->mcount = dp->scount;
 	}
 
 	/*
@@ -1391,52 +2328,57 @@ static void wwv_endpoc(struct wwvunit *up, int epopos)
 	 * to zero; if it decrements to -3, the interval is halved and
 	 * the counter set to zero.
 	 */
-	dtemp = (mepoch - zepoch) % SECOND;
+	dtemp = (dp->mepoch - dp->zepoch) % SECOND;
 	if (up->status & FGATE) {
 		if (abs(dtemp) < MAXFREQ * MINAVG) {
-			up->freq += (dtemp / 2.) / ((mcount - zcount) *
+			up->freq += (dtemp / 2.) / ((dp->mcount - dp->zcount) *
 			    FCONST);
 			if (up->freq > MAXFREQ)
 				up->freq = MAXFREQ;
 			else if (up->freq < -MAXFREQ)
 				up->freq = -MAXFREQ;
 			if (abs(dtemp) < MAXFREQ * MINAVG / 2.) {
-				if (avginc < 3) {
-					avginc++;
+				if (dp->avginc < 3) {
+					dp->avginc++;
 				} else {
 					if (up->avgint < MAXAVG) {
 						up->avgint <<= 1;
-						avginc = 0;
+						dp->avginc = 0;
 					}
 				}
 			}
 		} else {
-			if (avginc > -3) {
-				avginc--;
+			if (dp->avginc > -3) {
+				dp->avginc--;
 			} else {
 				if (up->avgint > MINAVG) {
 					up->avgint >>= 1;
-					avginc = 0;
+					dp->avginc = 0;
 				}
 			}
 		}
 	}
-	{
-		int tbuf_len = snprintf(tbuf, TBUF-1,
-		    "wwv2 %04x %5.0f %5.1f %5d %4d %4d %4d %4.0f %7.2f\n",
-		    up->status, up->epomax, up->eposnr, mepoch,
-		    up->avgint, maxrun, mcount - zcount, dtemp,
-		    up->freq * 1e6 / SECOND);
-		write(1, tbuf, tbuf_len);
+	if ((tp = tlm_alloc(up->tlm)) != NULL) {
+		tp->type = TLM_WWV2;
+		tp->status = up->status;
+		tp->u.wwv2.epomax = up->epomax;
+		tp->u.wwv2.eposnr = up->eposnr;
+		tp->u.wwv2.mepoch = dp->mepoch;
+		tp->u.wwv2.avgint = up->avgint;
+		tp->u.wwv2.maxrun = dp->maxrun;
+		tp->u.wwv2.mcount = dp->mcount - dp->zcount;
+		tp->u.wwv2.dtemp = dtemp;
+		tp->u.wwv2.freq = up->freq * 1e6 / SECOND;
+		tlm_commit(up->tlm);
 	}
 
 	/*
 	 * This is a valid update; set up for the next interval.
 	 */
 	up->status |= FGATE;
-	zepoch = mepoch;
-	zcount = mcount;
-	avgcnt = syncnt = maxrun = 0;
+	dp->zepoch = dp->mepoch;
+	dp->zcount = dp->mcount;
+	dp->avgcnt = dp->syncnt = dp->maxrun = 0;
 }
 
 
@@ -1462,8 +2404,8 @@ static void wwv_endpoc(struct wwvunit *up, int epopos)
 static void
 wwv_epoch(struct wwvunit *up)
 {
+	struct wwvdsp *dp = up->dsp;
 	struct chan *cp;
-	static float sigmin, sigzer, sigone, engmax, engmin;
 
 	/*
 	 * Find the maximum minute sync pulse energy for both the
@@ -1490,7 +2432,7 @@ wwv_epoch(struct wwvunit *up)
 	 * epoch is not exact.
 	 */
 	if (up->rphase == 15 * MS)
-		sigmin = sigzer = sigone = up->irig;
+		dp->sigmin = dp->sigzer = dp->sigone = up->irig;
 
 	/*
 	 * Latch the data signal at 200 ms. Keep this around until the
@@ -1499,8 +2441,8 @@ wwv_epoch(struct wwvunit *up)
 	 * reference oscillator phase.
 	 */
 	if (up->rphase == 200 * MS) {
-		sigzer = up->irig;
-		engmax = sqrtf(up->irig * up->irig + up->qrig * up->qrig);
+		dp->sigzer = up->irig;
+		dp->engmax = sqrtf(up->irig * up->irig + up->qrig * up->qrig);
 		up->datpha = up->qrig / up->avgint;
 		if (up->datpha >= 0) {
 			up->datapt++;
@@ -1519,7 +2461,7 @@ wwv_epoch(struct wwvunit *up)
 	 * end of the second.
 	 */
 	else if (up->rphase == 500 * MS)
-		sigone = up->irig;
+		dp->sigone = up->irig;
 
 	/*
 	 * At the end of the second crank the clock state machine and
@@ -1538,22 +2480,22 @@ wwv_epoch(struct wwvunit *up)
 	up->rphase++;
 	if (up->mphase % SECOND == up->repoch) {
 		up->status &= ~(DGATE | BGATE);
-		engmin = sqrtf(up->irig * up->irig + up->qrig * up->qrig);
-		up->datsig = engmax;
-		up->datsnr = wwv_snr(engmax, engmin);
+		dp->engmin = sqrtf(up->irig * up->irig + up->qrig * up->qrig);
+		up->datsig = dp->engmax;
+		up->datsnr = wwv_snr(dp->engmax, dp->engmin);
 
 		/*
 		 * If the amplitude or SNR is below threshold, average a
 		 * 0 in the the integrators; otherwise, average the
 		 * bipolar signal. This is done to avoid noise polution.
 		 */
-		if (engmax < DTHR || up->datsnr < DSNR) {
+		if (dp->engmax < DTHR || up->datsnr < DSNR) {
 			up->status |= DGATE;
 			wwv_rsec(up, 0);
 		} else {
-			sigzer -= sigone;
-			sigone -= sigmin;
-			wwv_rsec(up, sigone - sigzer);
+			dp->sigzer -= dp->sigone;
+			dp->sigone -= dp->sigmin;
+			wwv_rsec(up, dp->sigone - dp->sigzer);
 		}
 		if (up->status & (DGATE | BGATE))
 			up->errcnt++;
@@ -1584,19 +2526,12 @@ wwv_epoch(struct wwvunit *up)
  */
 static void wwv_rsec(struct wwvunit *up, float bit)
 {
-	static int iniflg;	/* initialization flag */
-	static float bcddld[4]; /* BCD data bits */
-	static float bitvec[61]; /* bit integrator for misc bits */
+	struct wwvdsp *dp = up->dsp;
 	struct chan *cp;
 	struct sync *sp, *rp;
-	char	tbuf[TBUF];	/* monitor buffer */
+	struct tlmrec *tp;
 	int	sw, arg, nsec;
 
-	if (!iniflg) {
-		iniflg = 1;
-		memset((char *)bitvec, 0, sizeof(bitvec));
-	}
-
 	/*
 	 * The bit represents the probability of a hit on zero (negative
 	 * values), a hit on one (positive values) or a miss (zero
@@ -1608,7 +2543,7 @@ static void wwv_rsec(struct wwvunit *up, float bit)
 	 */
 	nsec = up->rsec;
 	up->rsec++;
-	bitvec[nsec] += (bit - bitvec[nsec]) / TCONST;
+	dp->bitvec[nsec] += (bit - dp->bitvec[nsec]) / TCONST;
 	sw = progx[nsec].sw;
 	arg = progx[nsec].arg;
 
@@ -1734,19 +2669,19 @@ static void wwv_rsec(struct wwvunit *up, float bit)
 	 * to zero.
 	 */
 	case COEF1:			/* 4-7 */
-		bcddld[arg] = bit;
+		dp->bcddld[arg] = bit;
 		break;
 
 	case COEF:			/* 10-13, 15-17, 20-23, 25-26,
 					   30-33, 35-38, 40-41, 51-54 */
 		if (up->status & DSYNC)
-			bcddld[arg] = bit;
+			dp->bcddld[arg] = bit;
 		else
-			bcddld[arg] = 0;
+			dp->bcddld[arg] = 0;
 		break;
 
 	case COEF2:			/* 18, 27-28, 42-43 */
-		bcddld[arg] = 0;
+		dp->bcddld[arg] = 0;
 		break;
 
 	/*
@@ -1756,19 +2691,19 @@ static void wwv_rsec(struct wwvunit *up, float bit)
 	 * greatest and the next lower for later SNR calculation.
 	 */
 	case DECIM2:			/* 29 */
-		wwv_corr4(up, &up->decvec[arg], bcddld, bcd2);
+		wwv_corr4(up, &up->decvec[arg], dp->bcddld, bcd2);
 		break;
 
 	case DECIM3:			/* 44 */
-		wwv_corr4(up, &up->decvec[arg], bcddld, bcd3);
+		wwv_corr4(up, &up->decvec[arg], dp->bcddld, bcd3);
 		break;
 
 	case DECIM6:			/* 19 */
-		wwv_corr4(up, &up->decvec[arg], bcddld, bcd6);
+		wwv_corr4(up, &up->decvec[arg], dp->bcddld, bcd6);
 		break;
 
 	case DECIM9:			/* 8, 14, 24, 34, 39 */
-		wwv_corr4(up, &up->decvec[arg], bcddld, bcd9);
+		wwv_corr4(up, &up->decvec[arg], dp->bcddld, bcd9);
 		break;
 
 	/*
@@ -1778,15 +2713,15 @@ static void wwv_rsec(struct wwvunit *up, float bit)
 	 * integrating noise under low SNR conditions.
 	 */
 	case MSC20:			/* 55 */
-		wwv_corr4(up, &up->decvec[YR + 1], bcddld, bcd9);
+		wwv_corr4(up, &up->decvec[YR + 1], dp->bcddld, bcd9);
 		/* fall through */
 
 	case MSCBIT:			/* 2-3, 50, 56-57 */
-		if (bitvec[nsec] > BTHR) {
+		if (dp->bitvec[nsec] > BTHR) {
 			if (!(up->misc & arg))
 				up->alarm |= CMPERR;
 			up->misc |= arg;
-		} else if (bitvec[nsec] < -BTHR) {
+		} else if (dp->bitvec[nsec] < -BTHR) {
 			if (up->misc & arg)
 				up->alarm |= CMPERR;
 			up->misc &= ~arg;
@@ -1801,11 +2736,11 @@ static void wwv_rsec(struct wwvunit *up, float bit)
 	 * light them back up.
 	 */
 	case MSC21:			/* 58 */
-		if (bitvec[nsec] > BTHR) {
+		if (dp->bitvec[nsec] > BTHR) {
 			if (!(up->misc & arg))
 				up->alarm |= CMPERR;
 			up->misc |= arg;
-		} else if (bitvec[nsec] < -BTHR) {
+		} else if (dp->bitvec[nsec] < -BTHR) {
 			if (up->misc & arg)
 				up->alarm |= CMPERR;
 			up->misc &= ~arg;
@@ -1840,11 +2775,18 @@ static void wwv_rsec(struct wwvunit *up, float bit)
 		wwv_clock(up);
 		break;
 	}
-	if (!(up->status & DSYNC)) {
-		int tbuf_len = snprintf(tbuf, TBUF-1, "wwv3 %2d %04x %3d %4d %5.0f %5.1f %5.0f %5.1f %5.0f\n",
-		    nsec, up->status, up->gain, up->yepoch, up->epomax,
-		    up->eposnr, up->datsig, up->datsnr, bit);
-		write(1, tbuf, tbuf_len);
+	if (!(up->status & DSYNC) && (tp = tlm_alloc(up->tlm)) != NULL) {
+		tp->type = TLM_WWV3;
+		tp->status = up->status;
+		tp->gain = up->gain;
+		tp->u.wwv3.nsec = nsec;
+		tp->u.wwv3.yepoch = up->yepoch;
+		tp->u.wwv3.epomax = up->epomax;
+		tp->u.wwv3.eposnr = up->eposnr;
+		tp->u.wwv3.datsig = up->datsig;
+		tp->u.wwv3.datsnr = up->datsnr;
+		tp->u.wwv3.bit = bit;
+		tlm_commit(up->tlm);
 		//record_clock_stats(&peer->srcadr, tbuf);
 	}
 	up->disp += AUDIO_PHI;
@@ -1885,38 +2827,15 @@ void ntp_write(volatile struct shmTime *shmseg, time_t tv_sec, l_fp *rtv, int pr
     shmseg->valid = 1;
 }
 
-void Shellsort_dbl(double *in, unsigned int n)
-{
-  int i, j;
-  double v;
-  unsigned int inc = 1;
-
-  do {
-    inc = 3 * inc + 1;
-  } while (inc <= n);
-
-  do {
-    inc = inc / 3;
-    for (i = inc + 1; i <= n; i++) {
-      v = in[i-1];
-      j = i;
-      while (in[j-inc-1] > v) {
-        in[j-1] = in[j-inc-1];
-        j -= inc;
-        if (j <= inc)
-          break;
-      }
-      in[j-1] = v;
-    }
-  } while (inc > 1);
-}
-
 /*
  * wwv_process_offset - update median filter
  *
  * This routine uses the given offset and timestamps to construct a new
- * entry in the median filter circular buffer. Samples that overflow the
- * filter are quietly discarded.
+ * entry in the median filter. The filter is a window of the last NSTAGE
+ * samples, kept both in arrival order, to find the oldest, and in
+ * ascending order. The oldest sample is evicted and the new one
+ * inserted in place with a binary search, so the window is always
+ * sorted and the offset and jitter can be recomputed without a sort.
  */
 /* lasttim: last timecode timestamp */
 /* lastrec: last receive timestamp */
@@ -1924,35 +2843,65 @@ void wwv_process_offset(struct wwvunit *up, time_t lasttim)
 {
 	l_fp lftemp;
 	double doffset;
+	unsigned int i;
 
 	lftemp.l_ui = lasttim;
     lftemp.l_uf = 0;
 	L_SUB(&lftemp, &up->timestamp);
 	LFPTOD(&lftemp, doffset);
-    up->coderecv = (up->coderecv + 1) & 63;
-    up->filter[up->coderecv] = (doffset + PDELAY + up->pdelay);
-    if (up->coderecv == up->codeproc)
-        up->codeproc = (up->codeproc + 1) & 63;
+	doffset += PDELAY + up->pdelay;
+
+	if (up->nstage == NSTAGE) {
+		i = wwv_search(up->sorted, up->nstage, up->filter[up->coderecv]);
+		up->nstage--;
+		memmove(&up->sorted[i], &up->sorted[i + 1], (up->nstage - i) *
+		    sizeof(double));
+	}
+	up->filter[up->coderecv] = doffset;
+	up->coderecv = (up->coderecv + 1) % NSTAGE;
+	i = wwv_search(up->sorted, up->nstage, doffset);
+	memmove(&up->sorted[i + 1], &up->sorted[i], (up->nstage - i) *
+	    sizeof(double));
+	up->sorted[i] = doffset;
+	up->nstage++;
+	wwv_sample(up);
 }
 
+/*
+ * wwv_search - find the first sample not less than x
+ */
+static unsigned int wwv_search(const double *off, unsigned int n, double x)
+{
+	unsigned int lo, hi, mid;
+
+	lo = 0;
+	hi = n;
+	while (lo < hi) {
+		mid = (lo + hi) >> 1;
+		if (off[mid] < x)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo);
+}
+
+/*
+ * wwv_sample - compute the offset and jitter
+ *
+ * This routine trims the sorted window and leaves the offset, jitter
+ * and number of samples in the unit, where they can be read at any
+ * time.
+ */
 unsigned int wwv_sample(struct wwvunit *up)
 {
-	unsigned int i, j, k, m, n = 0;
-	double	off[64];
+	const double *off = up->sorted;
+	unsigned int i, j, k, m, n = up->nstage;
 	double	offset, offs2;
+	struct tlmrec *tp;
 
-	/*
-	 * Copy the raw offsets and sort into ascending order. Don't do
-	 * anything if the buffer is empty.
-	 */
-	while (up->codeproc != up->coderecv) {
-		up->codeproc = (up->codeproc + 1) & 63;
-		off[n++] = up->filter[up->codeproc];
-	}
 	if (!n) return (0);
 
-    Shellsort_dbl(off, n);
-
 	/*
 	 * Reject the furthest from the median of the samples until
 	 * approximately 60 percent of the samples remain.
@@ -1976,14 +2925,17 @@ unsigned int wwv_sample(struct wwvunit *up)
         }
 	}
 	offs2 /= m;
+	up->offset = offs2;
 	//up->jitter = sqrt(1.0 / up->jitter);
     up->jitter *= m;
 	up->jitter = m*sqrt(1.0 / up->jitter);
-	{
-	    char tbuf[TBUF];	/* monitor buffer */
-       	int tbuf_len = snprintf(tbuf, TBUF-1, "refclock_sample: n: %u offset: %.6f disp: %.6f jitter: %.6f\n",
-                                n, offs2, up->disp, 1.0/up->jitter);
-        write(2, tbuf, tbuf_len);
+	if ((tp = tlm_alloc(up->tlm)) != NULL) {
+		tp->type = TLM_SAMPLE;
+		tp->u.sample.n = n;
+		tp->u.sample.offset = offs2;
+		tp->u.sample.disp = up->disp;
+		tp->u.sample.jitter = 1.0/up->jitter;
+		tlm_commit(up->tlm);
 	}
 	return (unsigned int)n;
 }
@@ -1998,7 +2950,7 @@ static inline unsigned int av_log2(unsigned int x) {
 
 static void wwv_clock(struct wwvunit *up)
 {
-    unsigned int hms = 0;
+	struct tlmrec *tp;
 	time_t offset; /* offset in NTP seconds */
 
 	if (!(up->status & SSYNC))
@@ -2008,44 +2960,68 @@ static void wwv_clock(struct wwvunit *up)
 	if (!(up->alarm))
 		up->status |= INSYNC;
 	if (up->status & INSYNC && up->status & SSYNC) {
-		up->sec = up->rsec;
-		up->min = up->decvec[MN].digit + up->decvec[MN + 1].digit * 10;
-		up->hour = up->decvec[HR].digit + up->decvec[HR + 1].digit * 10;
-		up->jt.yearday = up->decvec[DA].digit + up->decvec[DA + 1].digit * 10 + up->decvec[DA + 2].digit * 100;
-		up->jt.year = up->decvec[YR].digit + up->decvec[YR + 1].digit * 10;
-		up->jt.year += 2000;
-        hms = ((3600 * up->hour) + (60 * up->min) + up->sec);
-		up->yearstart = calyearstart(up->timestamp.l_ui);
-	    offset = (int32_t)86400*(up->jt.yearday-1);
-        {
-	        char tbuf[TBUF];	/* monitor buffer */
-       	    int tbuf_len = snprintf(tbuf, TBUF-1, "offset: %lu\n", offset);
-            write(2, tbuf, tbuf_len);
-        }
-        offset += (int32_t)hms;
-        //offset += (int32_t)up->yearstart;
+		offset = wwv_yeartime(up);
+		if ((tp = tlm_alloc(up->tlm)) != NULL) {
+			tp->type = TLM_DAY;
+			tp->u.day.offset = (time_t)86400*(up->jt.yearday-1);
+			tlm_commit(up->tlm);
+		}
 		up->watch = 0;
 		up->disp = 0;
 		wwv_process_offset(up, offset);
-		//wwv_process_offset(up, hms);
-        if (!(hms & 7)) {
-            unsigned int n = 0, codeproc = up->codeproc;
-	        while (codeproc != up->coderecv) {
-		        codeproc = (codeproc + 1) & 63;
-                n++;
-	        }
-            if (n >= 4) {
-                if (wwv_sample(up)) {
-                    l_fp curtime;
-                    get_systime(&curtime);
-                    ntp_write(up->shmTime, offset, &curtime, av_log2((unsigned int)up->jitter));
-                }
-            }
-        }
+		wwv_publish(up, offset);
 	}
 	up->lencode = timecode(up, up->a_lastcode);
 }
 
+/*
+ * wwv_yeartime - decode the time of the current second
+ *
+ * This routine sets the time fields of the unit from the decoding
+ * matrix and the seconds counter and returns the seconds since the
+ * beginning of the year.
+ */
+static time_t wwv_yeartime(struct wwvunit *up)
+{
+    unsigned int hms;
+	time_t offset; /* offset in NTP seconds */
+
+	up->sec = up->rsec;
+	up->min = up->decvec[MN].digit + up->decvec[MN + 1].digit * 10;
+	up->hour = up->decvec[HR].digit + up->decvec[HR + 1].digit * 10;
+	up->jt.yearday = up->decvec[DA].digit + up->decvec[DA + 1].digit * 10 + up->decvec[DA + 2].digit * 100;
+	up->jt.year = up->decvec[YR].digit + up->decvec[YR + 1].digit * 10;
+	up->jt.year += 2000;
+    hms = ((3600 * up->hour) + (60 * up->min) + up->sec);
+	up->yearstart = calyearstart(up->timestamp.l_ui);
+    offset = (int32_t)86400*(up->jt.yearday-1);
+    offset += (int32_t)hms;
+    //offset += (int32_t)up->yearstart;
+	return (offset);
+}
+
+/*
+ * wwv_publish - publish the time to the NTP shared memory segment
+ *
+ * This routine is called each time the median filter takes a new
+ * sample, which is once a minute when the clock is synchronized. Once
+ * the filter has at least NPUBLISH samples, it writes the time of the
+ * sample along with the receive time derived from the filtered offset,
+ * so the jitter of any one sample does not get through.
+ */
+static void wwv_publish(struct wwvunit *up, time_t offset)
+{
+	l_fp	rtv, lftemp;
+
+	if (up->nstage < NPUBLISH || up->shmTime == NULL)
+		return;
+	rtv.l_ui = offset;
+	rtv.l_uf = 0;
+	DTOLFP(up->offset, &lftemp);
+	L_SUB(&rtv, &lftemp);
+	ntp_write(up->shmTime, offset, &rtv, av_log2((unsigned int)up->jitter));
+}
+
 /*
  * wwv_corr4 - determine maximum-likelihood digit
  *
@@ -2060,12 +3036,12 @@ static void
 wwv_corr4(struct wwvunit *up,
 	struct decvec *vp,	/* decoding table pointer */
 	float	data[],		/* received data vector */
-	float	tab[][4]	/* correlation vector array */
+	const float tab[][4]	/* correlation vector array */
 	)
 {
 	float	topmax, nxtmax;	/* metrics */
 	float	acc;		/* accumulator */
-	char	tbuf[TBUF];	/* monitor buffer */
+	struct tlmrec *tp;
 	int	mldigit;	/* max likelihood digit */
 	int	i, j;
 
@@ -2126,13 +3102,20 @@ wwv_corr4(struct wwvunit *up,
 			}
 		}
 	}
-	if (!(up->status & INSYNC)) {
-		int tbuf_len = snprintf(tbuf, TBUF-1,
-		    "wwv4 %2d %04x %3d %4d %5.0f %2d %d %d %d %5.0f %5.1f\n",
-		    up->rsec - 1, up->status, up->gain, up->yepoch,
-		    up->epomax, vp->radix, vp->digit, mldigit,
-		    vp->count, vp->digprb, vp->digsnr);
-		write(1, tbuf, tbuf_len);
+	if (!(up->status & INSYNC) && (tp = tlm_alloc(up->tlm)) != NULL) {
+		tp->type = TLM_WWV4;
+		tp->status = up->status;
+		tp->gain = up->gain;
+		tp->u.wwv4.rsec = up->rsec - 1;
+		tp->u.wwv4.yepoch = up->yepoch;
+		tp->u.wwv4.epomax = up->epomax;
+		tp->u.wwv4.radix = vp->radix;
+		tp->u.wwv4.digit = vp->digit;
+		tp->u.wwv4.mldigit = mldigit;
+		tp->u.wwv4.count = vp->count;
+		tp->u.wwv4.digprb = vp->digprb;
+		tp->u.wwv4.digsnr = vp->digsnr;
+		tlm_commit(up->tlm);
 	}
 }
 
@@ -2263,6 +3246,9 @@ wwv_tsec(struct wwvunit *up)
  * the metric must be at least MTHR (13); otherwise, the station select
  * bits are cleared so the second sync is disabled and the data bit
  * integrators averaged to a miss.
+ *
+ * In multi-stream mode there is no need to tune anything, so the
+ * decoder simply switches to the stream for the selected channel.
  */
 static int
 wwv_newchan(struct wwvunit *up)
@@ -2311,6 +3297,8 @@ wwv_newchan(struct wwvunit *up)
 		rval = FALSE;
 	} else {
 		up->dchan = j;
+		if (up->multi != NULL)
+			up->achan = j;
 		up->sptr = sp;
 		//memcpy(&pp->refid, sp->refid, 4);
 		up->status |= METRIC;
@@ -2359,6 +3347,10 @@ wwv_newgame(struct wwvunit *up)
 	up->avgint = MINAVG;
 	up->freq = 0;
 	up->gain = MAXGAIN / 2;
+	if (up->acq != NULL) {
+		up->acq->nfold = 0;
+		memset(up->acq->part, 0, sizeof(up->acq->part));
+	}
 
 	/*
 	 * Initialize the station processes for audio gain, select bit,
@@ -2467,39 +3459,39 @@ void d2md(unsigned int day, unsigned int isleap, unsigned int *m, unsigned int *
 static int timecode(struct wwvunit *up, char *ptr)
 {
     struct sync *sp;
-    unsigned int year, day, month, mday, hour, minute, second, isleap;
-    char synchar, dst;
-    char cptr[50];
-	unsigned int cptr_len = 0;
+    struct tlmrec rec;
+    unsigned int year, day, month, mday, isleap;
+    int fd;
 
     /*
      * Common fixed-format fields
      */
-    synchar = (up->status & INSYNC) ? ' ' : '?';
     year = up->decvec[YR].digit + up->decvec[YR + 1].digit * 10 + 2000;
     day = up->decvec[DA].digit + up->decvec[DA + 1].digit * 10 + up->decvec[DA + 2].digit * 100;
-    hour = up->decvec[HR].digit + up->decvec[HR + 1].digit * 10;
-    minute = up->decvec[MN].digit + up->decvec[MN + 1].digit * 10;
-    second = 0;
-    dst = dstcod[(up->misc >> 4) & 0x3];
-    ptr[0] = synchar;
-    ptr[1] = '\0';
     isleap = IsLeapYear(year);
     d2md(day, isleap, &month, &mday);
-    cptr_len = snprintf(cptr, 48, "| %1X %4d %02d %02d %02u:%02u:%02u %c",
-			            up->alarm, year, month, mday, hour, minute, second, dst);
+    memset(&rec, 0, sizeof(rec));
+    rec.type = TLM_TIMECODE;
+    rec.u.timecode.alarm = up->alarm;
+    rec.u.timecode.year = year;
+    rec.u.timecode.month = month;
+    rec.u.timecode.mday = mday;
+    rec.u.timecode.hour = up->decvec[HR].digit + up->decvec[HR + 1].digit * 10;
+    rec.u.timecode.minute = up->decvec[MN].digit + up->decvec[MN + 1].digit * 10;
 
     /*
      * Specific variable-format fields
      */
     sp = up->sptr;
-    cptr_len += snprintf(cptr + cptr_len-1, 48, " | %d %d %s %.0f %d %.1f %d |\n",
-                         up->watch, up->mitig[up->dchan].gain, sp->refid, sp->metric,
-                         up->errcnt, up->freq / SECOND * 1e6, up->avgint);
-	write(1, cptr, cptr_len);
-	memcpy(ptr, cptr, cptr_len);
-	ptr[cptr_len] = '\0';
-	return cptr_len;
+    rec.u.timecode.watch = up->watch;
+    rec.gain = up->mitig[up->dchan].gain;
+    memcpy(rec.refid, sp->refid, sizeof(rec.refid));
+    rec.u.timecode.metric = sp->metric;
+    rec.u.timecode.errcnt = up->errcnt;
+    rec.u.timecode.freq = up->freq / SECOND * 1e6;
+    rec.u.timecode.avgint = up->avgint;
+    tlm_put(up->tlm, &rec);
+    return (tlm_format(&rec, ptr, &fd));
 }
 
 #include <sys/types.h>
@@ -2521,44 +3513,470 @@ struct shmTime *getShmTime (unsigned int unit)
     }
 }
 
-uint8_t *slurp_file(char *path, size_t *filesize);
-#if 0
-int main(int argc, char **argv) {
-    size_t bufsize;
-    unsigned int i = 0, frames;
+
+/*
+ * The programs below are left out when the decoder is linked into
+ * another program, such as the benchmark.
+ */
+#ifndef NO_MAIN
+static volatile sig_atomic_t terminate; /* SIGTERM received */
+
+static void sigterm(int sig) {
+    terminate = 1;
+}
+
+/*
+ * Capture pipeline. The capture thread reads blocks of codec samples
+ * into a ring and timestamps each one as soon as its read returns, so
+ * a stall in the decoder neither skews the receive time nor holds up
+ * the input. The main thread decodes the blocks in order. If the ring
+ * is full, the capture thread drops the block it just read and counts
+ * an overrun, except for a regular file, which it simply stops reading
+ * until there is room.
+ */
+#define CAPPRIO     10      /* capture priority above SCHED_FIFO min */
+#define CAPDEPTH    (8 * SECOND) /* ring depth (samples) */
+
+struct capblk {
+    l_fp recv_time;         /* system time at end of read */
+    struct timespec mono;   /* raw monotonic time at end of read */
+    int16_t *buf;           /* codec samples */
+};
+
+struct capture {
+    pthread_t thread;       /* capture thread */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    /* block posted or freed */
+    struct capblk *blk;     /* block ring */
+    int16_t *spare;         /* overrun buffer */
+    unsigned int nblk;      /* blocks in ring */
+    unsigned int blksiz;    /* samples per block */
+    unsigned int head;      /* blocks posted */
+    unsigned int tail;      /* blocks decoded */
+    unsigned long overrun;  /* blocks dropped, ring full */
+    int fd;                 /* input */
+    int wait;               /* wait for room instead of dropping */
+    int quit;               /* decoder done */
+    int eof;                /* input ended */
+};
+
+/*
+ * cap_read - read a whole block. Returns 0 if successful, -1 at end of
+ * input, on error or on SIGTERM. A SIGTERM that arrives while the
+ * thread is not blocked in read() is caught by the check before the
+ * next one.
+ */
+static int cap_read(int fd, int16_t *buf, size_t len) {
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len) {
+        if (terminate)
+            return -1;
+        n = read(fd, (char *)buf + done, len - done);
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+static void *cap_thread(void *arg) {
+    struct capture *cp = arg;
+    struct capblk *bp;
+    struct capblk spare;
+    int full;
+
+    spare.buf = cp->spare;
+    pthread_mutex_lock(&cp->lock);
+    while (!cp->quit) {
+        while (cp->wait && !cp->quit && cp->head - cp->tail >= cp->nblk)
+            pthread_cond_wait(&cp->cond, &cp->lock);
+        if (cp->quit)
+            break;
+        full = cp->head - cp->tail >= cp->nblk;
+        bp = full ? &spare : &cp->blk[cp->head % cp->nblk];
+        pthread_mutex_unlock(&cp->lock);
+        if (cap_read(cp->fd, bp->buf, cp->blksiz * sizeof(int16_t)) < 0) {
+            pthread_mutex_lock(&cp->lock);
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC_RAW, &bp->mono);
+        get_systime(&bp->recv_time);
+        pthread_mutex_lock(&cp->lock);
+        if (full)
+            cp->overrun++;
+        else
+            cp->head++;
+        pthread_cond_broadcast(&cp->cond);
+    }
+    cp->eof = 1;
+    pthread_cond_broadcast(&cp->cond);
+    pthread_mutex_unlock(&cp->lock);
+    return NULL;
+}
+
+/*
+ * cap_free - free the ring
+ */
+static void cap_free(struct capture *cp) {
+    unsigned int i;
+
+    if (cp->blk) {
+        for (i = 0; i < cp->nblk; i++)
+            free(cp->blk[i].buf);
+    }
+    free(cp->blk);
+    free(cp->spare);
+    free(cp);
+}
+
+/*
+ * cap_start - allocate the ring and start the capture thread, at real
+ * time priority if we are allowed to.
+ */
+static struct capture *cap_start(int fd, unsigned int blksiz) {
+    struct capture *cp;
+    struct sched_param param;
+    pthread_attr_t attr;
+    struct stat st;
+    unsigned int i;
+    int rval;
+
+    if (!(cp = (struct capture *)calloc(1, sizeof(struct capture))))
+        return NULL;
+    cp->fd = fd;
+    cp->blksiz = blksiz;
+    cp->nblk = CAPDEPTH / blksiz;
+    if (cp->nblk < 4)
+        cp->nblk = 4;
+    cp->wait = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (!(cp->blk = (struct capblk *)calloc(cp->nblk, sizeof(struct capblk))) ||
+        !(cp->spare = (int16_t *)malloc(blksiz * sizeof(int16_t)))) {
+        cap_free(cp);
+        return NULL;
+    }
+    for (i = 0; i < cp->nblk; i++) {
+        if (!(cp->blk[i].buf = (int16_t *)malloc(blksiz * sizeof(int16_t)))) {
+            cap_free(cp);
+            return NULL;
+        }
+    }
+    pthread_mutex_init(&cp->lock, NULL);
+    pthread_cond_init(&cp->cond, NULL);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO) + CAPPRIO;
+    pthread_attr_setschedparam(&attr, &param);
+    rval = pthread_create(&cp->thread, &attr, cap_thread, cp);
+    pthread_attr_destroy(&attr);
+    if (rval == EPERM) {
+        fprintf(stderr, "wwv: no real time priority for capture\n");
+        rval = pthread_create(&cp->thread, NULL, cap_thread, cp);
+    }
+    if (rval) {
+        pthread_mutex_destroy(&cp->lock);
+        pthread_cond_destroy(&cp->cond);
+        cap_free(cp);
+        return NULL;
+    }
+    return cp;
+}
+
+/*
+ * cap_stop - stop the capture thread and report the overruns and the
+ * longest interval between blocks.
+ */
+static void cap_stop(struct capture *cp, double maxint) {
+    pthread_mutex_lock(&cp->lock);
+    cp->quit = 1;
+    pthread_cond_broadcast(&cp->cond);
+    pthread_mutex_unlock(&cp->lock);
+    pthread_join(cp->thread, NULL);
+    fprintf(stderr, "capture: %u blocks %lu overruns %.3f s max interval\n",
+        cp->tail, cp->overrun, maxint);
+    pthread_mutex_destroy(&cp->lock);
+    pthread_cond_destroy(&cp->cond);
+    cap_free(cp);
+}
+
+/*
+ * Replay mode. A recorded capture is memory mapped and decoded as fast
+ * as the processor allows, with the receive time of each block derived
+ * from its sample index rather than the system clock, so the decoder
+ * behaves as it did when the capture was made and a run is exactly
+ * repeatable. The capture is either a WAV file, 16-bit PCM at 8 kHz,
+ * of which the first channel is used, or raw samples. Nothing is
+ * written to the NTP shared memory segment. At the end the times to
+ * minute sync, units sync and clock sync are reported along with the
+ * decoding speed; the timecodes and offsets are in the usual monitor
+ * lines.
+ */
+static int main_replay(struct wwvunit *up, const char *path, long start, unsigned int blksiz, int tlmfd) {
+    static const int bits[3] = {MSYNC, DSYNC, INSYNC};
+    static const char *name[3] = {"MSYNC", "DSYNC", "INSYNC"};
+    double when[3] = {-1, -1, -1};
+    struct wavfile cap;
+    const int16_t *samp;
     int16_t *buf;
-    unsigned char *_buf = slurp_file(argv[1], &bufsize);
-    struct wwvunit *up = wwv_start(2);
+    struct timespec t1, t2;
+    unsigned int nchan, n, i;
+    size_t nsamp, k;
+    l_fp t0, t;
+    double dtemp;
+
+    if (wav_map(path, SECOND, &cap) < 0)
+        return -1;
+    samp = cap.samp;
+    nsamp = cap.nsamp;
+    nchan = cap.nchan;
+    if (!(buf = (int16_t *)malloc(blksiz * sizeof(int16_t)))) {
+        wav_unmap(&cap);
+        return -1;
+    }
+
+    /*
+     * Unless told otherwise, the capture ended when the file was
+     * last modified.
+     */
+    if (start < 0)
+        start = cap.mtime - nsamp / SECOND;
+    t0.l_ui = start + JAN_1970;
+    t0.l_uf = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (k = 0; k < nsamp && !terminate; k += n) {
+        n = nsamp - k < blksiz ? nsamp - k : blksiz;
+        for (i = 0; i < n; i++)
+            buf[i] = samp[(k + i) * nchan];
+        DTOLFP((double)k / SECOND, &t);
+        L_ADD(&t, &t0);
+        wwv_receive(up, buf, n, t);
+        tlm_drain(up->tlm, tlmfd);
+        for (i = 0; i < 3; i++) {
+            if (when[i] < 0 && up->status & bits[i])
+                when[i] = (double)(k + n) / SECOND;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    tlm_drain(up->tlm, tlmfd);
+    dtemp = (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) * 1e-9;
+    fprintf(stderr, "replay: %s %.0f s in %.3f s (%.0fx)\n", path,
+        (double)k / SECOND, dtemp, dtemp > 0 ? k / SECOND / dtemp : 0);
+    for (i = 0; i < 3; i++) {
+        if (when[i] < 0)
+            fprintf(stderr, "replay: %s never\n", name[i]);
+        else
+            fprintf(stderr, "replay: %s %.0f s\n", name[i], when[i]);
+    }
+    free(buf);
+    wav_unmap(&cap);
+    return 0;
+}
+
+/*
+ * Multi-stream mode: one raw 8 kHz stream per qsy[] frequency, in
+ * order, with "-" for a channel that is not available.
+ */
+static int main_multi(struct wwvunit *up, int nfiles, char **files, const char *statefile, int tlmfd) {
+    int in_fd[NCHAN];
+    int16_t *buf[NCHAN];
     l_fp l_curtime;
-    up->shmTime = getShmTime(3);
-    _buf += 44; bufsize -= 44;
-    buf = (int16_t*)_buf;
-    frames = bufsize/16000;
-    while(i < frames) {
+    unsigned int nbuf = 0;
+    int i, n, rval = -1;
+
+    for (i = 0; i < NCHAN; i++) {
+        in_fd[i] = -1;
+        buf[i] = NULL;
+    }
+    for (i = 0; i < NCHAN; i++) {
+        if (i >= nfiles || !strcmp(files[i], "-"))
+            continue;
+        if ((in_fd[i] = open(files[i], O_RDONLY)) < 0) {
+            perror(files[i]);
+            goto done;
+        }
+        if (!(buf[i] = (int16_t *)malloc(8000*sizeof(int16_t))))
+            goto done;
+    }
+    if (wwv_multi(up, NCHAN) < 0) {
+        fprintf(stderr, "wwv: cannot start multi-stream mode\n");
+        goto done;
+    }
+    while(!terminate) {
+        for (i = 0; i < NCHAN; i++) {
+            if (in_fd[i] < 0) continue;
+            n = read(in_fd[i], buf[i], 8000*sizeof(int16_t));
+            if (n < (int)(8000*sizeof(int16_t))) break;
+        }
+        if (i < NCHAN) break;
         get_systime(&l_curtime);
-        wwv_receive(up, buf+i*8000, 8000, l_curtime);
-        i++;
+        wwv_receive_multi(up, buf, 8000, l_curtime);
+        tlm_drain(up->tlm, tlmfd);
+        if (statefile && ++nbuf % SNAPINT == 0)
+            wwv_save(up, statefile);
     }
-    return 0;
+    tlm_drain(up->tlm, tlmfd);
+    if (statefile)
+        wwv_save(up, statefile);
+    rval = 0;
+done:
+    for (i = 0; i < NCHAN; i++) {
+        if (in_fd[i] >= 0) close(in_fd[i]);
+        free(buf[i]);
+    }
+    return rval;
 }
-#endif
 
 int main(int argc, char **argv) {
     int in_fd = -1;
     unsigned int i = 0;
-    int16_t buf[48000];
-    struct wwvunit *up = wwv_start(2);
-    l_fp l_curtime;
+    unsigned int blksiz = SECOND;
+    unsigned long nsamp = 0;
+    struct wwvunit *up;
+    struct capture *cp;
+    struct capblk *bp;
+    struct timespec last = {0, 0};
+    double dtemp, maxint = 0;
+    sigset_t sigs;
+    const char *statefile = NULL;
+    struct sigaction sa;
+    int acqmin = 0;
+    int tlmfd = -1;
+    int replay = 0;
+    long start = -1;
+    int c;
+
+    while ((c = getopt(argc, argv, "a:bn:rs:t:")) != -1) {
+        switch (c) {
+        case 'a':
+            acqmin = atoi(optarg);
+            break;
+        case 'b':
+            tlmfd = 1;
+            break;
+        case 'n':
+            blksiz = atoi(optarg);
+            break;
+        case 'r':
+            replay = 1;
+            break;
+        case 't':
+            start = atol(optarg);
+            break;
+        case 's':
+            statefile = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: wwv [-a 3-6] [-b] [-n blocksize] [-s statefile] file [file...]\n"
+                "       wwv -r [-a 3-6] [-b] [-n blocksize] [-t start] file\n");
+            return -1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (argc < 2) {
+        fprintf(stderr, "usage: wwv [-a 3-6] [-b] [-n blocksize] [-s statefile] file [file...]\n"
+                "       wwv -r [-a 3-6] [-b] [-n blocksize] [-t start] file\n");
+        return -1;
+    }
+    if (acqmin && argc > 2 && !replay) {
+        fprintf(stderr, "wwv: -a is not supported with multiple streams\n");
+        return -1;
+    }
+    if (blksiz < 1 || blksiz > CAPDEPTH) {
+        fprintf(stderr, "wwv: bad block size %u\n", blksiz);
+        return -1;
+    }
+    if (replay) {
+        statefile = NULL;
+    }
+    if (!(up = wwv_start(2, statefile))) {
+        return -1;
+    }
+    if (acqmin && wwv_acquire(up, acqmin) < 0) {
+        fprintf(stderr, "wwv: bad acquisition interval %d (%d to %d minutes)\n",
+            acqmin, AMIN, AMAX);
+        wwv_shutdown(2, up);
+        return -1;
+    }
+
+    /*
+     * SIGTERM interrupts the read, so the loop can save the state
+     * and exit.
+     */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigterm;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (replay) {
+        i = main_replay(up, argv[1], start, blksiz, tlmfd);
+        wwv_shutdown(2, up);
+        return i;
+    }
+    if (argc > 2) {
+        up->shmTime = getShmTime(3);
+        i = main_multi(up, argc - 1, argv + 1, statefile, tlmfd);
+        wwv_shutdown(2, up);
+        return i;
+    }
     if ((in_fd = open(argv[1], O_RDONLY)) < 0) {
+        perror(argv[1]);
+        wwv_shutdown(2, up);
         return -1;
     }
     up->shmTime = getShmTime(3);
-    while(1) {
-        if (read(in_fd, buf, 8000*sizeof(int16_t)) < 0) break;
-        get_systime(&l_curtime);
-        wwv_receive(up, buf, 8000, l_curtime);
-        i++;
+    if (!(cp = cap_start(in_fd, blksiz))) {
+        fprintf(stderr, "wwv: cannot start capture\n");
+        close(in_fd);
+        wwv_shutdown(2, up);
+        return -1;
+    }
+
+    /*
+     * SIGTERM goes to the capture thread, where it interrupts the
+     * read.
+     */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    while(!terminate) {
+        pthread_mutex_lock(&cp->lock);
+        while (cp->head == cp->tail && !cp->eof)
+            pthread_cond_wait(&cp->cond, &cp->lock);
+        if (cp->head == cp->tail) {
+            pthread_mutex_unlock(&cp->lock);
+            break;
+        }
+        pthread_mutex_unlock(&cp->lock);
+        bp = &cp->blk[cp->tail % cp->nblk];
+        if (cp->tail > 0) {
+            dtemp = (bp->mono.tv_sec - last.tv_sec) +
+                (bp->mono.tv_nsec - last.tv_nsec) * 1e-9;
+            if (dtemp > maxint)
+                maxint = dtemp;
+        }
+        last = bp->mono;
+        wwv_receive(up, bp->buf, blksiz, bp->recv_time);
+        tlm_drain(up->tlm, tlmfd);
+        pthread_mutex_lock(&cp->lock);
+        cp->tail++;
+        pthread_cond_broadcast(&cp->cond);
+        pthread_mutex_unlock(&cp->lock);
+        nsamp += blksiz;
+        if (statefile && nsamp / SECOND / SNAPINT !=
+            (nsamp - blksiz) / SECOND / SNAPINT)
+            wwv_save(up, statefile);
     }
+    cap_stop(cp, maxint);
+    tlm_drain(up->tlm, tlmfd);
+    if (statefile)
+        wwv_save(up, statefile);
     close(in_fd);
+    wwv_shutdown(2, up);
     return 0;
 }
+#endif /* NO_MAIN */
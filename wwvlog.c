@@ -0,0 +1,64 @@
+/*
+ * wwvlog.c - render binary WWV telemetry as text
+ *
+ * Reads the records written by "wwv -b" from a file or the standard
+ * input and prints them as the monitor lines the decoder prints itself
+ * without -b. All lines go to the standard output in the order they
+ * were queued; with -s the lines the decoder prints on its standard
+ * error go there instead.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "wwvtlm.h"
+
+#define NREC	256	/* records per read */
+
+int main(int argc, char **argv)
+{
+    const char *usage_str = "Usage: wwvlog [-s] [file]\n";
+    struct tlmrec rec[NREC];
+    char line[TLM_LINE];
+    int in_fd = 0, split = 0;
+    int option, fd, len;
+    ssize_t n, i;
+    size_t have = 0;
+
+    while ((option = getopt(argc, argv, "s")) != -1) {
+        switch (option) {
+        case 's':
+            split = 1;
+            break;
+        default:
+            write(2, usage_str, strlen(usage_str));
+            return 1;
+        }
+    }
+    if (optind < argc && (in_fd = open(argv[optind], O_RDONLY)) < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    /*
+     * A pipe can return part of a record, so keep the remainder for
+     * the next read.
+     */
+    while ((n = read(in_fd, (char *)rec + have, sizeof(rec) - have)) > 0) {
+        have += n;
+        for (i = 0; i < (ssize_t)(have / sizeof(struct tlmrec)); i++) {
+            if ((len = tlm_format(&rec[i], line, &fd)) == 0)
+                continue;
+            fwrite(line, 1, len, split && fd == 2 ? stderr : stdout);
+        }
+        n = have % sizeof(struct tlmrec);
+        memmove(rec, (char *)rec + have - n, n);
+        have = n;
+    }
+    if (have > 0)
+        fprintf(stderr, "wwvlog: %zu bytes of a partial record ignored\n", have);
+    return 0;
+}
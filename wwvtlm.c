@@ -0,0 +1,212 @@
+/*
+ * wwvtlm.c - WWV decoder telemetry ring and text rendering
+ *
+ * See wwvtlm.h. The consumer side lives here: tlm_drain() empties the
+ * ring in one batch, rendering the records into a buffer for each
+ * output stream and issuing one write per stream, or copying them out
+ * in binary with one write per contiguous run of the ring.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "wwvtlm.h"
+
+#define TLM_BUF		8192	/* text buffer per stream */
+
+/*
+ * tlm_create - allocate an empty ring
+ */
+struct tlmring *tlm_create(void)
+{
+	struct tlmring *rp;
+
+	if (!(rp = (struct tlmring *)aligned_alloc(64,
+	    sizeof(struct tlmring))))
+		return (NULL);
+	memset(rp, 0, sizeof(struct tlmring));
+	return (rp);
+}
+
+/*
+ * tlm_format - render a record as its monitor line
+ *
+ * The line goes in buf, which holds at least TLM_LINE characters, and
+ * the stream it belongs on (1 or 2) in fd. Returns the line length, or
+ * zero for an unknown record type.
+ */
+int tlm_format(const struct tlmrec *rec, char *buf, int *fd)
+{
+	int len;
+
+	*fd = 1;
+	switch (rec->type) {
+	case TLM_WWV1:
+		len = snprintf(buf, TLM_LINE - 1,
+		    "wwv1 %04x %3d %4d %5.0f %5.1f %5d %4d %4d %4d\n",
+		    rec->status, rec->gain, rec->u.wwv1.tepoch,
+		    rec->u.wwv1.epomax, rec->u.wwv1.eposnr, rec->u.wwv1.tmp2,
+		    rec->u.wwv1.avgcnt, rec->u.wwv1.syncnt,
+		    rec->u.wwv1.maxrun);
+		break;
+
+	case TLM_WWV2:
+		len = snprintf(buf, TLM_LINE - 1,
+		    "wwv2 %04x %5.0f %5.1f %5d %4d %4d %4d %4.0f %7.2f\n",
+		    rec->status, rec->u.wwv2.epomax, rec->u.wwv2.eposnr,
+		    rec->u.wwv2.mepoch, rec->u.wwv2.avgint,
+		    rec->u.wwv2.maxrun, rec->u.wwv2.mcount, rec->u.wwv2.dtemp,
+		    rec->u.wwv2.freq);
+		break;
+
+	case TLM_WWV3:
+		len = snprintf(buf, TLM_LINE - 1,
+		    "wwv3 %2d %04x %3d %4d %5.0f %5.1f %5.0f %5.1f %5.0f\n",
+		    rec->u.wwv3.nsec, rec->status, rec->gain,
+		    rec->u.wwv3.yepoch, rec->u.wwv3.epomax,
+		    rec->u.wwv3.eposnr, rec->u.wwv3.datsig,
+		    rec->u.wwv3.datsnr, rec->u.wwv3.bit);
+		break;
+
+	case TLM_WWV4:
+		len = snprintf(buf, TLM_LINE - 1,
+		    "wwv4 %2d %04x %3d %4d %5.0f %2d %d %d %d %5.0f %5.1f\n",
+		    rec->u.wwv4.rsec, rec->status, rec->gain,
+		    rec->u.wwv4.yepoch, rec->u.wwv4.epomax,
+		    rec->u.wwv4.radix, rec->u.wwv4.digit,
+		    rec->u.wwv4.mldigit, rec->u.wwv4.count,
+		    rec->u.wwv4.digprb, rec->u.wwv4.digsnr);
+		break;
+
+	case TLM_WWV8:
+		*fd = 2;
+		len = snprintf(buf, TLM_LINE - 1,
+		    "wwv8 %04x %3d %s %04x %.0f %.0f/%.1f %ld %ld\n",
+		    rec->status, rec->gain, rec->refid, rec->u.wwv8.reach,
+		    rec->u.wwv8.metric, rec->u.wwv8.synmax,
+		    rec->u.wwv8.synsnr, (long)rec->u.wwv8.pos,
+		    (long)rec->u.wwv8.epoch);
+		break;
+
+	case TLM_SAMPLE:
+		*fd = 2;
+		len = snprintf(buf, TLM_LINE - 1,
+		    "refclock_sample: n: %u offset: %.6f disp: %.6f jitter: %.6f\n",
+		    rec->u.sample.n, rec->u.sample.offset,
+		    rec->u.sample.disp, rec->u.sample.jitter);
+		break;
+
+	case TLM_DAY:
+		*fd = 2;
+		len = snprintf(buf, TLM_LINE - 1, "offset: %lu\n",
+		    (unsigned long)rec->u.day.offset);
+		break;
+
+	case TLM_TIMECODE:
+		len = snprintf(buf, TLM_LINE - 1,
+		    "| %1X %4d %02d %02d %02u:%02u:%02u  | %d %d %s %.0f %d %.1f %d |\n",
+		    rec->u.timecode.alarm, rec->u.timecode.year,
+		    rec->u.timecode.month, rec->u.timecode.mday,
+		    rec->u.timecode.hour, rec->u.timecode.minute, 0,
+		    rec->u.timecode.watch, rec->gain, rec->refid,
+		    rec->u.timecode.metric, rec->u.timecode.errcnt,
+		    rec->u.timecode.freq, rec->u.timecode.avgint);
+		break;
+
+	default:
+		return (0);
+	}
+	if (len > TLM_LINE - 1)
+		len = TLM_LINE - 1;
+	return (len);
+}
+
+/*
+ * tlm_write - write all of a buffer, resuming after a short write.
+ * Returns 0 if successful, -1 on error.
+ */
+static int tlm_write(int fd, const void *buf, size_t len)
+{
+	const char *ptr = (const char *)buf;
+	ssize_t	n;
+
+	while (len > 0) {
+		if ((n = write(fd, ptr, len)) < 0)
+			return (-1);
+		ptr += n;
+		len -= n;
+	}
+	return (0);
+}
+
+/*
+ * tlm_drain - empty the ring
+ *
+ * If fd is negative, the records are rendered and written to stdout
+ * and stderr; otherwise they are written to fd in binary. A count of
+ * records dropped since the last drain goes to stderr in either case.
+ * Returns the number of records drained.
+ */
+unsigned int tlm_drain(struct tlmring *rp, int fd)
+{
+	char	text[2][TLM_BUF];	/* stdout and stderr buffers */
+	int	tlen[2] = {0, 0};
+	unsigned int head, tail, n, drops;
+	int	i, out;
+
+	head = __atomic_load_n(&rp->head, __ATOMIC_ACQUIRE);
+	tail = rp->tail;
+	n = head - tail;
+	if (fd >= 0) {
+		while (tail != head) {
+			i = tail & (TLM_RING - 1);
+			out = head - tail;
+			if (out > TLM_RING - i)
+				out = TLM_RING - i;
+			if (tlm_write(fd, &rp->rec[i], out *
+			    sizeof(struct tlmrec)) < 0)
+				break;
+			tail += out;
+		}
+		tail = head;
+	} else {
+		for (; tail != head; tail++) {
+			i = tail & (TLM_RING - 1);
+			if (tlen[0] > TLM_BUF - TLM_LINE) {
+				tlm_write(1, text[0], tlen[0]);
+				tlen[0] = 0;
+			}
+			if (tlen[1] > TLM_BUF - TLM_LINE) {
+				tlm_write(2, text[1], tlen[1]);
+				tlen[1] = 0;
+			}
+			out = 1;
+			i = tlm_format(&rp->rec[i], text[0] + tlen[0], &out);
+			if (out == 2) {
+				memcpy(text[1] + tlen[1], text[0] + tlen[0], i);
+				tlen[1] += i;
+			} else {
+				tlen[0] += i;
+			}
+		}
+	}
+	__atomic_store_n(&rp->tail, tail, __ATOMIC_RELEASE);
+	drops = __atomic_load_n(&rp->drops, __ATOMIC_RELAXED);
+	if (drops != rp->ndrop) {
+		if (tlen[1] > TLM_BUF - TLM_LINE) {
+			tlm_write(2, text[1], tlen[1]);
+			tlen[1] = 0;
+		}
+		i = snprintf(text[1] + tlen[1], TLM_BUF - tlen[1],
+		    "tlm: %u records dropped\n", drops - rp->ndrop);
+		if (i > TLM_BUF - 1 - tlen[1])
+			i = TLM_BUF - 1 - tlen[1];
+		tlen[1] += i;
+		rp->ndrop = drops;
+	}
+	if (tlen[0] > 0)
+		tlm_write(1, text[0], tlen[0]);
+	if (tlen[1] > 0)
+		tlm_write(2, text[1], tlen[1]);
+	return (n);
+}
@@ -0,0 +1,169 @@
+/*
+ * wwvtlm.h - WWV decoder telemetry records
+ *
+ * The decoder does not format and write its monitor lines from the
+ * sample path. Each line is queued instead as a fixed-size binary
+ * record on a single-producer, single-consumer ring, which the main
+ * loop drains between buffers. The drain either renders the records as
+ * the usual text lines or passes them on in binary, to be rendered
+ * later by wwvlog. If the consumer falls behind, records are dropped
+ * and counted, so a stalled terminal or pipe never holds up the
+ * decoder.
+ *
+ * The binary records are in host byte order and layout, so they are
+ * for wwvlog on the same kind of machine.
+ */
+#ifndef WWVTLM_H
+#define WWVTLM_H
+
+#include <stdint.h>
+
+#define TLM_RING	1024	/* ring size (records, power of 2) */
+#define TLM_LINE	128	/* max rendered line length */
+
+/*
+ * Record types. The comments give the text line each one renders as.
+ */
+enum {
+	TLM_WWV1 = 1,		/* "wwv1", second sync (stdout) */
+	TLM_WWV2,		/* "wwv2", frequency update (stdout) */
+	TLM_WWV3,		/* "wwv3", data bit (stdout) */
+	TLM_WWV4,		/* "wwv4", digit likelihood (stdout) */
+	TLM_WWV8,		/* "wwv8", minute sync (stderr) */
+	TLM_SAMPLE,		/* "refclock_sample", offset filter (stderr) */
+	TLM_DAY,		/* "offset", day of year (stderr) */
+	TLM_TIMECODE		/* timecode (stdout) */
+};
+
+struct tlmrec {
+	uint8_t	type;		/* record type */
+	char	refid[5];	/* station identifier (wwv8, timecode) */
+	int32_t	status;		/* status bits */
+	int32_t	gain;		/* codec gain */
+	union {
+		struct {
+			int32_t	tepoch;	/* current second epoch */
+			int32_t	tmp2;	/* epoch difference */
+			int32_t	avgcnt;	/* averaging interval counter */
+			int32_t	syncnt;	/* run length counter */
+			int32_t	maxrun;	/* longest run length */
+			float	epomax;	/* second sync amplitude */
+			float	eposnr;	/* second sync SNR */
+		} wwv1;
+		struct {
+			int32_t	mepoch;	/* longest run end epoch */
+			int32_t	avgint;	/* master time constant */
+			int32_t	maxrun;	/* longest run length */
+			int32_t	mcount;	/* run end time difference */
+			float	epomax;	/* second sync amplitude */
+			float	eposnr;	/* second sync SNR */
+			float	dtemp;	/* frequency error */
+			double	freq;	/* frequency (PPM) */
+		} wwv2;
+		struct {
+			int32_t	nsec;	/* second of minute */
+			int32_t	yepoch;	/* sync epoch */
+			float	epomax;	/* second sync amplitude */
+			float	eposnr;	/* second sync SNR */
+			float	datsig;	/* data signal max */
+			float	datsnr;	/* data signal SNR (dB) */
+			float	bit;	/* bit likelihood */
+		} wwv3;
+		struct {
+			int32_t	rsec;	/* second of minute */
+			int32_t	yepoch;	/* sync epoch */
+			int32_t	radix;	/* digit radix */
+			int32_t	digit;	/* current clock digit */
+			int32_t	mldigit; /* max likelihood digit */
+			int32_t	count;	/* match count */
+			float	epomax;	/* second sync amplitude */
+			float	digprb;	/* max digit probability */
+			float	digsnr;	/* likelihood function (dB) */
+		} wwv4;
+		struct {
+			int32_t	reach;	/* reachability register */
+			int32_t	pos;	/* position in second */
+			int32_t	epoch;	/* minute sync epoch */
+			float	metric;	/* signal quality metric */
+			float	synmax;	/* sync signal max */
+			float	synsnr;	/* sync signal SNR */
+		} wwv8;
+		struct {
+			uint32_t n;	/* samples in the filter */
+			double	offset;	/* trimmed mean offset */
+			double	disp;	/* dispersion */
+			double	jitter;	/* jitter */
+		} sample;
+		struct {
+			int64_t	offset;	/* start of day (s) */
+		} day;
+		struct {
+			int32_t	alarm;	/* alarm flashers */
+			uint16_t year;	/* year */
+			uint8_t	month;	/* month */
+			uint8_t	mday;	/* day of month */
+			uint8_t	hour;	/* hour */
+			uint8_t	minute;	/* minute */
+			int32_t	watch;	/* watchcat */
+			int32_t	errcnt;	/* data bit error counter */
+			int32_t	avgint;	/* master time constant */
+			float	metric;	/* signal quality metric */
+			double	freq;	/* frequency (PPM) */
+		} timecode;
+	} u;
+};
+
+/*
+ * The ring indices are free-running and each sits on its own cache
+ * line, so the producer and consumer do not share a line they write.
+ */
+struct tlmring {
+	unsigned int	head __attribute__((aligned(64))); /* producer */
+	unsigned int	drops;		/* records dropped, ring full */
+	unsigned int	tail __attribute__((aligned(64))); /* consumer */
+	unsigned int	ndrop;		/* drops already reported */
+	struct tlmrec	rec[TLM_RING];	/* records */
+};
+
+/*
+ * tlm_alloc - return the next free record, or NULL if the ring is full
+ *
+ * The producer fills the record in place and then calls tlm_commit().
+ */
+static inline struct tlmrec *tlm_alloc(struct tlmring *rp)
+{
+	unsigned int tail;
+
+	if (rp == NULL)
+		return (NULL);
+	tail = __atomic_load_n(&rp->tail, __ATOMIC_ACQUIRE);
+	if (rp->head - tail >= TLM_RING) {
+		__atomic_store_n(&rp->drops, rp->drops + 1, __ATOMIC_RELAXED);
+		return (NULL);
+	}
+	return (&rp->rec[rp->head & (TLM_RING - 1)]);
+}
+
+static inline void tlm_commit(struct tlmring *rp)
+{
+	__atomic_store_n(&rp->head, rp->head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * tlm_put - queue a copy of a record built elsewhere
+ */
+static inline void tlm_put(struct tlmring *rp, const struct tlmrec *rec)
+{
+	struct tlmrec *tp;
+
+	if ((tp = tlm_alloc(rp)) != NULL) {
+		*tp = *rec;
+		tlm_commit(rp);
+	}
+}
+
+struct tlmring *tlm_create(void);
+int tlm_format(const struct tlmrec *rec, char *buf, int *fd);
+unsigned int tlm_drain(struct tlmring *rp, int fd);
+
+#endif /* WWVTLM_H */